@@ -26,10 +26,6 @@ ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "ast.h"
 
-ast_t * root;
-
-ast_t * ast_nil;
-
 ast_t * new_ast()
 {
    ast_t * ast = GC_MALLOC(sizeof(ast_t));
@@ -39,8 +35,8 @@ ast_t * new_ast()
 
 void ast_init()
 {
-    ast_nil = new_ast();
-    ast_nil->tag = AST_NONE;
+    ctx->ast_nil = new_ast();
+    ctx->ast_nil->tag = AST_NONE;
 }
 
 ast_t * ast0(tag_t tag)
@@ -103,6 +99,7 @@ ast_t * ast_symbol(tag_t tag, sym_t * sym)
    ast_t * ast = new_ast();
    ast->tag = tag;
    ast->sym = sym;
+   return ast;
 }
 
 void ast_print(ast_t * ast, int indent)
@@ -157,6 +154,20 @@ void ast_print(ast_t * ast, int indent)
          ast_print(ast->child, indent + 3);
          ast_print(ast->child->next, indent);
          break;
+      case AST_FOR_STMT:
+      case AST_PARFOR_STMT:
+         printf(ast->tag == AST_FOR_STMT ? "for\n" : "parallel for\n");
+         a = ast->child;
+         while (a != NULL)
+         {
+            ast_print(a, indent + 3);
+            a = a->next;
+         }
+         break;
+      case AST_REDUCE:
+         printf("reduction %s\n", ast->sym->name);
+         ast_print(ast->child, indent + 3);
+         break;
       case AST_BREAK:
          printf("break\n");
          break;
@@ -222,6 +233,25 @@ void ast_print(ast_t * ast, int indent)
          ast_print(ast->child, indent + 3);
          ast_print(ast->child->next, indent + 3);
          break;
+      case AST_CONST:
+         printf("const\n");
+         ast_print(ast->child, indent + 3);
+         ast_print(ast->child->next, indent + 3);
+         break;
+      case AST_MAP:
+      case AST_FILTER:
+      case AST_ARRAY_REDUCE:
+      case AST_SEND:
+      case AST_RECV:
+      case AST_CLOSE:
+         printf("%s\n", ast->child->sym->name);
+         a = ast->child->next;
+         while (a != NULL)
+         {
+            ast_print(a, indent + 3);
+            a = a->next;
+         }
+         break;
       case AST_APPL:
       case AST_LAPPL:
          printf("appl\n");
@@ -232,7 +262,13 @@ void ast_print(ast_t * ast, int indent)
             a = a->next;
          }
          break;
+      case AST_CHAN_CONSTRUCTOR:
+         printf("chan_constructor");
+         ast_print(ast->child, indent + 3);
+         ast_print(ast->child->next, indent + 3);
+         break;
       case AST_ARRAY_CONSTRUCTOR:
+      case AST_LOCAL_ARRAY_CONSTRUCTOR:
          printf("array_constructor");
          ast_print(ast->child, indent + 3);
          ast_print(ast->child->next, indent + 3);
@@ -240,6 +276,14 @@ void ast_print(ast_t * ast, int indent)
          printf("array");
          ast_print(ast->child, indent + 3);
          break;
+      case AST_FUTURE_TYPE:
+         printf("future");
+         ast_print(ast->child, indent + 3);
+         break;
+      case AST_CHAN_TYPE:
+         printf("chan");
+         ast_print(ast->child, indent + 3);
+         break;
       case AST_SLOT:
       case AST_LSLOT:
          printf("slot\n");
@@ -270,6 +314,25 @@ void ast_print(ast_t * ast, int indent)
          printf("return\n");
          ast_print(ast->child, indent + 3);
          break;
+      case AST_SPAWN:
+         printf("spawn\n");
+         ast_print(ast->child, indent + 3);
+         break;
+      case AST_AWAIT:
+         printf("await\n");
+         ast_print(ast->child, indent + 3);
+         break;
+      case AST_BACKGROUND:
+         printf("background\n");
+         ast_print(ast->child, indent + 3);
+         break;
+      case AST_COMMAND:
+         printf(":%s\n", ast->sym->name);
+         break;
+      case AST_INT_TO_ZZ:
+         printf("int_to_ZZ\n");
+         ast_print(ast->child, indent + 3);
+         break;
       default:
          printf("%d\n", ast->tag);
          exception("invalid AST tag in ast_print\n");
@@ -35,6 +35,7 @@ ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "symbol.h"
 #include "types.h"
 #include "environment.h"
+#include "context.h"
 
 #ifndef AST_H
 #define AST_H
@@ -59,7 +60,13 @@ typedef enum
    AST_ARRAY_CONSTRUCTOR, AST_ARRAY_TYPE,
    AST_IDENT, AST_TUPLE, AST_SLOT, AST_LOCN, AST_APPL,
    AST_LIDENT, AST_LTUPLE, AST_LSLOT, AST_LLOCN, AST_LAPPL,
-   AST_FN_BODY
+   AST_FN_BODY, AST_LOCAL_ARRAY_CONSTRUCTOR,
+   AST_COMMAND, AST_INT_TO_ZZ, AST_CONST,
+   AST_FOR_STMT, AST_PARFOR_STMT, AST_REDUCE,
+   AST_MAP, AST_FILTER, AST_ARRAY_REDUCE,
+   AST_SPAWN, AST_AWAIT, AST_FUTURE_TYPE,
+   AST_CHAN_CONSTRUCTOR, AST_CHAN_TYPE, AST_SEND, AST_RECV, AST_CLOSE,
+   AST_BACKGROUND
 } tag_t;
 
 typedef struct ast_t
@@ -72,10 +79,6 @@ typedef struct ast_t
    env_t * env;
 } ast_t;
 
-extern ast_t * root;
-
-extern ast_t * ast_nil;
-
 ast_t * new_ast();
 
 void ast_init();
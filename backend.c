@@ -25,10 +25,16 @@ ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
 #include "backend.h"
+#include "pipe.h"
+#include "bg.h"
+#include "eager.h"
+#include "batch.h"
 
 #define CS_MALLOC "GC_malloc"
 #define CS_REALLOC "GC_realloc"
 #define CS_MALLOC_ATOMIC "GC_malloc_atomic"
+#define CS_MALLOC_TYPED "GC_malloc_explicitly_typed"
+#define CS_CALLOC_TYPED "GC_calloc_explicitly_typed"
 
 /**********************************************************************
 
@@ -36,13 +42,11 @@ ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 **********************************************************************/
 
-loc_t ** loc_tab;
-
 void loc_tab_init(void)
 {
    long i;
    
-   loc_tab = (loc_t **) GC_MALLOC(LOC_TAB_SIZE*sizeof(loc_t *));
+   ctx->loc_tab = (loc_t **) GC_MALLOC(LOC_TAB_SIZE*sizeof(loc_t *));
 }
 
 loc_t * new_loc(const char * name, int length, LLVMValueRef llvm_val)
@@ -69,7 +73,7 @@ void loc_insert(const char * name, LLVMValueRef llvm_val)
    int hash = loc_hash(name, length);
    loc_t * loc;
 
-   while (loc_tab[hash])
+   while (ctx->loc_tab[hash])
    {
        hash++;
        if (hash == LOC_TAB_SIZE)
@@ -77,7 +81,7 @@ void loc_insert(const char * name, LLVMValueRef llvm_val)
    }
 
    loc = new_loc(name, length, llvm_val);
-   loc_tab[hash] = loc;
+   ctx->loc_tab[hash] = loc;
 }
 
 LLVMValueRef loc_lookup(const char * name)
@@ -85,10 +89,10 @@ LLVMValueRef loc_lookup(const char * name)
    int length = strlen(name);
    int hash = loc_hash(name, length);
    
-   while (loc_tab[hash])
+   while (ctx->loc_tab[hash])
    {
-       if (strcmp(loc_tab[hash]->name, name) == 0)
-           return loc_tab[hash]->llvm_val;
+       if (strcmp(ctx->loc_tab[hash]->name, name) == 0)
+           return ctx->loc_tab[hash]->llvm_val;
        hash++;
        if (hash == LOC_TAB_SIZE)
            hash = 0;
@@ -110,43 +114,247 @@ LLVMValueRef loc_lookup(const char * name)
 void llvm_functions(jit_t * jit)
 {
    LLVMTypeRef args[2];
+   LLVMTypeRef args3[3];
+   LLVMTypeRef args4[4];
    LLVMTypeRef fntype; 
    LLVMTypeRef ret;
    LLVMValueRef fn;
 
    /* patch in the printf function */
-   args[0] = LLVMPointerType(LLVMInt8Type(), 0);
+   args[0] = LLVMPointerType(LLVMInt8TypeInContext(jit->context), 0);
    ret = LLVMWordType();
    fntype = LLVMFunctionType(ret, args, 1, 1);
    fn = LLVMAddFunction(jit->module, "printf", fntype);
 
    /* patch in the exit function */
    args[0] = LLVMWordType();
-   ret = LLVMVoidType();
+   ret = LLVMVoidTypeInContext(jit->context);
    fntype = LLVMFunctionType(ret, args, 1, 0);
    fn = LLVMAddFunction(jit->module, "exit", fntype);
 
    /* patch in the GC_malloc function */
    args[0] = LLVMWordType();
-   ret = LLVMPointerType(LLVMInt8Type(), 0);
+   ret = LLVMPointerType(LLVMInt8TypeInContext(jit->context), 0);
    fntype = LLVMFunctionType(ret, args, 1, 0);
    fn = LLVMAddFunction(jit->module, CS_MALLOC, fntype);
    LLVMAddFunctionAttr(fn, LLVMNoAliasAttribute);
 
    /* patch in the GC_realloc function */
-   args[0] = LLVMPointerType(LLVMInt8Type(), 0);
+   args[0] = LLVMPointerType(LLVMInt8TypeInContext(jit->context), 0);
    args[1] = LLVMWordType();
-   ret = LLVMPointerType(LLVMInt8Type(), 0);
+   ret = LLVMPointerType(LLVMInt8TypeInContext(jit->context), 0);
    fntype = LLVMFunctionType(ret, args, 2, 0);
    fn = LLVMAddFunction(jit->module, CS_REALLOC, fntype);
    LLVMAddFunctionAttr(fn, LLVMNoAliasAttribute);
 
    /* patch in the GC_malloc_atomic function */
    args[0] = LLVMWordType();
-   ret = LLVMPointerType(LLVMInt8Type(), 0);
+   ret = LLVMPointerType(LLVMInt8TypeInContext(jit->context), 0);
    fntype = LLVMFunctionType(ret, args, 1, 0);
    fn = LLVMAddFunction(jit->module, CS_MALLOC_ATOMIC, fntype);
    LLVMAddFunctionAttr(fn, LLVMNoAliasAttribute);
+
+   /* patch in the GC_malloc_explicitly_typed function */
+   args[0] = LLVMWordType();
+   args[1] = LLVMWordType();
+   ret = LLVMPointerType(LLVMInt8TypeInContext(jit->context), 0);
+   fntype = LLVMFunctionType(ret, args, 2, 0);
+   fn = LLVMAddFunction(jit->module, CS_MALLOC_TYPED, fntype);
+   LLVMAddFunctionAttr(fn, LLVMNoAliasAttribute);
+
+   /* patch in the GC_calloc_explicitly_typed function */
+   args3[0] = LLVMWordType();
+   args3[1] = LLVMWordType();
+   args3[2] = LLVMWordType();
+   ret = LLVMPointerType(LLVMInt8TypeInContext(jit->context), 0);
+   fntype = LLVMFunctionType(ret, args3, 3, 0);
+   fn = LLVMAddFunction(jit->module, CS_CALLOC_TYPED, fntype);
+   LLVMAddFunctionAttr(fn, LLVMNoAliasAttribute);
+
+   /* patch in the memcpy function */
+   args3[0] = LLVMPointerType(LLVMInt8TypeInContext(jit->context), 0);
+   args3[1] = LLVMPointerType(LLVMInt8TypeInContext(jit->context), 0);
+   args3[2] = LLVMWordType();
+   ret = LLVMPointerType(LLVMInt8TypeInContext(jit->context), 0);
+   fntype = LLVMFunctionType(ret, args3, 3, 0);
+   fn = LLVMAddFunction(jit->module, "memcpy", fntype);
+
+   /* patch in the memset function */
+   args3[1] = LLVMInt32TypeInContext(jit->context);
+   fntype = LLVMFunctionType(ret, args3, 3, 0);
+   fn = LLVMAddFunction(jit->module, "memset", fntype);
+
+   /* patch in the overflow checked word arithmetic intrinsics */
+   args[0] = LLVMWordType();
+   args[1] = LLVMInt1TypeInContext(jit->context);
+   ret = LLVMStructTypeInContext(jit->context, args, 2, 0);
+   args[1] = LLVMWordType();
+   fntype = LLVMFunctionType(ret, args, 2, 0);
+   fn = LLVMAddFunction(jit->module, "llvm.sadd.with.overflow." LLVM_WORD, fntype);
+   fn = LLVMAddFunction(jit->module, "llvm.ssub.with.overflow." LLVM_WORD, fntype);
+   fn = LLVMAddFunction(jit->module, "llvm.smul.with.overflow." LLVM_WORD, fntype);
+
+   /* patch in the pow intrinsic */
+   args[0] = LLVMDoubleTypeInContext(jit->context);
+   args[1] = LLVMDoubleTypeInContext(jit->context);
+   ret = LLVMDoubleTypeInContext(jit->context);
+   fntype = LLVMFunctionType(ret, args, 2, 0);
+   fn = LLVMAddFunction(jit->module, "llvm.pow.f64", fntype);
+
+   /* patch in the count of allocations made by jit'd code */
+   LLVMValueRef stats = LLVMAddGlobal(jit->module, LLVMInt32TypeInContext(jit->context), "gc_stats");
+   LLVMAddGlobalMapping(jit->engine, stats, &gc_stats);
+
+   fntype = LLVMFunctionType(LLVMVoidTypeInContext(jit->context), NULL, 0, 0);
+   fn = LLVMAddFunction(jit->module, "gc_count", fntype);
+   LLVMAddGlobalMapping(jit->engine, fn, gc_count);
+
+   /* patch in the thread pool used by parallel for */
+   args4[0] = LLVMPointerType(LLVMInt8TypeInContext(jit->context), 0);
+   args4[1] = LLVMPointerType(LLVMInt8TypeInContext(jit->context), 0);
+   args4[2] = LLVMWordType();
+   args4[3] = LLVMWordType();
+   fntype = LLVMFunctionType(LLVMVoidTypeInContext(jit->context), args4, 4, 0);
+   fn = LLVMAddFunction(jit->module, "pool_for", fntype);
+   LLVMAddGlobalMapping(jit->engine, fn, pool_for);
+
+   fntype = LLVMFunctionType(LLVMVoidTypeInContext(jit->context), NULL, 0, 0);
+   fn = LLVMAddFunction(jit->module, "pool_lock", fntype);
+   LLVMAddGlobalMapping(jit->engine, fn, pool_lock);
+   fn = LLVMAddFunction(jit->module, "pool_unlock", fntype);
+   LLVMAddGlobalMapping(jit->engine, fn, pool_unlock);
+
+   args[0] = LLVMWordType();
+   fntype = LLVMFunctionType(LLVMWordType(), args, 1, 0);
+   fn = LLVMAddFunction(jit->module, "pool_blocks", fntype);
+   LLVMAddGlobalMapping(jit->engine, fn, pool_blocks);
+
+   /* patch in the task functions used by spawn and await */
+   args[0] = LLVMPointerType(LLVMInt8TypeInContext(jit->context), 0);
+   args[1] = LLVMPointerType(LLVMInt8TypeInContext(jit->context), 0);
+   fntype = LLVMFunctionType(LLVMPointerType(LLVMInt8TypeInContext(jit->context), 0), args, 2, 0);
+   fn = LLVMAddFunction(jit->module, "pool_spawn", fntype);
+   LLVMAddGlobalMapping(jit->engine, fn, pool_spawn);
+
+   fntype = LLVMFunctionType(LLVMPointerType(LLVMInt8TypeInContext(jit->context), 0), args, 1, 0);
+   fn = LLVMAddFunction(jit->module, "pool_await", fntype);
+   LLVMAddGlobalMapping(jit->engine, fn, pool_await);
+
+   /* patch in the channel functions */
+   args[0] = LLVMWordType();
+   args[1] = LLVMWordType();
+   fntype = LLVMFunctionType(LLVMPointerType(LLVMInt8TypeInContext(jit->context), 0), args, 2, 0);
+   fn = LLVMAddFunction(jit->module, "chan_new", fntype);
+   LLVMAddGlobalMapping(jit->engine, fn, chan_new);
+
+   args[0] = LLVMPointerType(LLVMInt8TypeInContext(jit->context), 0);
+   args[1] = LLVMPointerType(LLVMInt8TypeInContext(jit->context), 0);
+   fntype = LLVMFunctionType(LLVMVoidTypeInContext(jit->context), args, 2, 0);
+   fn = LLVMAddFunction(jit->module, "chan_send", fntype);
+   LLVMAddGlobalMapping(jit->engine, fn, chan_send);
+
+   fntype = LLVMFunctionType(LLVMInt32TypeInContext(jit->context), args, 2, 0);
+   fn = LLVMAddFunction(jit->module, "chan_recv", fntype);
+   LLVMAddGlobalMapping(jit->engine, fn, chan_recv);
+
+   fntype = LLVMFunctionType(LLVMVoidTypeInContext(jit->context), args, 1, 0);
+   fn = LLVMAddFunction(jit->module, "chan_close", fntype);
+   LLVMAddGlobalMapping(jit->engine, fn, chan_close);
+
+   /* patch in the cancellation of background jobs */
+   LLVMValueRef cancel = LLVMAddGlobal(jit->module, LLVMInt32TypeInContext(jit->context), "bg_cancel");
+   LLVMAddGlobalMapping(jit->engine, cancel, (void *) &bg_cancel);
+
+   fntype = LLVMFunctionType(LLVMVoidTypeInContext(jit->context), NULL, 0, 0);
+   fn = LLVMAddFunction(jit->module, "bg_check", fntype);
+   LLVMAddGlobalMapping(jit->engine, fn, bg_check);
+}
+
+/*
+   Link the runtime helpers, compiled to bitcode, into the module so 
+   that they can be inlined into jit'd code. The path can be overridden
+   with BACON_RUNTIME. Without the bitcode, we just call the copies of 
+   the helpers compiled into bacon.
+*/
+void runtime_link(jit_t * jit)
+{
+    LLVMMemoryBufferRef buf;
+    LLVMModuleRef rt;
+    LLVMValueRef fn;
+    char * msg = NULL;
+    const char * path = getenv("BACON_RUNTIME");
+
+    if (path == NULL)
+       path = RUNTIME_BC;
+
+    if (LLVMCreateMemoryBufferWithContentsOfFile(path, &buf, &msg) != 0)
+    {
+       LLVMDisposeMessage(msg);
+       return;
+    }
+
+    if (LLVMParseBitcodeInContext(jit->context, buf, &rt, &msg) != 0)
+    {
+       fprintf(stderr, "Unable to read %s: %s\n", path, msg);
+       LLVMDisposeMessage(msg);
+       LLVMDisposeMemoryBuffer(buf);
+       return;
+    }
+
+    LLVMDisposeMemoryBuffer(buf);
+
+    /* the helpers are tiny, so always inline them */
+    for (fn = LLVMGetFirstFunction(rt); fn != NULL; fn = LLVMGetNextFunction(fn))
+       if (!LLVMIsDeclaration(fn))
+          LLVMAddFunctionAttr(fn, LLVMAlwaysInlineAttribute);
+
+    if (LLVMLinkModules(jit->module, rt, LLVMLinkerDestroySource, &msg) != 0)
+    {
+       fprintf(stderr, "Unable to link %s: %s\n", path, msg);
+       LLVMDisposeMessage(msg);
+    }
+}
+
+/*
+   Set up LLVM for use by engines in any number of threads
+*/
+pthread_once_t llvm_once = PTHREAD_ONCE_INIT;
+
+void llvm_start(void)
+{
+    LLVMStartMultithreaded();
+    LLVMLinkInJIT();
+    LLVMInitializeNativeTarget();
+}
+
+/*
+   Add the optimisation passes run on each jit'd function to a pass
+   manager for a module of the given engine
+*/
+void jit_add_passes(LLVMPassManagerRef pass, LLVMExecutionEngineRef engine)
+{
+    LLVMAddTargetData(LLVMGetExecutionEngineTargetData(engine), pass);  
+    LLVMAddAggressiveDCEPass(pass); /* */
+    LLVMAddDeadStoreEliminationPass(pass); 
+    LLVMAddIndVarSimplifyPass(pass); 
+    LLVMAddJumpThreadingPass(pass); 
+    LLVMAddLICMPass(pass); 
+    LLVMAddLoopDeletionPass(pass); 
+    LLVMAddLoopRotatePass(pass); 
+    LLVMAddLoopUnrollPass(pass); 
+    LLVMAddLoopUnswitchPass(pass);
+    LLVMAddMemCpyOptPass(pass); 
+    LLVMAddReassociatePass(pass); 
+    LLVMAddSCCPPass(pass); 
+    LLVMAddScalarReplAggregatesPass(pass); 
+    LLVMAddSimplifyLibCallsPass(pass);
+    LLVMAddTailCallEliminationPass(pass); 
+    LLVMAddDemoteMemoryToRegisterPass(pass); /* */ 
+    LLVMAddConstantPropagationPass(pass);  
+    LLVMAddInstructionCombiningPass(pass);  
+    LLVMAddPromoteMemoryToRegisterPass(pass);  
+    LLVMAddGVNPass(pass);  
+    LLVMAddCFGSimplificationPass(pass);
 }
 
 /*
@@ -160,11 +368,13 @@ jit_t * llvm_init(void)
     jit_t * jit = (jit_t *) GC_MALLOC(sizeof(jit_t));
 
     /* Jit setup */
-    LLVMLinkInJIT();
-    LLVMInitializeNativeTarget();
+    pthread_once(&llvm_once, llvm_start);
+
+    jit->context = LLVMContextCreate();
+    pthread_mutex_init(&jit->lock, NULL);
 
     /* Create module */
-    jit->module = LLVMModuleCreateWithName("cesium");
+    jit->module = LLVMModuleCreateWithNameInContext("cesium", jit->context);
 
     /* Create JIT engine */
     if (LLVMCreateJITCompilerForModule(&(jit->engine), jit->module, 2, &error) != 0) 
@@ -176,28 +386,14 @@ jit_t * llvm_init(void)
    
     /* Create optimisation pass pipeline */
     jit->pass = LLVMCreateFunctionPassManagerForModule(jit->module);  
-    LLVMAddTargetData(LLVMGetExecutionEngineTargetData(jit->engine), jit->pass);  
-    LLVMAddAggressiveDCEPass(jit->pass); /* */
-    LLVMAddDeadStoreEliminationPass(jit->pass); 
-    LLVMAddIndVarSimplifyPass(jit->pass); 
-    LLVMAddJumpThreadingPass(jit->pass); 
-    LLVMAddLICMPass(jit->pass); 
-    LLVMAddLoopDeletionPass(jit->pass); 
-    LLVMAddLoopRotatePass(jit->pass); 
-    LLVMAddLoopUnrollPass(jit->pass); 
-    LLVMAddLoopUnswitchPass(jit->pass);
-    LLVMAddMemCpyOptPass(jit->pass); 
-    LLVMAddReassociatePass(jit->pass); 
-    LLVMAddSCCPPass(jit->pass); 
-    LLVMAddScalarReplAggregatesPass(jit->pass); 
-    LLVMAddSimplifyLibCallsPass(jit->pass);
-    LLVMAddTailCallEliminationPass(jit->pass); 
-    LLVMAddDemoteMemoryToRegisterPass(jit->pass); /* */ 
-    LLVMAddConstantPropagationPass(jit->pass);  
-    LLVMAddInstructionCombiningPass(jit->pass);  
-    LLVMAddPromoteMemoryToRegisterPass(jit->pass);  
-    LLVMAddGVNPass(jit->pass);  
-    LLVMAddCFGSimplificationPass(jit->pass);
+    jit_add_passes(jit->pass, jit->engine);
+
+    /* inline runtime helpers and small functions before the function passes run */
+    jit->inliner = LLVMCreatePassManager();
+    LLVMAddAlwaysInlinerPass(jit->inliner);
+    LLVMAddFunctionInliningPass(jit->inliner);
+    
+    runtime_link(jit);
 
     /* patch in some external functions */
     llvm_functions(jit);
@@ -211,12 +407,111 @@ jit_t * llvm_init(void)
 */
 void llvm_reset(jit_t * jit)
 {
+    fn_list_t ** f;
+
     if (jit->function)
+    {
+       for (f = &jit->defs; *f != NULL; f = &(*f)->next)
+       {
+          if ((*f)->fn == jit->function) /* don't leave it to jit_abandon */
+          {
+             (*f)->type->llvm = NULL;
+             *f = (*f)->next;
+             break;
+          }
+       }
        LLVMDeleteFunction(jit->function);
+    }
     if (jit->builder)
        LLVMDisposeBuilder(jit->builder);
     jit->function = NULL;
     jit->builder = NULL;
+    jit->pending = NULL;
+    jit->snapping = 0;
+    jit->snap_fns = NULL;
+    jit->compiling = 0;
+    jit->snap = NULL;
+}
+
+/*
+   The thread holding the jit, if any, and so the compiler state of 
+   its engine
+*/
+__thread jit_t * jit_held = NULL;
+
+/*
+   Take the jit, waiting while another thread of the engine uses it
+*/
+void jit_lock(jit_t * jit)
+{
+    pthread_mutex_lock(&jit->lock);
+    jit_held = jit;
+}
+
+/*
+   Give up the jit if this thread holds it, e.g. after an exception. 
+   Returns 1 if it was held.
+*/
+int jit_unlock(jit_t * jit)
+{
+    if (jit_held != jit)
+       return 0;
+
+    jit_held = NULL;
+    pthread_mutex_unlock(&jit->lock);
+
+    return 1;
+}
+
+/*
+   Delete the functions defined since the last statement began, after
+   an exception interrupted the jit'ing of one of them. Their types are
+   reset so they will be jit'd afresh when next called.
+*/
+void jit_abandon(jit_t * jit)
+{
+    fn_list_t * f;
+
+    for (f = jit->defs; f != NULL; f = f->next) /* they may call each other */
+       LLVMReplaceAllUsesWith(f->fn, LLVMGetUndef(LLVMTypeOf(f->fn)));
+
+    for (f = jit->defs; f != NULL; f = f->next)
+    {
+       LLVMDeleteFunction(f->fn);
+       f->type->llvm = NULL;
+    }
+
+    jit->defs = NULL;
+    jit->pending = NULL;
+}
+
+/*
+   Queue a finished function for optimisation. The inliner is a module
+   pass, so it can't be run while other functions are only partly 
+   jit'd, e.g. when a function is jit'd on first call from inside
+   another, or a parallel for body is outlined.
+*/
+void jit_optimise(jit_t * jit, LLVMValueRef fn)
+{
+    fn_list_t * f = (fn_list_t *) GC_MALLOC(sizeof(fn_list_t));
+
+    f->fn = fn;
+    f->next = jit->pending;
+    jit->pending = f;
+}
+
+/*
+   Inline the runtime helpers and optimise the queued functions, once
+   the statement being jit'd is complete. Machine code for a batch of
+   them may be generated in parallel at the same time.
+*/
+void jit_run_passes(jit_t * jit)
+{
+    LLVMRunPassManager(jit->inliner, jit->module);
+
+    batch_compile(jit, jit->pending);
+
+    jit->pending = NULL;
 }
 
 /*
@@ -224,12 +519,25 @@ void llvm_reset(jit_t * jit)
 */
 void llvm_cleanup(jit_t * jit)
 {
+    unit_t * u;
+
     /* Clean up */
     LLVMDisposePassManager(jit->pass);  
+    LLVMDisposePassManager(jit->inliner);  
     LLVMDisposeExecutionEngine(jit->engine); 
+    LLVMContextDispose(jit->context);
+    for (u = jit->units; u != NULL; u = u->next)
+    {
+       LLVMDisposeExecutionEngine(u->engine);
+       LLVMContextDispose(u->context);
+    }
+    pthread_mutex_destroy(&jit->lock);
     jit->pass = NULL;
+    jit->inliner = NULL;
     jit->engine = NULL;
     jit->module = NULL;
+    jit->context = NULL;
+    jit->units = NULL;
 }
 
 /* 
@@ -248,8 +556,19 @@ void jit_exception(jit_t * jit, const char * msg)
 int is_atomic(type_t * type)
 {
    typ_t t = type->tag;
-   return (t != ARRAY && t != TUPLE && t != DATA 
-        && t != FN);
+   
+   if (t == TUPLE || t == DATA) /* atomic if all slots are */
+   {
+      int i;
+
+      for (i = 0; i < type->arity; i++)
+         if (!is_atomic(type->args[i]))
+            return 0;
+
+      return 1;
+   }
+
+   return (t != ARRAY && t != FN && t != PTR && t != REF && t != FUTURE && t != CHAN);
 }
 
 /*
@@ -261,18 +580,121 @@ int is_structured(type_t * type)
    return (t == ARRAY || t == TUPLE || t == DATA);
 }
 
+/**********************************************************************
+
+   Layout descriptors for typed GC allocation
+
+**********************************************************************/
+
+/*
+   Set the bits in the bitmap bm corresponding to words of an object
+   of the given type (at the given byte offset) which may hold pointers
+*/
+void gc_bitmap(jit_t * jit, GC_word * bm, type_t * type, unsigned long long offset)
+{
+   typ_t t = type->tag;
+   
+   if (t == TUPLE || t == DATA) /* structs are stored inline */
+   {
+      LLVMTargetDataRef td = LLVMGetExecutionEngineTargetData(jit->engine);
+      LLVMTypeRef llvm = type_to_llvm(jit, type);
+      int i;
+
+      for (i = 0; i < type->arity; i++)
+         gc_bitmap(jit, bm, type->args[i], offset + LLVMOffsetOfElement(td, llvm, i));
+   } else if (!is_atomic(type)) /* array data, fn or pointer */
+      GC_set_bit(bm, offset/sizeof(GC_word));
+}
+
+/*
+   Return a descriptor for GC_malloc_explicitly_typed for objects of
+   the given type. If the type doesn't mix pointer and non-pointer words
+   there is nothing to gain over GC_malloc(_atomic) and we return 0.
+*/
+GC_descr gc_descriptor(jit_t * jit, type_t * type)
+{
+   descr_t * d;
+
+   for (d = ctx->descr_list; d != NULL; d = d->next)
+      if (d->type == type)
+         return d->descr;
+
+   d = (descr_t *) GC_MALLOC(sizeof(descr_t));
+   d->type = type;
+   d->descr = 0;
+   d->next = ctx->descr_list;
+   ctx->descr_list = d;
+
+   if (type->tag == TUPLE || type->tag == DATA)
+   {
+      LLVMTargetDataRef td = LLVMGetExecutionEngineTargetData(jit->engine);
+      size_t i, ptrs = 0;
+      size_t words = LLVMABISizeOfType(td, type_to_llvm(jit, type))/sizeof(GC_word);
+      GC_word * bm = (GC_word *) GC_MALLOC(((words + GC_WORDSZ - 1)/GC_WORDSZ)*sizeof(GC_word));
+
+      gc_bitmap(jit, bm, type, 0);
+
+      for (i = 0; i < words; i++)
+         if (bm[i/GC_WORDSZ] & ((GC_word) 1 << (i % GC_WORDSZ)))
+            ptrs++;
+
+      if (ptrs != 0 && ptrs != words)
+         d->descr = GC_make_descriptor(bm, words);
+   }
+
+   return d->descr;
+}
+
+/*
+   Jit a count of an allocation made by jit'd code, taken if GC 
+   statistics are on when the code runs
+*/
+void LLVMBuildGCCount(jit_t * jit)
+{
+   LLVMValueRef stats = LLVMGetNamedGlobal(jit->module, "gc_stats");
+   LLVMBasicBlockRef b = LLVMAppendBasicBlockInContext(jit->context, jit->function, "count");
+   LLVMBasicBlockRef e = LLVMAppendBasicBlockInContext(jit->context, jit->function, "counted");
+   LLVMValueRef val;
+
+   val = LLVMBuildLoad(jit->builder, stats, "stats");
+   val = LLVMBuildICmp(jit->builder, LLVMIntNE, val, LLVMConstInt(LLVMInt32TypeInContext(jit->context), 0, 0), "on");
+   LLVMBuildCondBr(jit->builder, val, b, e);
+   
+   LLVMPositionBuilderAtEnd(jit->builder, b);
+   LLVMBuildCall(jit->builder, LLVMGetNamedFunction(jit->module, "gc_count"), NULL, 0, "");
+   LLVMBuildBr(jit->builder, e);
+
+   LLVMPositionBuilderAtEnd(jit->builder, e);
+}
+
 /* 
-   Jit a call to GC_malloc
+   Jit a call to GC_malloc to create an object of the given type
 */
-LLVMValueRef LLVMBuildGCMalloc(jit_t * jit, LLVMTypeRef type, const char * name, int atomic)
+LLVMValueRef LLVMBuildGCMalloc(jit_t * jit, type_t * t, const char * name)
 {
-    LLVMValueRef fn;
-    if (atomic)
+    LLVMTypeRef type = type_to_llvm(jit, t);
+    LLVMValueRef fn, gcmalloc;
+    GC_descr descr;
+
+    LLVMBuildGCCount(jit);
+
+    if (is_atomic(t))
+    {
         fn = LLVMGetNamedFunction(jit->module, CS_MALLOC_ATOMIC);
-    else
+        LLVMValueRef arg[1] = { LLVMSizeOf(type) };
+        gcmalloc = LLVMBuildCall(jit->builder, fn, arg, 1, "malloc");
+    } else if ((descr = gc_descriptor(jit, t)) != 0) /* only scan the pointer words */
+    {
+        fn = LLVMGetNamedFunction(jit->module, CS_MALLOC_TYPED);
+        LLVMValueRef args[2] = { LLVMSizeOf(type), LLVMConstInt(LLVMWordType(), descr, 0) };
+        gcmalloc = LLVMBuildCall(jit->builder, fn, args, 2, "malloc");
+    } else
+    {
         fn = LLVMGetNamedFunction(jit->module, CS_MALLOC);
-    LLVMValueRef arg[1] = { LLVMSizeOf(type) };
-    LLVMValueRef gcmalloc = LLVMBuildCall(jit->builder, fn, arg, 1, "malloc");
+        LLVMValueRef arg[1] = { LLVMSizeOf(type) };
+        gcmalloc = LLVMBuildCall(jit->builder, fn, arg, 1, "malloc");
+    }
+
     return LLVMBuildPointerCast(jit->builder, gcmalloc, LLVMPointerType(type, 0), name);
 }
 
@@ -287,46 +709,103 @@ LLVMValueRef LLVMBuildGCRealloc(jit_t * jit, LLVMValueRef ptr, LLVMTypeRef type,
     return LLVMBuildPointerCast(jit->builder, gcrealloc, LLVMPointerType(type, 0), name);
 }
 
-/* 
-   Jit a call to GC_malloc to create an array
+/*
+   Jit a call to memset to zero len bytes at ptr. GC_malloc_atomic 
+   doesn't clear memory, but entries of flint types must start out 
+   zero before they can be set.
 */
-LLVMValueRef LLVMBuildGCArrayMalloc(jit_t * jit, type_t * t, LLVMValueRef num, const char * name, int atomic)
+void LLVMBuildZero(jit_t * jit, LLVMValueRef ptr, LLVMValueRef len)
 {
-    LLVMValueRef fn;
-    if (atomic)
-        fn = LLVMGetNamedFunction(jit->module, CS_MALLOC_ATOMIC);
-    else
-        fn = LLVMGetNamedFunction(jit->module, CS_MALLOC);
+    LLVMTypeRef i8ptr = LLVMPointerType(LLVMInt8TypeInContext(jit->context), 0);
+    LLVMValueRef fn = LLVMGetNamedFunction(jit->module, "memset");
+    LLVMValueRef args[3] = { LLVMBuildPointerCast(jit->builder, ptr, i8ptr, "dst"),
+       LLVMConstInt(LLVMInt32TypeInContext(jit->context), 0, 0), len };
     
+    LLVMBuildCall(jit->builder, fn, args, 3, "");
+}
+
+/* 
+   Jit a call to GC_malloc to create an array with entries of type t
+*/
+LLVMValueRef LLVMBuildGCArrayMalloc(jit_t * jit, type_t * t, LLVMValueRef num, const char * name)
+{
     LLVMTypeRef type = type_to_llvm(jit, t);
-    
     LLVMValueRef size = LLVMSizeOf(type);
-    LLVMValueRef arg[1] = { LLVMBuildMul(jit->builder, num, size, "arr_size") };
-    LLVMValueRef gcmalloc = LLVMBuildCall(jit->builder, fn, arg, 1, "malloc");
+    LLVMValueRef fn, gcmalloc;
+    GC_descr descr;
+
+    LLVMBuildGCCount(jit);
+    
+    if (is_atomic(t))
+    {
+        fn = LLVMGetNamedFunction(jit->module, CS_MALLOC_ATOMIC);
+        LLVMValueRef arg[1] = { LLVMBuildMul(jit->builder, num, size, "arr_size") };
+        gcmalloc = LLVMBuildCall(jit->builder, fn, arg, 1, "malloc");
+        LLVMBuildZero(jit, gcmalloc, arg[0]);
+    } else if ((descr = gc_descriptor(jit, t)) != 0) /* only scan the pointer words */
+    {
+        fn = LLVMGetNamedFunction(jit->module, CS_CALLOC_TYPED);
+        LLVMValueRef args[3] = { num, size, LLVMConstInt(LLVMWordType(), descr, 0) };
+        gcmalloc = LLVMBuildCall(jit->builder, fn, args, 3, "malloc");
+    } else
+    {
+        fn = LLVMGetNamedFunction(jit->module, CS_MALLOC);
+        LLVMValueRef arg[1] = { LLVMBuildMul(jit->builder, num, size, "arr_size") };
+        gcmalloc = LLVMBuildCall(jit->builder, fn, arg, 1, "malloc");
+    }
+
     return LLVMBuildPointerCast(jit->builder, gcmalloc, LLVMPointerType(type, 0), name);
 }
 
 /* 
-   Jit a call to GC_realloc to reallocate an array
+   Jit a call to GC_realloc to reallocate an array currently holding
+   old entries so that it can hold num entries
 */
-LLVMValueRef LLVMBuildGCArrayRealloc(jit_t * jit, type_t * t, LLVMValueRef arr, LLVMValueRef num, const char * name)
+LLVMValueRef LLVMBuildGCArrayRealloc(jit_t * jit, type_t * t, LLVMValueRef arr, 
+                                     LLVMValueRef old, LLVMValueRef num, const char * name)
 {
-    LLVMValueRef fn = LLVMGetNamedFunction(jit->module, CS_REALLOC);
-    
     LLVMTypeRef type = type_to_llvm(jit, t);
-    
     LLVMValueRef size = LLVMSizeOf(type);
-    LLVMValueRef args[2] = { LLVMBuildPointerCast(jit->builder, arr, LLVMPointerType(LLVMInt8Type(), 0), "arr"), 
+    LLVMTypeRef i8ptr = LLVMPointerType(LLVMInt8TypeInContext(jit->context), 0);
+    
+    if (!is_atomic(t) && gc_descriptor(jit, t) != 0) /* typed objects can't be passed to GC_realloc */
+    {
+        LLVMValueRef narr = LLVMBuildGCArrayMalloc(jit, t, num, name);
+        LLVMValueRef fn = LLVMGetNamedFunction(jit->module, "memcpy");
+        LLVMValueRef args[3] = { LLVMBuildPointerCast(jit->builder, narr, i8ptr, "dst"),
+           LLVMBuildPointerCast(jit->builder, arr, i8ptr, "src"),
+           LLVMBuildMul(jit->builder, old, size, "arr_size") };
+        LLVMBuildCall(jit->builder, fn, args, 3, "");
+        return narr;
+    }
+
+    LLVMBuildGCCount(jit);
+
+    LLVMValueRef fn = LLVMGetNamedFunction(jit->module, CS_REALLOC);
+    LLVMValueRef args[2] = { LLVMBuildPointerCast(jit->builder, arr, i8ptr, "arr"), 
        LLVMBuildMul(jit->builder, num, size, "arr_size") };
     LLVMValueRef gcrealloc = LLVMBuildCall(jit->builder, fn, args, 2, "realloc");
-    return LLVMBuildPointerCast(jit->builder, gcrealloc, LLVMPointerType(type, 0), name);
+    LLVMValueRef narr = LLVMBuildPointerCast(jit->builder, gcrealloc, LLVMPointerType(type, 0), name);
+
+    if (is_atomic(t)) /* the new entries aren't cleared */
+    {
+        LLVMValueRef grow = LLVMBuildICmp(jit->builder, LLVMIntUGT, num, old, "grow");
+        LLVMValueRef extra = LLVMBuildSelect(jit->builder, grow, 
+           LLVMBuildSub(jit->builder, num, old, "extra"), LLVMConstInt(LLVMWordType(), 0, 0), "extra");
+        LLVMValueRef indices[1] = { old };
+        LLVMValueRef tail = LLVMBuildInBoundsGEP(jit->builder, narr, indices, 1, "tail");
+        
+        LLVMBuildZero(jit, tail, LLVMBuildMul(jit->builder, extra, size, "tail_size"));
+    }
+
+    return narr;
 }
 
 LLVMValueRef AddLocal(jit_t * jit, LLVMTypeRef type, char * name)
 {
    LLVMBasicBlockRef second = LLVMGetFirstBasicBlock(jit->function);
-   LLVMBasicBlockRef first = LLVMInsertBasicBlock(second, serialise("decl"));
-   LLVMBuilderRef builder = LLVMCreateBuilder();
+   LLVMBasicBlockRef first = LLVMInsertBasicBlockInContext(jit->context, second, serialise("decl"));
+   LLVMBuilderRef builder = LLVMCreateBuilderInContext(jit->context);
    LLVMPositionBuilderAtEnd(builder, first);
    LLVMValueRef val = LLVMBuildAlloca(builder, type, name);
    LLVMBuildBr(builder, second);
@@ -336,6 +815,37 @@ LLVMValueRef AddLocal(jit_t * jit, LLVMTypeRef type, char * name)
    return val;
 }
 
+/*
+   Return the LLVM global for a global variable. While a background 
+   statement is jit'd, each mutable global it uses is replaced by a
+   private copy, see exec_background.
+*/
+LLVMValueRef global_lookup(jit_t * jit, bind_t * bind)
+{
+   LLVMValueRef var = LLVMGetNamedGlobal(jit->module, bind->llvm);
+   LLVMTypeRef type;
+   snap_t * s;
+
+   if (!jit->snapping || bind->immutable || var == NULL)
+      return var;
+
+   for (s = jit->snap; s != NULL; s = s->next)
+      if (s->bind == bind)
+         return s->copy;
+
+   type = LLVMGetElementType(LLVMTypeOf(var));
+
+   s = (snap_t *) GC_MALLOC(sizeof(snap_t));
+   s->bind = bind;
+   s->var = var;
+   s->copy = LLVMAddGlobal(jit->module, type, "__cs_snap");
+   LLVMSetInitializer(s->copy, LLVMGetUndef(type));
+   s->next = jit->snap;
+   jit->snap = s;
+
+   return s->copy;
+}
+
 LLVMValueRef create_var(jit_t * jit, sym_t * sym, char * llvm, type_t * t)
 {
    LLVMValueRef val;
@@ -372,7 +882,7 @@ LLVMTypeRef tuple_to_llvm(jit_t * jit, type_t * type)
         args[i] = type_to_llvm(jit, type->args[i]); 
 
     /* make LLVM struct type */
-    return LLVMStructType(args, params, 1);
+    return LLVMStructTypeInContext(jit->context, args, params, 1);
 }
 
 /* 
@@ -388,7 +898,7 @@ LLVMTypeRef array_to_llvm(jit_t * jit, type_t * type)
     args[1] = LLVMWordType();
 
     /* make LLVM struct type */
-    return LLVMStructType(args, 2, 1);
+    return LLVMStructTypeInContext(jit->context, args, 2, 1);
 }
 
 /* 
@@ -396,18 +906,18 @@ LLVMTypeRef array_to_llvm(jit_t * jit, type_t * type)
 */
 LLVMTypeRef type_to_llvm(jit_t * jit, type_t * type)
 {
-   if (type == t_nil)
-      return LLVMVoidType();
-   else if (type == t_int || type == t_uint)
+   if (type == ctx->t_nil)
+      return LLVMVoidTypeInContext(jit->context);
+   else if (type == ctx->t_int || type == ctx->t_uint)
       return LLVMWordType();
-   else if (type == t_double)
-      return LLVMDoubleType();
-   else if (type == t_char)
-      return LLVMInt8Type();
-   else if (type == t_string)
-      return LLVMPointerType(LLVMInt8Type(), 0);
-   else if (type == t_bool)
-      return LLVMInt1Type();
+   else if (type == ctx->t_double)
+      return LLVMDoubleTypeInContext(jit->context);
+   else if (type == ctx->t_char)
+      return LLVMInt8TypeInContext(jit->context);
+   else if (type == ctx->t_string)
+      return LLVMPointerType(LLVMInt8TypeInContext(jit->context), 0);
+   else if (type == ctx->t_bool)
+      return LLVMInt1TypeInContext(jit->context);
    else if (type->tag == TUPLE)
       return tuple_to_llvm(jit, type);
    else if (type->tag == ARRAY)
@@ -424,7 +934,8 @@ LLVMTypeRef type_to_llvm(jit_t * jit, type_t * type)
          LLVMTypeRef * types = GC_MALLOC(count*sizeof(LLVMTypeRef));
          for (i = 0; i < count; i++)
             types[i] = type_to_llvm(jit, type->args[i]);
-         LLVMStructSetBody(t, types, count, 0);
+         if (LLVMIsOpaqueStruct(t)) /* the runtime bitcode may have given the body */
+            LLVMStructSetBody(t, types, count, 0);
          bind->llvm = type->llvm;
       }
       
@@ -432,6 +943,10 @@ LLVMTypeRef type_to_llvm(jit_t * jit, type_t * type)
    }
    else if (type->tag == PTR || type->tag == REF)
       return LLVMPointerType(type_to_llvm(jit, type->ret), 0);
+   else if (type->tag == FUTURE) /* the task_t computing the result */
+      return LLVMPointerType(LLVMInt8TypeInContext(jit->context), 0);
+   else if (type->tag == CHAN) /* the chan_t */
+      return LLVMPointerType(LLVMInt8TypeInContext(jit->context), 0);
    else
       jit_exception(jit, "Unknown type in type_to_llvm\n");
 }
@@ -460,21 +975,58 @@ ret_t * ret(int closed, LLVMValueRef val)
 }
 
 /*
-   Jit a ZZ literal
+   Find the pool entry for the literal with the given text and type,
+   returning a new one (with global set to NULL) if it isn't there
 */
-ret_t * exec_ZZ(jit_t * jit, ast_t * ast)
+const_t * const_lookup(sym_t * sym, type_t * type)
 {
-   char * str = ast->sym->name; /* the integer represented as a string */
-   fmpz * temp = GC_malloc(sizeof(fmpz));
-   LLVMValueRef val;
+   int hash;
+   const_t * c;
+   
+   if (ctx->const_tab == NULL)
+      ctx->const_tab = (const_t **) GC_MALLOC(CONST_TAB_SIZE*sizeof(const_t *));
+
+   hash = (int) (((unsigned long) sym >> 4) % CONST_TAB_SIZE);
+   
+   for (c = ctx->const_tab[hash]; c != NULL; c = c->next)
+      if (c->sym == sym && c->type == type)
+         return c;
+
+   c = (const_t *) GC_MALLOC(sizeof(const_t));
+   c->sym = sym;
+   c->type = type;
+   c->next = ctx->const_tab[hash];
+   ctx->const_tab[hash] = c;
+
+   return c;
+}
 
-   fmpz_init(temp);
-   fmpz_set_str(temp, str, 10);
+/*
+   Jit a ZZ literal. The pooled value is read only, so each use gets
+   its own copy, which may be bound to a ref or updated in place. For
+   a small value the copy is just a word.
+*/
+ret_t * exec_ZZ(jit_t * jit, ast_t * ast)
+{
+   const_t * c = const_lookup(ast->sym, ctx->t_ZZ);
+   LLVMValueRef loc = AddLocal(jit, type_to_llvm(jit, ctx->t_ZZ), serialise("__cs_ZZ"));
+   LLVMValueRef args[2];
    
-   LLVMValueRef field[1] = { LLVMConstInt(LLVMWordType(), (slong) *temp, 0) };
-   val = LLVMConstNamedStruct(type_to_llvm(jit, t_ZZ), field, 1);
-   LLVMValueRef loc = LLVMAddGlobal(jit->module, type_to_llvm(jit, t_ZZ), "__cs_ZZ");
-   LLVMSetInitializer(loc, val);
+   if (c->global == NULL) /* first use of this literal */
+   {
+      fmpz_init(c->val);
+      fmpz_set_str(c->val, ast->sym->name, 10);
+   
+      LLVMValueRef field[1] = { LLVMConstInt(LLVMWordType(), (slong) *c->val, 0) };
+      LLVMValueRef val = LLVMConstNamedStruct(type_to_llvm(jit, ctx->t_ZZ), field, 1);
+      c->global = LLVMAddGlobal(jit->module, type_to_llvm(jit, ctx->t_ZZ), "__cs_ZZ");
+      LLVMSetInitializer(c->global, val);
+      LLVMSetGlobalConstant(c->global, 1);
+   }
+
+   args[0] = loc;
+   args[1] = c->global;
+   LLVMBuildCall(jit->builder, LLVMGetNamedFunction(jit->module, "__ZZ_init_set"), args, 2, "");
 
    return ret(0, loc);
 }
@@ -491,6 +1043,22 @@ ret_t * exec_int(jit_t * jit, ast_t * ast)
     return ret(0, val);
 }
 
+/*
+   Jit the conversion of an int known to fit in a small fmpz to a ZZ.
+   A small fmpz is just the word itself, so we simply store it.
+*/
+ret_t * exec_int_to_ZZ(jit_t * jit, ast_t * ast)
+{
+    LLVMValueRef val = exec_ast(jit, ast->child)->val;
+    LLVMValueRef loc = AddLocal(jit, type_to_llvm(jit, ctx->t_ZZ), serialise("__cs_ZZ"));
+    
+    LLVMValueRef indices[2] = { LLVMConstInt(LLVMInt32TypeInContext(jit->context), 0, 0), LLVMConstInt(LLVMInt32TypeInContext(jit->context), 0, 0) };
+    LLVMValueRef field = LLVMBuildInBoundsGEP(jit->builder, loc, indices, 2, "field");
+    LLVMBuildStore(jit->builder, val, field);
+
+    return ret(0, loc);
+}
+
 /*
    Jit a uint literal
 */
@@ -510,7 +1078,7 @@ ret_t * exec_double(jit_t * jit, ast_t * ast)
 {
     double num = atof(ast->sym->name);
     
-    LLVMValueRef val = LLVMConstReal(LLVMDoubleType(), num);
+    LLVMValueRef val = LLVMConstReal(LLVMDoubleTypeInContext(jit->context), num);
 
     return ret(0, val);
 }
@@ -552,7 +1120,7 @@ ret_t * exec_char(jit_t * jit, ast_t * ast)
        }
     }
 
-    LLVMValueRef val = LLVMConstInt(LLVMInt8Type(), c, 0);;
+    LLVMValueRef val = LLVMConstInt(LLVMInt8TypeInContext(jit->context), c, 0);;
 
     return ret(0, val);
 }
@@ -562,28 +1130,191 @@ ret_t * exec_char(jit_t * jit, ast_t * ast)
 */
 ret_t * exec_string(jit_t * jit, ast_t * ast)
 {
-    char * str = ast->sym->name;
+    const_t * c = const_lookup(ast->sym, ctx->t_string);
     
-    LLVMValueRef val = LLVMBuildGlobalStringPtr(jit->builder, str, "string");
+    if (c->global == NULL) /* first use of this literal */
+       c->global = LLVMBuildGlobalStringPtr(jit->builder, ast->sym->name, "string");
 
-    return ret(0, val);
+    return ret(0, c->global);
 }
 
 /*
-   Jit a binary operation involving a ZZ
+   Return an i1 which is true if the given word is a small fmpz,
+   i.e. COEFF_MIN <= w <= COEFF_MAX
 */
-ret_t * exec_binary_data(jit_t * jit, ast_t * ast, int cleanup)
+LLVMValueRef LLVMBuildIsSmallZZ(jit_t * jit, LLVMValueRef w)
 {
-    ast_t * expr1 = ast->child;                          
-    ast_t * expr2 = expr1->next;                         
+    LLVMValueRef max = LLVMConstInt(LLVMWordType(), COEFF_MAX, 0);
+    LLVMValueRef range = LLVMConstInt(LLVMWordType(), 2*COEFF_MAX, 0);
+    
+    LLVMValueRef off = LLVMBuildAdd(jit->builder, w, max, "offset");
+    return LLVMBuildICmp(jit->builder, LLVMIntULE, off, range, "small");
+}
 
-    ret_t * ret1 = exec_ast(jit, expr1);               
-    ret_t * ret2 = exec_ast(jit, expr2);              
+/*
+   Jit res = a op b for ZZ's, where op is +, - or *. If both operands
+   are small we do an overflow checked word operation inline and only
+   call flint, which promotes the result to an mpz, if that fails.
+*/
+void exec_ZZ_arith(jit_t * jit, char * intr, LLVMValueRef res, 
+                   LLVMValueRef a, LLVMValueRef b, LLVMValueRef fn)
+{
+    LLVMValueRef indices[2] = { LLVMConstInt(LLVMInt32TypeInContext(jit->context), 0, 0), LLVMConstInt(LLVMInt32TypeInContext(jit->context), 0, 0) };
+    
+    LLVMBasicBlockRef fast = LLVMAppendBasicBlockInContext(jit->context, jit->function, "zzfast");
+    LLVMBasicBlockRef store = LLVMAppendBasicBlockInContext(jit->context, jit->function, "zzstore");
+    LLVMBasicBlockRef slow = LLVMAppendBasicBlockInContext(jit->context, jit->function, "zzslow");
+    LLVMBasicBlockRef end = LLVMAppendBasicBlockInContext(jit->context, jit->function, "zzend");
+    
+    LLVMValueRef w1 = LLVMBuildLoad(jit->builder, 
+                      LLVMBuildInBoundsGEP(jit->builder, a, indices, 2, "field"), "word");
+    LLVMValueRef w2 = LLVMBuildLoad(jit->builder, 
+                      LLVMBuildInBoundsGEP(jit->builder, b, indices, 2, "field"), "word");
+    LLVMValueRef small = LLVMBuildAnd(jit->builder, LLVMBuildIsSmallZZ(jit, w1), 
+                                      LLVMBuildIsSmallZZ(jit, w2), "small");
+    LLVMBuildCondBr(jit->builder, small, fast, slow);
+    
+    /* both small, try word arithmetic */
+    LLVMPositionBuilderAtEnd(jit->builder, fast);
+    LLVMValueRef args[2] = { w1, w2 };
+    LLVMValueRef pair = LLVMBuildCall(jit->builder, 
+                        LLVMGetNamedFunction(jit->module, intr), args, 2, "checked");
+    LLVMValueRef r = LLVMBuildExtractValue(jit->builder, pair, 0, "res");
+    LLVMValueRef ovfl = LLVMBuildExtractValue(jit->builder, pair, 1, "ovfl");
+    LLVMValueRef ok = LLVMBuildAnd(jit->builder, LLVMBuildIsSmallZZ(jit, r), 
+                                   LLVMBuildNot(jit->builder, ovfl, "not"), "ok");
+    LLVMBuildCondBr(jit->builder, ok, store, slow);
+
+    /* result is small, store it directly */
+    LLVMPositionBuilderAtEnd(jit->builder, store);
+    LLVMBuildStore(jit->builder, r, LLVMBuildInBoundsGEP(jit->builder, res, indices, 2, "field"));
+    LLVMBuildBr(jit->builder, end);
+
+    /* promote to flint, borrowing limbs for the result from the pool */
+    LLVMPositionBuilderAtEnd(jit->builder, slow);
+    LLVMValueRef arg1[1] = { res };
+    LLVMBuildCall(jit->builder, LLVMGetNamedFunction(jit->module, "__fmpz_pool_init"), arg1, 1, "");
+    LLVMValueRef arg3[3] = { res, a, b };
+    LLVMBuildCall(jit->builder, fn, arg3, 3, "");
+    LLVMBuildBr(jit->builder, end);
+    
+    LLVMPositionBuilderAtEnd(jit->builder, end);
+}
 
-    bind_t * bind = find_symbol(ast->sym);
-    type_t * op = find_prototype(bind->type, ast->child);
+/*
+   Jit a load of the given field of a struct
+*/
+LLVMValueRef LLVMBuildLoadField(jit_t * jit, LLVMValueRef s, int i, const char * name)
+{
+    LLVMValueRef indices[2] = { LLVMConstInt(LLVMInt32TypeInContext(jit->context), 0, 0), LLVMConstInt(LLVMInt32TypeInContext(jit->context), i, 0) };
+    
+    return LLVMBuildLoad(jit->builder, 
+           LLVMBuildInBoundsGEP(jit->builder, s, indices, 2, name), name);
+}
 
-    if (op == NULL)
+/*
+   Jit x*y mod n for residues x, y < n, given ninv and norm as per
+   flint's nmod_t, i.e. ninv is the precomputed inverse of n << norm.
+   This is the division free reduction of n_ll_mod_preinv, done in 
+   128 bits.
+*/
+LLVMValueRef LLVMBuildMulMod(jit_t * jit, LLVMValueRef x, LLVMValueRef y, 
+                    LLVMValueRef n, LLVMValueRef ninv, LLVMValueRef norm)
+{
+    LLVMBuilderRef b = jit->builder;
+    LLVMTypeRef dword = LLVMIntTypeInContext(jit->context, 2*sizeof(long)*8);
+    LLVMValueRef half = LLVMConstInt(dword, sizeof(long)*8, 0);
+    LLVMValueRef one = LLVMConstInt(LLVMWordType(), 1, 0);
+
+    LLVMValueRef nn = LLVMBuildShl(b, n, norm, "nn"); /* normalised n */
+    LLVMValueRef p = LLVMBuildMul(b, LLVMBuildZExt(b, x, dword, "x"), 
+                                     LLVMBuildZExt(b, y, dword, "y"), "p");
+    p = LLVMBuildShl(b, p, LLVMBuildZExt(b, norm, dword, "norm"), "p"); /* p < n^2, fits */
+    LLVMValueRef hi = LLVMBuildTrunc(b, LLVMBuildLShr(b, p, half, "hi"), LLVMWordType(), "hi");
+    LLVMValueRef lo = LLVMBuildTrunc(b, p, LLVMWordType(), "lo");
+    
+    /* (q1, q0) = ninv*hi + (hi, lo) */
+    LLVMValueRef q = LLVMBuildMul(b, LLVMBuildZExt(b, ninv, dword, "ninv"), 
+                                     LLVMBuildZExt(b, hi, dword, "hi"), "q");
+    q = LLVMBuildAdd(b, q, p, "q");
+    LLVMValueRef q1 = LLVMBuildTrunc(b, LLVMBuildLShr(b, q, half, "q1"), LLVMWordType(), "q1");
+    LLVMValueRef q0 = LLVMBuildTrunc(b, q, LLVMWordType(), "q0");
+
+    /* r = lo - (q1 + 1)*nn, then at most two corrections */
+    LLVMValueRef r = LLVMBuildSub(b, lo, 
+                     LLVMBuildMul(b, LLVMBuildAdd(b, q1, one, "q1"), nn, "qn"), "r");
+    LLVMValueRef gt = LLVMBuildICmp(b, LLVMIntUGT, r, q0, "gt");
+    r = LLVMBuildSelect(b, gt, LLVMBuildAdd(b, r, nn, "r"), r, "r");
+    LLVMValueRef ge = LLVMBuildICmp(b, LLVMIntUGE, r, nn, "ge");
+    r = LLVMBuildSelect(b, ge, LLVMBuildSub(b, r, nn, "r"), r, "r");
+
+    return LLVMBuildLShr(b, r, norm, "r");
+}
+
+/*
+   Jit res = a op b for nmods, where op is +, - or *. An exception is 
+   raised if the moduli differ.
+*/
+void exec_nmod_arith(jit_t * jit, sym_t * op, LLVMValueRef res, 
+                     LLVMValueRef a, LLVMValueRef b)
+{
+    LLVMBuilderRef bld = jit->builder;
+    LLVMValueRef x = LLVMBuildLoadField(jit, a, 0, "x");
+    LLVMValueRef y = LLVMBuildLoadField(jit, b, 0, "y");
+    LLVMValueRef n = LLVMBuildLoadField(jit, a, 1, "n");
+    LLVMValueRef m = LLVMBuildLoadField(jit, b, 1, "m");
+    LLVMValueRef ninv = LLVMBuildLoadField(jit, a, 2, "ninv");
+    LLVMValueRef norm = LLVMBuildLoadField(jit, a, 3, "norm");
+    LLVMBasicBlockRef bad = LLVMAppendBasicBlockInContext(jit->context, jit->function, "mismatch");
+    LLVMBasicBlockRef ok = LLVMAppendBasicBlockInContext(jit->context, jit->function, "match");
+    LLVMValueRef r;
+    int i;
+
+    LLVMBuildCondBr(bld, LLVMBuildICmp(bld, LLVMIntNE, n, m, "ne"), bad, ok);
+    
+    LLVMPositionBuilderAtEnd(bld, bad);
+    LLVMBuildCall(bld, LLVMGetNamedFunction(jit->module, "__nmod_mismatch"), NULL, 0, "");
+    LLVMBuildUnreachable(bld);
+
+    LLVMPositionBuilderAtEnd(bld, ok);
+
+    if (op == sym_lookup("+")) /* as nmod_add, avoiding overflow */
+    {
+       LLVMValueRef neg = LLVMBuildSub(bld, n, y, "neg");
+       LLVMValueRef ge = LLVMBuildICmp(bld, LLVMIntUGE, x, neg, "ge");
+       r = LLVMBuildSelect(bld, ge, LLVMBuildSub(bld, x, neg, "r"), 
+                                    LLVMBuildAdd(bld, x, y, "r"), "r");
+    } else if (op == sym_lookup("-"))
+    {
+       LLVMValueRef lt = LLVMBuildICmp(bld, LLVMIntULT, x, y, "lt");
+       r = LLVMBuildSub(bld, x, y, "r");
+       r = LLVMBuildSelect(bld, lt, LLVMBuildAdd(bld, r, n, "r"), r, "r");
+    } else /* * */
+       r = LLVMBuildMulMod(jit, x, y, n, ninv, norm);
+
+    LLVMValueRef vals[4] = { r, n, ninv, norm };
+    for (i = 0; i < 4; i++)
+    {
+       LLVMValueRef indices[2] = { LLVMConstInt(LLVMInt32TypeInContext(jit->context), 0, 0), LLVMConstInt(LLVMInt32TypeInContext(jit->context), i, 0) };
+       LLVMBuildStore(bld, vals[i], LLVMBuildInBoundsGEP(bld, res, indices, 2, "field"));
+    }
+}
+
+/*
+   Jit a binary operation involving a ZZ
+*/
+ret_t * exec_binary_data(jit_t * jit, ast_t * ast, int cleanup)
+{
+    ast_t * expr1 = ast->child;                          
+    ast_t * expr2 = expr1->next;                         
+
+    ret_t * ret1 = exec_ast(jit, expr1);               
+    ret_t * ret2 = exec_ast(jit, expr2);              
+
+    bind_t * bind = find_symbol(ast->sym);
+    type_t * op = find_prototype(bind->type, ast->child);
+
+    if (op == NULL)
        exception("Unable to find binary operation for data type\n");
 
     if (op->intrinsic)
@@ -597,11 +1328,42 @@ ret_t * exec_binary_data(jit_t * jit, ast_t * ast, int cleanup)
        else
           val = AddLocal(jit, type_to_llvm(jit, op->ret), llvm);
 
-       if (requires_constructor(op->ret))
-          call_constructors(jit, val, op->ret);
-
        LLVMValueRef fn = LLVMGetNamedFunction(jit->module, op->llvm);
 
+       if (op->ret == ctx->t_nmod) /* residue arithmetic is inlined */
+       {
+          exec_nmod_arith(jit, ast->sym, val, ret1->val, ret2->val);
+          
+          return ret(0, val);
+       }
+
+       if (op->ret == ctx->t_ZZ && expr1->type == ctx->t_ZZ && expr2->type == ctx->t_ZZ)
+       {
+          char * intr = NULL;
+
+          if (ast->sym == sym_lookup("+"))
+             intr = "llvm.sadd.with.overflow." LLVM_WORD;
+          else if (ast->sym == sym_lookup("-"))
+             intr = "llvm.ssub.with.overflow." LLVM_WORD;
+          else if (ast->sym == sym_lookup("*"))
+             intr = "llvm.smul.with.overflow." LLVM_WORD;
+
+          if (intr != NULL)
+          {
+             exec_ZZ_arith(jit, intr, val, ret1->val, ret2->val, fn);
+
+             return ret(0, val);
+          }
+       }
+
+       if (op->ret == ctx->t_ZZ) /* borrow limbs for the result from the pool */
+       {
+          LLVMValueRef init = LLVMGetNamedFunction(jit->module, "__fmpz_pool_init");
+          LLVMValueRef arg[1] = { val };
+          LLVMBuildCall(jit->builder, init, arg, 1, "");
+       } else if (requires_constructor(op->ret))
+          call_constructors(jit, val, op->ret);
+
        LLVMValueRef arg[3] = { val, ret1->val, ret2->val };
 
        LLVMBuildCall(jit->builder, fn, arg, 3, "");
@@ -629,7 +1391,7 @@ __name(jit_t * jit, ast_t * ast, int cleanup)                 \
                                                               \
     LLVMValueRef v1 = ret1->val, v2 = ret2->val, val;         \
                                                               \
-    if (expr1->type == t_double)                              \
+    if (expr1->type == ctx->t_double)                              \
        val = __fop(jit->builder, v1, v2, __str);              \
     else                                                      \
        val = __iop(jit->builder, v1, v2, __str);              \
@@ -699,7 +1461,7 @@ __name(jit_t * jit, ast_t * ast)                                      \
                                                                       \
     LLVMValueRef v1 = ret1->val, v2 = ret2->val, val;                 \
                                                                       \
-    if (expr1->type == t_double)                                      \
+    if (expr1->type == ctx->t_double)                                      \
        val = __fop(jit->builder, __frel, v1, v2, __str);              \
     else                                                              \
        val = __iop(jit->builder, __irel, v1, v2, __str);              \
@@ -723,6 +1485,162 @@ ret_t * exec_binary_rel(exec_eq, LLVMBuildFCmp, LLVMRealOEQ, LLVMBuildICmp, LLVM
 
 ret_t * exec_binary_rel(exec_ne, LLVMBuildFCmp, LLVMRealONE, LLVMBuildICmp, LLVMIntNE, "ne")
 
+/*
+   Jit x^e for a word x and an exponent e known at compile time, by 
+   binary powering unrolled into multiplications
+*/
+LLVMValueRef exec_pow_const(jit_t * jit, LLVMValueRef x, unsigned long e)
+{
+    LLVMValueRef res = NULL;
+
+    while (e != 0)
+    {
+       if (e & 1)
+          res = res ? LLVMBuildMul(jit->builder, res, x, "pow") : x;
+       e >>= 1;
+       if (e != 0)
+          x = LLVMBuildMul(jit->builder, x, x, "sqr");
+    }
+
+    return res ? res : LLVMConstInt(LLVMWordType(), 1, 0);
+}
+
+/*
+   Jit x^e for words by binary powering, i.e. a loop
+   
+      r = 1; while (e != 0) { if (e & 1) r *= x; x *= x; e >>= 1; }
+*/
+LLVMValueRef exec_pow_loop(jit_t * jit, LLVMValueRef x, LLVMValueRef e)
+{
+    LLVMBasicBlockRef entry = LLVMGetInsertBlock(jit->builder);
+    LLVMBasicBlockRef loop = LLVMAppendBasicBlockInContext(jit->context, jit->function, "pow");
+    LLVMBasicBlockRef body = LLVMAppendBasicBlockInContext(jit->context, jit->function, "powbody");
+    LLVMBasicBlockRef end = LLVMAppendBasicBlockInContext(jit->context, jit->function, "powend");
+
+    LLVMValueRef zero = LLVMConstInt(LLVMWordType(), 0, 0);
+    LLVMValueRef one = LLVMConstInt(LLVMWordType(), 1, 0);
+    
+    LLVMBuildBr(jit->builder, loop);
+    LLVMPositionBuilderAtEnd(jit->builder, loop);
+
+    LLVMValueRef r = LLVMBuildPhi(jit->builder, LLVMWordType(), "r");
+    LLVMValueRef b = LLVMBuildPhi(jit->builder, LLVMWordType(), "b");
+    LLVMValueRef n = LLVMBuildPhi(jit->builder, LLVMWordType(), "n");
+    LLVMValueRef done = LLVMBuildICmp(jit->builder, LLVMIntEQ, n, zero, "done");
+    LLVMBuildCondBr(jit->builder, done, end, body);
+
+    LLVMPositionBuilderAtEnd(jit->builder, body);
+    LLVMValueRef odd = LLVMBuildICmp(jit->builder, LLVMIntNE, 
+                       LLVMBuildAnd(jit->builder, n, one, "bit"), zero, "odd");
+    LLVMValueRef r2 = LLVMBuildSelect(jit->builder, odd, 
+                      LLVMBuildMul(jit->builder, r, b, "mul"), r, "r2");
+    LLVMValueRef b2 = LLVMBuildMul(jit->builder, b, b, "b2");
+    LLVMValueRef n2 = LLVMBuildLShr(jit->builder, n, one, "n2");
+    LLVMBuildBr(jit->builder, loop);
+
+    LLVMValueRef r_in[2] = { one, r2 };
+    LLVMValueRef b_in[2] = { x, b2 };
+    LLVMValueRef n_in[2] = { e, n2 };
+    LLVMBasicBlockRef blocks[2] = { entry, body };
+    LLVMAddIncoming(r, r_in, blocks, 2);
+    LLVMAddIncoming(b, b_in, blocks, 2);
+    LLVMAddIncoming(n, n_in, blocks, 2);
+
+    LLVMPositionBuilderAtEnd(jit->builder, end);
+
+    return r;
+}
+
+/*
+   Given r = x^|e| for a negative int exponent e, jit the truncated 
+   value of x^e, which is r if x is 0, 1 or -1 and 0 otherwise
+*/
+LLVMValueRef exec_pow_neg(jit_t * jit, LLVMValueRef x, LLVMValueRef r)
+{
+    LLVMValueRef one = LLVMConstInt(LLVMWordType(), 1, 0);
+    LLVMValueRef two = LLVMConstInt(LLVMWordType(), 2, 0);
+    LLVMValueRef big = LLVMBuildICmp(jit->builder, LLVMIntUGT, 
+                       LLVMBuildAdd(jit->builder, x, one, "x1"), two, "big");
+
+    return LLVMBuildSelect(jit->builder, big, 
+                           LLVMConstInt(LLVMWordType(), 0, 0), r, "neg");
+}
+
+/*
+   Jit an exponentiation. Constant exponents are strength reduced.
+   A negative int exponent gives the truncated value of x^e.
+*/
+ret_t * exec_pow(jit_t * jit, ast_t * ast, int cleanup)
+{
+    ast_t * expr1 = ast->child;
+    ast_t * expr2 = expr1->next;
+    LLVMValueRef val;
+    
+    if (expr1->type->tag == DATA)
+    {
+       if (expr2->tag == AST_UINT && strcmp(expr2->sym->name, "2") == 0
+        && (expr1->tag == AST_IDENT || expr1->tag == AST_ZZ))
+       {
+          /* x^2 is just x*x, which is inlined for small values */
+          ast_t * sqr = new_ast();
+
+          *sqr = *ast;
+          sqr->sym = sym_lookup("*");
+          sqr->child = new_ast();
+          *(sqr->child) = *expr1;
+          sqr->child->next = new_ast();
+          *(sqr->child->next) = *expr1;
+          sqr->child->next->next = NULL;
+
+          return exec_binary_data(jit, sqr, cleanup);
+       }
+
+       return exec_binary_data(jit, ast, cleanup);
+    }
+
+    LLVMValueRef v1 = exec_ast(jit, expr1)->val;
+    LLVMValueRef v2 = exec_ast(jit, expr2)->val;
+
+    if (expr1->type == ctx->t_double)
+    {
+       double e = expr2->tag == AST_DOUBLE ? atof(expr2->sym->name) : -1.0;
+
+       if (e == 0.0) /* pow(x, 0) is 1 even for NaN */
+          val = LLVMConstReal(LLVMDoubleTypeInContext(jit->context), 1.0);
+       else if (e == 1.0)
+          val = v1;
+       else if (e == 2.0)
+          val = LLVMBuildFMul(jit->builder, v1, v1, "sqr");
+       else
+       {
+          LLVMValueRef args[2] = { v1, v2 };
+          val = LLVMBuildCall(jit->builder, 
+                LLVMGetNamedFunction(jit->module, "llvm.pow.f64"), args, 2, "pow");
+       }
+    } else if (expr2->tag == AST_UINT) /* unroll constant exponents */
+       val = exec_pow_const(jit, v1, strtoul(expr2->sym->name, NULL, 10));
+    else if (expr2->tag == AST_INT)
+    {
+       long e = atol(expr2->sym->name);
+       
+       val = exec_pow_const(jit, v1, e < 0 ? -(unsigned long) e : e);
+       if (e < 0)
+          val = exec_pow_neg(jit, v1, val);
+    } else if (expr2->type == ctx->t_int)
+    {
+       LLVMValueRef zero = LLVMConstInt(LLVMWordType(), 0, 0);
+       LLVMValueRef neg = LLVMBuildICmp(jit->builder, LLVMIntSLT, v2, zero, "eneg");
+       LLVMValueRef e = LLVMBuildSelect(jit->builder, neg, 
+                        LLVMBuildNeg(jit->builder, v2, "abs"), v2, "e");
+
+       val = exec_pow_loop(jit, v1, e);
+       val = LLVMBuildSelect(jit->builder, neg, exec_pow_neg(jit, v1, val), val, "pow");
+    } else
+       val = exec_pow_loop(jit, v1, v2);
+
+    return ret(0, val);
+}
+
 /* 
    Dispatch to various binary operations 
 */
@@ -743,6 +1661,9 @@ ret_t * exec_binop(jit_t * jit, ast_t * ast, int cleanup)
     if (ast->sym == sym_lookup("%"))
         return exec_mod(jit, ast, cleanup);
 
+    if (ast->sym == sym_lookup("^"))
+        return exec_pow(jit, ast, cleanup);
+
     if (ast->sym == sym_lookup("=="))
         return exec_eq(jit, ast);
 
@@ -775,8 +1696,8 @@ ret_t * exec_block(jit_t * jit, ast_t * ast)
    
     if (ast->tag == AST_BLOCK)
     {
-       scope_save = current_scope;
-       current_scope = ast->env;
+       scope_save = ctx->current_scope;
+       ctx->current_scope = ast->env;
     }
 
     while (c != NULL)
@@ -791,7 +1712,7 @@ ret_t * exec_block(jit_t * jit, ast_t * ast)
        /*if (find_symbol_in_current_scope(sym_lookup("return")) == NULL)*/
        if (c_ret->closed == 0)
           exec_destructors(jit, NULL);
-       current_scope = scope_save;
+       ctx->current_scope = scope_save;
     }
 
     return c_ret;
@@ -809,10 +1730,10 @@ ret_t * exec_if_else_expr(jit_t * jit, ast_t * ast)
     ret_t * exp_ret, * con_ret, * alt_ret;
     LLVMValueRef val;
 
-    LLVMBasicBlockRef i = LLVMAppendBasicBlock(jit->function, "if");
-    LLVMBasicBlockRef b1 = LLVMAppendBasicBlock(jit->function, "ifbody");
-    LLVMBasicBlockRef b2 = LLVMAppendBasicBlock(jit->function, "elsebody");
-    LLVMBasicBlockRef e = LLVMAppendBasicBlock(jit->function, "ifend");
+    LLVMBasicBlockRef i = LLVMAppendBasicBlockInContext(jit->context, jit->function, "if");
+    LLVMBasicBlockRef b1 = LLVMAppendBasicBlockInContext(jit->context, jit->function, "ifbody");
+    LLVMBasicBlockRef b2 = LLVMAppendBasicBlockInContext(jit->context, jit->function, "elsebody");
+    LLVMBasicBlockRef e = LLVMAppendBasicBlockInContext(jit->context, jit->function, "ifend");
 
     LLVMBuildBr(jit->builder, i);
     LLVMPositionBuilderAtEnd(jit->builder, i);  
@@ -834,143 +1755,1170 @@ ret_t * exec_if_else_expr(jit_t * jit, ast_t * ast)
     alt_ret = exec_ast(jit, alt); /* stmt2 */
     LLVMBuildStore(jit->builder, alt_ret->val, tmp);
 
-    LLVMBuildBr(jit->builder, e);
+    LLVMBuildBr(jit->builder, e);
+
+    LLVMPositionBuilderAtEnd(jit->builder, e); 
+    
+    val = LLVMBuildLoad(jit->builder, tmp, "if_else_tmp");
+      
+    return ret(0, val);
+}
+
+/*
+   Jit an if..else statement
+*/
+ret_t * exec_if_else_stmt(jit_t * jit, ast_t * ast)
+{
+    ast_t * exp = ast->child;
+    ast_t * con = exp->next;
+    ast_t * alt = con->next;
+    
+    ret_t * exp_ret, * con_ret, * alt_ret;
+
+    LLVMBasicBlockRef i = LLVMAppendBasicBlockInContext(jit->context, jit->function, "if");
+    LLVMBasicBlockRef b1 = LLVMAppendBasicBlockInContext(jit->context, jit->function, "ifbody");
+    LLVMBasicBlockRef b2 = LLVMAppendBasicBlockInContext(jit->context, jit->function, "elsebody");
+    LLVMBasicBlockRef e = LLVMAppendBasicBlockInContext(jit->context, jit->function, "ifend");
+
+    LLVMBuildBr(jit->builder, i);
+    LLVMPositionBuilderAtEnd(jit->builder, i);  
+    
+    exp_ret = exec_ast(jit, exp); /* expression */
+
+    LLVMBuildCondBr(jit->builder, exp_ret->val, b1, b2);
+    LLVMPositionBuilderAtEnd(jit->builder, b1); 
+   
+    con_ret = exec_ast(jit, con); /* stmt1 */
+    
+    if (!con_ret->closed)
+       LLVMBuildBr(jit->builder, e);
+
+    LLVMPositionBuilderAtEnd(jit->builder, b2);  
+
+    alt_ret = exec_ast(jit, alt); /* stmt2 */
+    
+    if (!alt_ret->closed)
+       LLVMBuildBr(jit->builder, e);
+
+    if (con_ret->closed && alt_ret->closed)
+    {
+       LLVMDeleteBasicBlock(e);
+       return ret(1, NULL);
+    } else
+    {
+       LLVMPositionBuilderAtEnd(jit->builder, e); 
+       return ret(0, NULL);
+    }
+}
+
+/*
+   Jit an if statement
+*/
+ret_t * exec_if_stmt(jit_t * jit, ast_t * ast)
+{
+    ast_t * exp = ast->child;
+    ast_t * con = exp->next;
+    
+    ret_t * exp_ret, * con_ret;
+
+    LLVMBasicBlockRef i = LLVMAppendBasicBlockInContext(jit->context, jit->function, "if");
+    LLVMBasicBlockRef b = LLVMAppendBasicBlockInContext(jit->context, jit->function, "ifbody");
+    LLVMBasicBlockRef e = LLVMAppendBasicBlockInContext(jit->context, jit->function, "ifend");
+
+    LLVMBuildBr(jit->builder, i);
+    LLVMPositionBuilderAtEnd(jit->builder, i);  
+    
+    exp_ret = exec_ast(jit, exp); /* expression */
+
+    LLVMBuildCondBr(jit->builder, exp_ret->val, b, e);
+    LLVMPositionBuilderAtEnd(jit->builder, b); 
+   
+    con_ret = exec_ast(jit, con); /* stmt1 */
+    
+    if (!con_ret->closed)
+       LLVMBuildBr(jit->builder, e);
+
+    LLVMPositionBuilderAtEnd(jit->builder, e); 
+      
+    return ret(0, NULL);
+}
+
+/*
+   Jit a while statement
+*/
+ret_t * exec_while_stmt(jit_t * jit, ast_t * ast)
+{
+    ast_t * exp = ast->child;
+    ast_t * con = exp->next;
+    
+    ret_t * exp_ret, * con_ret;
+
+    LLVMBasicBlockRef breaksave = jit->breakto;
+
+    LLVMBasicBlockRef w = LLVMAppendBasicBlockInContext(jit->context, jit->function, "while");
+    LLVMBasicBlockRef b = LLVMAppendBasicBlockInContext(jit->context, jit->function, "whilebody");
+    LLVMBasicBlockRef e = LLVMAppendBasicBlockInContext(jit->context, jit->function, "whileend");
+
+    LLVMBuildBr(jit->builder, w);
+    LLVMPositionBuilderAtEnd(jit->builder, w);  
+    
+    exp_ret = exec_ast(jit, exp); /* expression */
+    
+    LLVMBuildCondBr(jit->builder, exp_ret->val, b, e);
+    LLVMPositionBuilderAtEnd(jit->builder, b); 
+   
+    jit->breakto = e;
+
+    con_ret = exec_ast(jit, con); /* stmt1 */
+    
+    jit->breakto = breaksave;
+
+    if (!con_ret->closed)
+    {
+        exec_poll(jit);
+        LLVMBuildBr(jit->builder, w);
+    }
+ 
+    LLVMPositionBuilderAtEnd(jit->builder, e); 
+      
+    return ret(0, NULL);
+}
+
+/*
+   Jit a break statement
+*/
+ret_t * exec_break(jit_t * jit, ast_t * ast)
+{
+    if (jit->breakto == NULL)
+        jit_exception(jit, "Attempt to break outside loop");
+
+    LLVMBuildBr(jit->builder, jit->breakto);
+         
+    return ret(1, NULL);
+}
+
+/*
+   Make a fresh local for the loop variable of a for statement
+*/
+LLVMValueRef exec_loop_var(jit_t * jit, ast_t * id)
+{
+    bind_t * bind = find_symbol(id->sym);
+    
+    bind->llvm = serialise(id->sym->name);
+    
+    return AddLocal(jit, LLVMWordType(), bind->llvm);
+}
+
+/*
+   Start jit'ing a loop over the range [lo, hi), with the loop counter
+   stored in var. The builder is left in the body of the loop.
+*/
+void loop_start(jit_t * jit, loop_t * l, LLVMValueRef var, 
+                                   LLVMValueRef lo, LLVMValueRef hi)
+{
+    LLVMValueRef i, cmp;
+
+    l->var = var;
+    l->cond = LLVMAppendBasicBlockInContext(jit->context, jit->function, "for");
+    l->body = LLVMAppendBasicBlockInContext(jit->context, jit->function, "forbody");
+    l->end = LLVMAppendBasicBlockInContext(jit->context, jit->function, "forend");
+
+    LLVMBuildStore(jit->builder, lo, var);
+    LLVMBuildBr(jit->builder, l->cond);
+    LLVMPositionBuilderAtEnd(jit->builder, l->cond);  
+    
+    i = LLVMBuildLoad(jit->builder, var, "i");
+    cmp = LLVMBuildICmp(jit->builder, LLVMIntSLT, i, hi, "cmp");
+    
+    LLVMBuildCondBr(jit->builder, cmp, l->body, l->end);
+    LLVMPositionBuilderAtEnd(jit->builder, l->body); 
+}
+
+/*
+   Jit a check for a request to cancel the background job running the
+   loop, at the end of each iteration. Until some job is cancelled it 
+   is just a load and a branch.
+*/
+void exec_poll(jit_t * jit)
+{
+    LLVMValueRef cancel = LLVMGetNamedGlobal(jit->module, "bg_cancel");
+    LLVMBasicBlockRef b = LLVMAppendBasicBlockInContext(jit->context, jit->function, "cancel");
+    LLVMBasicBlockRef e = LLVMAppendBasicBlockInContext(jit->context, jit->function, "nocancel");
+    LLVMValueRef val;
+
+    val = LLVMBuildLoad(jit->builder, cancel, "cancel");
+    LLVMSetVolatile(val, 1); /* set by another thread */
+    val = LLVMBuildICmp(jit->builder, LLVMIntNE, val, LLVMConstInt(LLVMInt32TypeInContext(jit->context), 0, 0), "cancelled");
+    LLVMBuildCondBr(jit->builder, val, b, e);
+    
+    LLVMPositionBuilderAtEnd(jit->builder, b);
+    LLVMBuildCall(jit->builder, LLVMGetNamedFunction(jit->module, "bg_check"), NULL, 0, "");
+    LLVMBuildBr(jit->builder, e);
+
+    LLVMPositionBuilderAtEnd(jit->builder, e);
+}
+
+/*
+   Finish jit'ing a loop, incrementing the counter unless the body 
+   ended with a jump
+*/
+void loop_end(jit_t * jit, loop_t * l, int closed)
+{
+    LLVMValueRef i;
+
+    if (!closed)
+    {
+        i = LLVMBuildLoad(jit->builder, l->var, "i");
+        i = LLVMBuildAdd(jit->builder, i, LLVMConstInt(LLVMWordType(), 1, 0), "inc");
+        LLVMBuildStore(jit->builder, i, l->var);
+        exec_poll(jit);
+        LLVMBuildBr(jit->builder, l->cond);
+    }
+ 
+    LLVMPositionBuilderAtEnd(jit->builder, l->end); 
+}
+
+/*
+   Jit a loop over the range [lo, hi) with the given body. If breakable
+   is not set, a break in the body is an error.
+*/
+void exec_for_loop(jit_t * jit, LLVMValueRef var, LLVMValueRef lo, 
+                                LLVMValueRef hi, ast_t * body, int breakable)
+{
+    ret_t * body_ret;
+    loop_t l;
+
+    LLVMBasicBlockRef breaksave = jit->breakto;
+
+    loop_start(jit, &l, var, lo, hi);
+   
+    jit->breakto = breakable ? l.end : NULL;
+
+    body_ret = exec_ast(jit, body);
+    
+    jit->breakto = breaksave;
+
+    loop_end(jit, &l, body_ret->closed);
+}
+
+/*
+   Jit a for statement
+*/
+ret_t * exec_for_stmt(jit_t * jit, ast_t * ast)
+{
+    ast_t * id = ast->child;
+    ast_t * lo = id->next;
+    ast_t * hi = lo->next;
+    ast_t * body = hi->next;
+
+    env_t * scope_save = ctx->current_scope;
+    ret_t * lo_ret, * hi_ret;
+    LLVMValueRef var;
+
+    /* the range is evaluated once, outside the loop scope */
+    lo_ret = exec_ast(jit, lo);
+    hi_ret = exec_ast(jit, hi);
+
+    ctx->current_scope = ast->env;
+    
+    var = exec_loop_var(jit, id);
+    exec_for_loop(jit, var, lo_ret->val, hi_ret->val, body, 1);
+
+    ctx->current_scope = scope_save;
+    
+    return ret(0, NULL);
+}
+
+/*
+   Bind sym in the current scope to a copy of the given variable, whose
+   storage is now given by val
+*/
+bind_t * bind_shadow(bind_t * bind, sym_t * sym, LLVMValueRef val)
+{
+    bind_t * b = (bind_t *) GC_MALLOC(sizeof(bind_t));
+    
+    *b = *bind;
+    b->sym = sym;
+    b->llvm = serialise(sym->name);
+    b->llvm_val = NULL;
+    b->next = ctx->current_scope->scope;
+    ctx->current_scope->scope = b;
+    
+    loc_insert(b->llvm, val);
+
+    return b;
+}
+
+/*
+   Bind a hidden name in the current scope to a variable of the given
+   type. If val is NULL, the variable is initialised by its first 
+   assignment, otherwise val gives its storage.
+*/
+bind_t * bind_temp(type_t * t, LLVMValueRef val)
+{
+    bind_t * b = bind_symbol(sym_lookup(serialise("__cs_tmp")), t, NULL);
+
+    if (val != NULL)
+    {
+       b->llvm = serialise(b->sym->name);
+       loc_insert(b->llvm, val);
+    }
+
+    return b;
+}
+
+/*
+   Return an identifier AST node for a bound symbol
+*/
+ast_t * bind_ident(bind_t * b)
+{
+    return ast_symbol(AST_IDENT, b->sym);
+}
+
+/*
+   Store the given pointers in an environment for an outlined loop 
+   body. Entries which are NULL are left unset.
+*/
+LLVMValueRef env_store(jit_t * jit, LLVMValueRef * vals, int n)
+{
+    LLVMTypeRef i8ptr = LLVMPointerType(LLVMInt8TypeInContext(jit->context), 0);
+    LLVMValueRef envp = AddLocal(jit, LLVMArrayType(i8ptr, n), serialise("env"));
+    LLVMValueRef p;
+    int i;
+
+    for (i = 0; i < n; i++)
+    {
+       if (vals[i] != NULL)
+       {
+          LLVMValueRef index[2] = { LLVMConstInt(LLVMInt32TypeInContext(jit->context), 0, 0), LLVMConstInt(LLVMInt32TypeInContext(jit->context), i, 0) };
+          p = LLVMBuildInBoundsGEP(jit->builder, envp, index, 2, "env");
+          LLVMBuildStore(jit->builder, LLVMBuildPointerCast(jit->builder, vals[i], i8ptr, "var"), p);
+       }
+    }
+
+    return envp;
+}
+
+/*
+   Load entry i of the n entry environment of the outlined loop body
+   being jit'd, as a pointer of the given type
+*/
+LLVMValueRef env_load(jit_t * jit, int n, int i, LLVMTypeRef type)
+{
+    LLVMTypeRef env_type = LLVMArrayType(LLVMPointerType(LLVMInt8TypeInContext(jit->context), 0), n);
+    LLVMValueRef env = LLVMGetParam(jit->function, 2);
+    LLVMValueRef index[2] = { LLVMConstInt(LLVMInt32TypeInContext(jit->context), 0, 0), LLVMConstInt(LLVMInt32TypeInContext(jit->context), i, 0) };
+    LLVMValueRef p;
+    
+    env = LLVMBuildPointerCast(jit->builder, env, LLVMPointerType(env_type, 0), "env");
+    p = LLVMBuildInBoundsGEP(jit->builder, env, index, 2, "env");
+    p = LLVMBuildLoad(jit->builder, p, "var");
+    
+    return LLVMBuildPointerCast(jit->builder, p, type, "var");
+}
+
+/*
+   Start jit'ing an outlined loop body void body(word lo, word hi, 
+   i8 * env), to be run on the thread pool. The state of the jit for
+   the caller is saved in o. Tasks started by spawn are outlined the 
+   same way, and ignore lo and hi.
+*/
+void outline_start(jit_t * jit, outline_t * o)
+{
+    LLVMTypeRef args[3];
+    
+    args[0] = LLVMWordType();
+    args[1] = LLVMWordType();
+    args[2] = LLVMPointerType(LLVMInt8TypeInContext(jit->context), 0);
+    
+    o->fn_save = jit->function;
+    o->build_save = jit->builder;
+    o->break_save = jit->breakto;
+    o->scope_save = ctx->current_scope;
+
+    o->fn = LLVMAddFunction(jit->module, serialise("__cs_parfor"), 
+                            LLVMFunctionType(LLVMVoidTypeInContext(jit->context), args, 3, 0));
+    
+    jit->function = o->fn;
+    jit->builder = LLVMCreateBuilderInContext(jit->context);
+    jit->breakto = NULL;
+    LLVMPositionBuilderAtEnd(jit->builder, LLVMAppendBasicBlockInContext(jit->context, o->fn, "entry"));
+}
+
+/*
+   Finish jit'ing an outlined function and return to jit'ing the caller
+*/
+void outline_close(jit_t * jit, outline_t * o)
+{
+    LLVMBuildRetVoid(jit->builder);
+    
+    jit_optimise(jit, o->fn);
+
+    LLVMDisposeBuilder(jit->builder);
+    jit->builder = o->build_save;
+    jit->function = o->fn_save;
+    jit->breakto = o->break_save;
+    ctx->current_scope = o->scope_save;
+}
+
+/*
+   Finish jit'ing an outlined loop body and return to the caller, which
+   runs it on the thread pool over [lo, hi) with the given environment
+*/
+void outline_end(jit_t * jit, outline_t * o, LLVMValueRef envp, 
+                                LLVMValueRef lo, LLVMValueRef hi)
+{
+    LLVMTypeRef i8ptr = LLVMPointerType(LLVMInt8TypeInContext(jit->context), 0);
+    LLVMValueRef args[4];
+
+    outline_close(jit, o);
+
+    args[0] = LLVMConstPointerCast(o->fn, i8ptr);
+    args[1] = LLVMBuildPointerCast(jit->builder, envp, i8ptr, "env");
+    args[2] = lo;
+    args[3] = hi;
+    LLVMBuildCall(jit->builder, LLVMGetNamedFunction(jit->module, "pool_for"), args, 4, "");
+}
+
+/*
+   Jit a thread's private copy of a reduction variable, initialised to
+   the identity for the reduction. For min and max we start from the
+   shared value, so the caller must hold the pool lock.
+*/
+LLVMValueRef exec_reduce_init(jit_t * jit, ast_t * red, bind_t * shared)
+{
+    type_t * t = shared->type;
+    int one = (red->sym == sym_lookup("*"));
+    int copy = (red->sym == sym_lookup("min") || red->sym == sym_lookup("max"));
+    LLVMValueRef var, fn, args[2];
+    LLVMValueRef priv = AddLocal(jit, type_to_llvm(jit, t), serialise("__cs_red"));
+    
+    if (scope_is_global(shared))
+       var = global_lookup(jit, shared);
+    else
+       var = loc_lookup(shared->llvm);
+
+    if (t == ctx->t_ZZ)
+    {
+       args[0] = priv;
+       if (copy)
+       {
+          fn = LLVMGetNamedFunction(jit->module, "__ZZ_init_set");
+          args[1] = var;
+       } else
+       {
+          fn = LLVMGetNamedFunction(jit->module, "__ZZ_init_set_ui");
+          args[1] = LLVMConstInt(LLVMWordType(), one, 0);
+       }
+       LLVMBuildCall(jit->builder, fn, args, 2, "");
+    } else if (copy)
+       LLVMBuildStore(jit->builder, LLVMBuildLoad(jit->builder, var, "red"), priv);
+    else if (t == ctx->t_double)
+       LLVMBuildStore(jit->builder, LLVMConstReal(LLVMDoubleTypeInContext(jit->context), one), priv);
+    else
+       LLVMBuildStore(jit->builder, LLVMConstInt(LLVMWordType(), one, 0), priv);
+
+    return priv;
+}
+
+/*
+   Jit the combination of a thread's partial result, bound to part, 
+   into the shared reduction variable. The caller must hold the pool 
+   lock.
+*/
+void exec_reduce_combine(jit_t * jit, ast_t * red, sym_t * part)
+{
+    sym_t * s = red->child->sym;
+    ast_t * stmt;
+    
+    if (red->sym == sym_lookup("min") || red->sym == sym_lookup("max"))
+    {
+       sym_t * cmp = sym_lookup(red->sym == sym_lookup("min") ? "<" : ">");
+       
+       stmt = ast2(AST_IF_STMT, 
+                   ast_binop(cmp, ast_symbol(AST_IDENT, part), ast_symbol(AST_IDENT, s)),
+                   ast1(AST_THEN, ast2(AST_ASSIGNMENT, ast_symbol(AST_LIDENT, s), 
+                                                       ast_symbol(AST_IDENT, part))));
+    } else /* s = s op part */
+       stmt = ast2(AST_ASSIGNMENT, ast_symbol(AST_LIDENT, s), 
+                   ast_binop(red->sym, ast_symbol(AST_IDENT, s), ast_symbol(AST_IDENT, part)));
+       
+    inference(stmt);
+    exec_ast(jit, stmt);
+}
+
+/*
+   Jit a parallel for statement. The body is outlined into a function
+   which runs a range of iterations, given an environment holding 
+   pointers to the local variables visible in the body. The function 
+   is then run on chunks of the range by the thread pool. Reduction 
+   variables are replaced by private copies in each chunk, which are 
+   combined into the shared variable at the end of the chunk.
+*/
+ret_t * exec_parfor_stmt(jit_t * jit, ast_t * ast)
+{
+    ast_t * id = ast->child;
+    ast_t * lo = id->next;
+    ast_t * hi = lo->next;
+    ast_t * body = hi->next;
+    ast_t * red;
+    
+    env_t * env = ast->env, * e;
+    bind_t * scope_orig = env->scope, * shared_scope, * b;
+    bind_t ** caps, ** privs;
+    ret_t * lo_ret, * hi_ret;
+    int i, j, n = 0, m = 0;
+    outline_t o;
+
+    LLVMValueRef * vals, * red_vals, envp;
+    sym_t ** parts;
+
+    /* the range is evaluated once, outside the loop scope */
+    lo_ret = exec_ast(jit, lo);
+    hi_ret = exec_ast(jit, hi);
+
+    /* 
+       find the local variables visible in the body, innermost first;
+       the binds of the loop scope itself hide any outer variable
+    */
+    for (e = env; e->next != NULL; e = e->next)
+       for (b = e->scope; b != NULL; b = b->next)
+          n++;
+
+    caps = (bind_t **) GC_MALLOC((n + 1)*sizeof(bind_t *));
+    vals = (LLVMValueRef *) GC_MALLOC((n + 1)*sizeof(LLVMValueRef));
+
+    n = 0;
+    for (e = env; e->next != NULL; e = e->next)
+    {
+       for (b = e->scope; b != NULL; b = b->next)
+       {
+          for (i = 0; i < n && caps[i]->sym != b->sym; i++) ;
+          
+          if (i == n) /* not hidden by an inner binding */
+          {
+             caps[n] = b;
+             if (e != env && b->llvm != NULL && b->type != NULL)
+                vals[n] = loc_lookup(b->llvm);
+             n++;
+          }
+       }
+    }
+
+    /* pass pointers to them to the loop body */
+    envp = env_store(jit, vals, n);
+    
+    outline_start(jit, &o);
+    
+    ctx->current_scope = env;
+
+    /* shadow the captured variables with the pointers in the environment */
+    for (i = 0; i < n; i++)
+       if (vals[i] != NULL)
+          bind_shadow(caps[i], caps[i]->sym, env_load(jit, n, i, LLVMTypeOf(vals[i])));
+    
+    shared_scope = env->scope;
+
+    /* replace reduction variables with private copies */
+    for (red = body->next; red != NULL; red = red->next)
+       m++;
+
+    privs = (bind_t **) GC_MALLOC((m + 1)*sizeof(bind_t *));
+    red_vals = (LLVMValueRef *) GC_MALLOC((m + 1)*sizeof(LLVMValueRef));
+    parts = (sym_t **) GC_MALLOC((m + 1)*sizeof(sym_t *));
+
+    if (m != 0)
+       LLVMBuildCall(jit->builder, LLVMGetNamedFunction(jit->module, "pool_lock"), NULL, 0, "");
+
+    for (red = body->next, j = 0; red != NULL; red = red->next, j++)
+       red_vals[j] = exec_reduce_init(jit, red, find_symbol(red->child->sym));
+    
+    for (red = body->next, j = 0; red != NULL; red = red->next, j++)
+       privs[j] = bind_shadow(find_symbol(red->child->sym), red->child->sym, red_vals[j]);
+
+    if (m != 0)
+       LLVMBuildCall(jit->builder, LLVMGetNamedFunction(jit->module, "pool_unlock"), NULL, 0, "");
+
+    /* jit the loop over the chunk */
+    exec_for_loop(jit, exec_loop_var(jit, id), LLVMGetParam(o.fn, 0), 
+                  LLVMGetParam(o.fn, 1), body, 0);
+
+    /* combine the partial results into the shared variables */
+    env->scope = shared_scope;
+
+    for (j = 0; j < m; j++)
+    {
+       parts[j] = sym_lookup(serialise("__cs_red"));
+       bind_shadow(privs[j], parts[j], red_vals[j]);
+    }
+
+    if (m != 0)
+    {
+       LLVMBuildCall(jit->builder, LLVMGetNamedFunction(jit->module, "pool_lock"), NULL, 0, "");
+    
+       for (red = body->next, j = 0; red != NULL; red = red->next, j++)
+          exec_reduce_combine(jit, red, parts[j]);
+
+       LLVMBuildCall(jit->builder, LLVMGetNamedFunction(jit->module, "pool_unlock"), NULL, 0, "");
+
+       for (j = 0; j < m; j++)
+          call_destructors(jit, red_vals[j], privs[j]->type, NULL);
+    }
+
+    env->scope = scope_orig;
+
+    /* run the loop on the thread pool */
+    outline_end(jit, &o, envp, lo_ret->val, hi_ret->val);
+
+    return ret(0, NULL);
+}
+
+/*
+   Jit a statement of the body of a builtin loop, destroying any 
+   temporaries it creates at the end of the iteration
+*/
+void exec_loop_stmt(jit_t * jit, ast_t * stmt)
+{
+    scope_up();
+    exec_ast(jit, stmt);
+    exec_destructors(jit, NULL);
+    scope_down();
+}
+
+/*
+   Jit the allocation of an array of the given type with len entries,
+   which are constructed
+*/
+LLVMValueRef exec_array_alloc(jit_t * jit, type_t * t, LLVMValueRef len)
+{
+    LLVMValueRef val = AddLocal(jit, array_to_llvm(jit, t), "array_s");
+    LLVMValueRef arr = LLVMBuildGCArrayMalloc(jit, t->params[0], len, "arr");
+    LLVMValueRef indices[2] = { LLVMConstInt(LLVMInt32TypeInContext(jit->context), 0, 0), LLVMConstInt(LLVMInt32TypeInContext(jit->context), 1, 0) };
+    LLVMValueRef indices2[2] = { LLVMConstInt(LLVMInt32TypeInContext(jit->context), 0, 0), LLVMConstInt(LLVMInt32TypeInContext(jit->context), 0, 0) };
+    
+    LLVMBuildStore(jit->builder, len, LLVMBuildInBoundsGEP(jit->builder, val, indices, 2, "length"));
+    LLVMBuildStore(jit->builder, arr, LLVMBuildInBoundsGEP(jit->builder, val, indices2, 2, "array"));
+    
+    call_constructors(jit, val, t);
+
+    return val;
+}
+
+/*
+   Jit map(f, a). The result is allocated up front, then the entries 
+   are computed in parallel by a loop which calls the prototype of f
+   found by inference directly, so that it can be inlined.
+*/
+ret_t * exec_map(jit_t * jit, ast_t * ast)
+{
+    ast_t * f = ast->child->next;
+    ast_t * arr = f->next;
+    ast_t * stmt;
+    bind_t * s, * d, * i;
+    LLVMValueRef src, dst, len, vals[2], envp;
+    outline_t o;
+    loop_t l;
+
+    src = exec_ast(jit, arr)->val;
+    len = LLVMBuildLoadField(jit, src, 1, "length");
+    dst = exec_array_alloc(jit, ast->type, len);
+    
+    vals[0] = src;
+    vals[1] = dst;
+    envp = env_store(jit, vals, 2);
+
+    outline_start(jit, &o);
+    scope_up();
+    
+    s = bind_temp(arr->type, env_load(jit, 2, 0, LLVMTypeOf(src)));
+    d = bind_temp(ast->type, env_load(jit, 2, 1, LLVMTypeOf(dst)));
+    i = bind_temp(ctx->t_int, AddLocal(jit, LLVMWordType(), serialise("i")));
+    
+    /* d[i] = f(s[i]) */
+    stmt = ast2(AST_ASSIGNMENT, ast2(AST_LLOCN, bind_ident(d), bind_ident(i)),
+                ast2(AST_APPL, ast_symbol(AST_IDENT, f->sym), 
+                               ast2(AST_LOCN, bind_ident(s), bind_ident(i))));
+    inference(stmt);
+
+    loop_start(jit, &l, loc_lookup(i->llvm), LLVMGetParam(o.fn, 0), LLVMGetParam(o.fn, 1));
+    exec_loop_stmt(jit, stmt);
+    loop_end(jit, &l, 0);
+
+    outline_end(jit, &o, envp, LLVMConstInt(LLVMWordType(), 0, 0), len);
+
+    return ret(0, dst);
+}
+
+/*
+   Jit filter(f, a). The predicate is evaluated on all entries in 
+   parallel, then the selected entries are copied to the result in 
+   order.
+*/
+ret_t * exec_filter(jit_t * jit, ast_t * ast)
+{
+    ast_t * f = ast->child->next;
+    ast_t * arr = f->next;
+    ast_t * appl, * stmt;
+    bind_t * s, * d, * i, * j;
+    LLVMValueRef src, dst, len, flags, vals[2], envp, idx, c, count;
+    LLVMBasicBlockRef copy, next;
+    env_t * scope_save = ctx->current_scope;
+    outline_t o;
+    loop_t l;
+
+    src = exec_ast(jit, arr)->val;
+    len = LLVMBuildLoadField(jit, src, 1, "length");
+    flags = LLVMBuildGCArrayMalloc(jit, ctx->t_bool, len, "flags");
+    
+    vals[0] = src;
+    vals[1] = flags;
+    envp = env_store(jit, vals, 2);
+
+    /* flags[i] = f(s[i]) */
+    outline_start(jit, &o);
+    scope_up();
+    
+    s = bind_temp(arr->type, env_load(jit, 2, 0, LLVMTypeOf(src)));
+    i = bind_temp(ctx->t_int, AddLocal(jit, LLVMWordType(), serialise("i")));
+    
+    appl = ast2(AST_APPL, ast_symbol(AST_IDENT, f->sym), 
+                          ast2(AST_LOCN, bind_ident(s), bind_ident(i)));
+    inference(appl);
+
+    loop_start(jit, &l, loc_lookup(i->llvm), LLVMGetParam(o.fn, 0), LLVMGetParam(o.fn, 1));
+    scope_up();
+    c = exec_ast(jit, appl)->val;
+    idx = LLVMBuildLoad(jit->builder, l.var, "i");
+    LLVMBuildStore(jit->builder, c, 
+          LLVMBuildInBoundsGEP(jit->builder, env_load(jit, 2, 1, LLVMTypeOf(flags)), &idx, 1, "flag"));
+    exec_destructors(jit, NULL);
+    scope_down();
+    loop_end(jit, &l, 0);
+
+    outline_end(jit, &o, envp, LLVMConstInt(LLVMWordType(), 0, 0), len);
+
+    /* count the selected entries */
+    scope_up();
+    
+    i = bind_temp(ctx->t_int, AddLocal(jit, LLVMWordType(), serialise("i")));
+    j = bind_temp(ctx->t_int, AddLocal(jit, LLVMWordType(), serialise("j")));
+    LLVMBuildStore(jit->builder, LLVMConstInt(LLVMWordType(), 0, 0), loc_lookup(j->llvm));
+
+    loop_start(jit, &l, loc_lookup(i->llvm), LLVMConstInt(LLVMWordType(), 0, 0), len);
+    idx = LLVMBuildLoad(jit->builder, l.var, "i");
+    c = LLVMBuildLoad(jit->builder, LLVMBuildInBoundsGEP(jit->builder, flags, &idx, 1, "flag"), "flag");
+    c = LLVMBuildZExt(jit->builder, c, LLVMWordType(), "flag");
+    count = LLVMBuildLoad(jit->builder, loc_lookup(j->llvm), "count");
+    LLVMBuildStore(jit->builder, LLVMBuildAdd(jit->builder, count, c, "count"), loc_lookup(j->llvm));
+    loop_end(jit, &l, 0);
+    
+    count = LLVMBuildLoad(jit->builder, loc_lookup(j->llvm), "count");
+    dst = exec_array_alloc(jit, ast->type, count);
+
+    /* d[j] = s[i] for the selected i */
+    s = bind_temp(arr->type, src);
+    d = bind_temp(ast->type, dst);
+    
+    stmt = ast2(AST_ASSIGNMENT, ast2(AST_LLOCN, bind_ident(d), bind_ident(j)),
+                                ast2(AST_LOCN, bind_ident(s), bind_ident(i)));
+    inference(stmt);
+    
+    LLVMBuildStore(jit->builder, LLVMConstInt(LLVMWordType(), 0, 0), loc_lookup(j->llvm));
+    
+    loop_start(jit, &l, loc_lookup(i->llvm), LLVMConstInt(LLVMWordType(), 0, 0), len);
+    copy = LLVMAppendBasicBlockInContext(jit->context, jit->function, "copy");
+    next = LLVMAppendBasicBlockInContext(jit->context, jit->function, "next");
+    idx = LLVMBuildLoad(jit->builder, l.var, "i");
+    c = LLVMBuildLoad(jit->builder, LLVMBuildInBoundsGEP(jit->builder, flags, &idx, 1, "flag"), "flag");
+    LLVMBuildCondBr(jit->builder, c, copy, next);
+    
+    LLVMPositionBuilderAtEnd(jit->builder, copy);
+    exec_loop_stmt(jit, stmt);
+    count = LLVMBuildLoad(jit->builder, loc_lookup(j->llvm), "j");
+    count = LLVMBuildAdd(jit->builder, count, LLVMConstInt(LLVMWordType(), 1, 0), "j");
+    LLVMBuildStore(jit->builder, count, loc_lookup(j->llvm));
+    LLVMBuildBr(jit->builder, next);
+    
+    LLVMPositionBuilderAtEnd(jit->builder, next);
+    loop_end(jit, &l, 0);
+
+    ctx->current_scope = scope_save;
+
+    return ret(0, dst);
+}
+
+/*
+   Jit reduce(f, a, init), which computes f(...f(f(init, a[0]), a[1])...).
+   If f takes two values of the type of the entries, the array is 
+   split into blocks which are reduced in parallel, and the partial 
+   results are then combined in order. This assumes f is associative.
+   Otherwise the reduction is done serially.
+*/
+ret_t * exec_array_reduce(jit_t * jit, ast_t * ast)
+{
+    ast_t * f = ast->child->next;
+    ast_t * arr = f->next;
+    ast_t * init = arr->next;
+    ast_t * stmt, * stmt2, * stmt3;
+    type_t * t = ast->type, * t_part = array_type(t);
+    bind_t * s, * p, * r, * i, * k, * acc, * bs, * bi;
+    LLVMValueRef src, len, blocks, part, val, temp = NULL, vals[3], envp, n, nb, onb, first, last;
+    env_t * scope_save = ctx->current_scope;
+    outline_t o;
+    loop_t l, l2;
+    int structured = (t->tag == DATA || t->tag == TUPLE || t->tag == ARRAY);
+
+    src = exec_ast(jit, arr)->val;
+    len = LLVMBuildLoadField(jit, src, 1, "length");
+    val = exec_ast(jit, init)->val;
+
+    if (structured) /* the result is a temporary, like the value of a call */
+    {
+       char * name = serialise("__cs_data");
+       temp = create_var(jit, sym_lookup(name), name, t);
+    }
+
+    scope_up();
+
+    if (!structured)
+    {
+       LLVMValueRef var = AddLocal(jit, type_to_llvm(jit, t), serialise("init"));
+       LLVMBuildStore(jit->builder, val, var);
+       val = var;
+    }
+
+    s = bind_temp(arr->type, src);
+    r = bind_temp(t, NULL);
+    i = bind_temp(ctx->t_int, AddLocal(jit, LLVMWordType(), serialise("i")));
+    
+    /* r = init */
+    stmt = ast2(AST_ASSIGNMENT, ast_symbol(AST_LIDENT, r->sym), bind_ident(bind_temp(t, val)));
+    inference(stmt);
+    exec_ast(jit, stmt);
+
+    if (arr->type->params[0] == t) /* partial results can be combined with f */
+    {
+       blocks = AddLocal(jit, LLVMWordType(), serialise("blocks"));
+       nb = LLVMBuildCall(jit->builder, LLVMGetNamedFunction(jit->module, "pool_blocks"), &len, 1, "blocks");
+       LLVMBuildStore(jit->builder, nb, blocks);
+       part = exec_array_alloc(jit, t_part, nb);
+       
+       vals[0] = src;
+       vals[1] = part;
+       vals[2] = blocks;
+       envp = env_store(jit, vals, 3);
+
+       /* reduce blocks [k*n/nb, (k + 1)*n/nb) into p[k] */
+       outline_start(jit, &o);
+       scope_up();
+       
+       n = env_load(jit, 3, 0, LLVMTypeOf(src));
+       bs = bind_temp(arr->type, n);
+       n = LLVMBuildLoadField(jit, n, 1, "length");
+       p = bind_temp(t_part, env_load(jit, 3, 1, LLVMTypeOf(part)));
+       onb = LLVMBuildLoad(jit->builder, env_load(jit, 3, 2, LLVMTypeOf(blocks)), "blocks");
+       bi = bind_temp(ctx->t_int, AddLocal(jit, LLVMWordType(), serialise("i")));
+       k = bind_temp(ctx->t_int, AddLocal(jit, LLVMWordType(), serialise("k")));
+       acc = bind_temp(t, NULL);
+
+       /* acc = s[i], acc = f(acc, s[i]), p[k] = acc */
+       stmt = ast2(AST_ASSIGNMENT, ast_symbol(AST_LIDENT, acc->sym), 
+                                   ast2(AST_LOCN, bind_ident(bs), bind_ident(bi)));
+       stmt2 = ast2(AST_ASSIGNMENT, ast_symbol(AST_LIDENT, acc->sym), 
+                    ast2(AST_APPL, ast_symbol(AST_IDENT, f->sym), bind_ident(acc)));
+       stmt2->child->next->child->next->next = ast2(AST_LOCN, bind_ident(bs), bind_ident(bi));
+       stmt3 = ast2(AST_ASSIGNMENT, ast2(AST_LLOCN, bind_ident(p), bind_ident(k)), bind_ident(acc));
+       inference(stmt);
+       inference(stmt2);
+       inference(stmt3);
+
+       loop_start(jit, &l, loc_lookup(k->llvm), LLVMGetParam(o.fn, 0), LLVMGetParam(o.fn, 1));
+       
+       val = LLVMBuildLoad(jit->builder, l.var, "k");
+       first = LLVMBuildSDiv(jit->builder, LLVMBuildMul(jit->builder, val, n, "first"), onb, "first");
+       val = LLVMBuildAdd(jit->builder, val, LLVMConstInt(LLVMWordType(), 1, 0), "k");
+       last = LLVMBuildSDiv(jit->builder, LLVMBuildMul(jit->builder, val, n, "last"), onb, "last");
+       
+       LLVMBuildStore(jit->builder, first, loc_lookup(bi->llvm));
+       exec_loop_stmt(jit, stmt);
+
+       first = LLVMBuildAdd(jit->builder, first, LLVMConstInt(LLVMWordType(), 1, 0), "first");
+       loop_start(jit, &l2, loc_lookup(bi->llvm), first, last);
+       exec_loop_stmt(jit, stmt2);
+       loop_end(jit, &l2, 0);
+
+       exec_loop_stmt(jit, stmt3);
+       call_destructors(jit, loc_lookup(acc->llvm), t, NULL);
+       
+       loop_end(jit, &l, 0);
+
+       outline_end(jit, &o, envp, LLVMConstInt(LLVMWordType(), 0, 0), nb);
+
+       /* r = f(r, p[k]) */
+       p = bind_temp(t_part, part);
+       k = i;
+       stmt = ast2(AST_ASSIGNMENT, ast_symbol(AST_LIDENT, r->sym), 
+                   ast2(AST_APPL, ast_symbol(AST_IDENT, f->sym), bind_ident(r)));
+       stmt->child->next->child->next->next = ast2(AST_LOCN, bind_ident(p), bind_ident(k));
+       inference(stmt);
+
+       loop_start(jit, &l, loc_lookup(k->llvm), LLVMConstInt(LLVMWordType(), 0, 0), nb);
+       exec_loop_stmt(jit, stmt);
+       loop_end(jit, &l, 0);
+
+       call_destructors(jit, part, t_part, NULL);
+    } else
+    {
+       /* r = f(r, s[i]) */
+       stmt = ast2(AST_ASSIGNMENT, ast_symbol(AST_LIDENT, r->sym), 
+                   ast2(AST_APPL, ast_symbol(AST_IDENT, f->sym), bind_ident(r)));
+       stmt->child->next->child->next->next = ast2(AST_LOCN, bind_ident(s), bind_ident(i));
+       inference(stmt);
+
+       loop_start(jit, &l, loc_lookup(i->llvm), LLVMConstInt(LLVMWordType(), 0, 0), len);
+       exec_loop_stmt(jit, stmt);
+       loop_end(jit, &l, 0);
+    }
+
+    ctx->current_scope = scope_save;
+
+    val = LLVMBuildLoad(jit->builder, loc_lookup(r->llvm), "reduce");
+    
+    if (!structured)
+       return ret(0, val);
+    
+    LLVMBuildStore(jit->builder, val, temp); /* move the result to the temporary */
+    
+    return ret(0, temp);
+}
+
+/*
+   Jit spawn f(args). The arguments are evaluated now and copied into 
+   the environment of a new task, so the task never refers to the 
+   frame of its caller. The call is outlined into a function which the
+   pool runs, leaving the result at the start of the environment. The
+   value of the spawn is the task, which serves as the future.
+*/
+ret_t * exec_spawn(jit_t * jit, ast_t * ast)
+{
+    ast_t * appl = ast->child;
+    ast_t * id = appl->child;
+    ast_t * arg, * call, * last;
+    type_t * res = ast->type->params[0];
+    type_t * env_type, ** types;
+    LLVMTypeRef i8ptr = LLVMPointerType(LLVMInt8TypeInContext(jit->context), 0);
+    LLVMValueRef envp, env, val, slot, args[2];
+    int i, n = 0;
+    outline_t o;
+
+    for (arg = id->next; arg != NULL; arg = arg->next)
+       n++;
+
+    /* the environment holds the result, then the arguments */
+    types = (type_t **) GC_MALLOC((n + 1)*sizeof(type_t *));
+    types[0] = res == ctx->t_nil ? ctx->t_int : res; /* slot unused for nil */
+    for (arg = id->next, i = 1; arg != NULL; arg = arg->next, i++)
+       types[i] = arg->type;
+    env_type = tuple_type(n + 1, types);
+
+    envp = LLVMBuildGCMalloc(jit, env_type, "env");
+
+    for (arg = id->next, i = 1; arg != NULL; arg = arg->next, i++)
+    {
+       LLVMValueRef index[2] = { LLVMConstInt(LLVMInt32TypeInContext(jit->context), 0, 0), LLVMConstInt(LLVMInt32TypeInContext(jit->context), i, 0) };
+       slot = LLVMBuildInBoundsGEP(jit->builder, envp, index, 2, "arg");
+
+       if (arg->tag == AST_APPL && is_structured(arg->type)) /* move the temporary */
+       {
+          val = exec_appl(jit, arg, 0)->val;
+          LLVMBuildStore(jit->builder, LLVMBuildLoad(jit->builder, val, "load"), slot);
+       } else
+       {
+          val = exec_ast(jit, arg)->val;
+          if (is_structured(arg->type))
+             copy_construct(jit, slot, val, arg->type);
+          else
+             LLVMBuildStore(jit->builder, val, slot);
+       }
+    }
+
+    outline_start(jit, &o);
+    scope_up();
+    
+    env = LLVMBuildPointerCast(jit->builder, LLVMGetParam(o.fn, 2), 
+                               LLVMPointerType(type_to_llvm(jit, env_type), 0), "env");
+    
+    /* call f on the copies of the arguments, which it owns */
+    call = ast1(AST_APPL, ast_symbol(AST_IDENT, id->sym));
+    last = call->child;
+    for (i = 1; i <= n; i++)
+    {
+       LLVMValueRef index[2] = { LLVMConstInt(LLVMInt32TypeInContext(jit->context), 0, 0), LLVMConstInt(LLVMInt32TypeInContext(jit->context), i, 0) };
+       slot = LLVMBuildInBoundsGEP(jit->builder, env, index, 2, "arg");
+       
+       last->next = bind_ident(bind_temp(types[i], slot));
+       last = last->next;
+    }
+    inference(call);
+
+    val = exec_appl(jit, call, 0)->val;
 
-    LLVMPositionBuilderAtEnd(jit->builder, e); 
+    if (res != ctx->t_nil)
+    {
+       LLVMValueRef index[2] = { LLVMConstInt(LLVMInt32TypeInContext(jit->context), 0, 0), LLVMConstInt(LLVMInt32TypeInContext(jit->context), 0, 0) };
+       slot = LLVMBuildInBoundsGEP(jit->builder, env, index, 2, "res");
+       
+       if (is_structured(res)) /* move the result out of the temporary */
+          val = LLVMBuildLoad(jit->builder, val, "load");
+       LLVMBuildStore(jit->builder, val, slot);
+    }
     
-    val = LLVMBuildLoad(jit->builder, tmp, "if_else_tmp");
-      
+    exec_destructors(jit, NULL); /* the arguments */
+    scope_down();
+    outline_close(jit, &o);
+    
+    args[0] = LLVMConstPointerCast(o.fn, i8ptr);
+    args[1] = LLVMBuildPointerCast(jit->builder, envp, i8ptr, "env");
+    val = LLVMBuildCall(jit->builder, LLVMGetNamedFunction(jit->module, "pool_spawn"), args, 2, "future");
+
     return ret(0, val);
 }
 
 /*
-   Jit an if..else statement
+   Jit await f. This waits for the task to finish, then moves the 
+   result out of its environment into a temporary, so a future can 
+   only be awaited once.
 */
-ret_t * exec_if_else_stmt(jit_t * jit, ast_t * ast)
+ret_t * exec_await(jit_t * jit, ast_t * ast, int cleanup)
 {
-    ast_t * exp = ast->child;
-    ast_t * con = exp->next;
-    ast_t * alt = con->next;
-    
-    ret_t * exp_ret, * con_ret, * alt_ret;
+    type_t * t = ast->type;
+    LLVMValueRef task = exec_ast(jit, ast->child)->val;
+    LLVMValueRef env, temp;
+    char * name;
 
-    LLVMBasicBlockRef i = LLVMAppendBasicBlock(jit->function, "if");
-    LLVMBasicBlockRef b1 = LLVMAppendBasicBlock(jit->function, "ifbody");
-    LLVMBasicBlockRef b2 = LLVMAppendBasicBlock(jit->function, "elsebody");
-    LLVMBasicBlockRef e = LLVMAppendBasicBlock(jit->function, "ifend");
+    env = LLVMBuildCall(jit->builder, LLVMGetNamedFunction(jit->module, "pool_await"), &task, 1, "env");
 
-    LLVMBuildBr(jit->builder, i);
-    LLVMPositionBuilderAtEnd(jit->builder, i);  
-    
-    exp_ret = exec_ast(jit, exp); /* expression */
+    if (t == ctx->t_nil)
+       return ret(0, NULL);
 
-    LLVMBuildCondBr(jit->builder, exp_ret->val, b1, b2);
-    LLVMPositionBuilderAtEnd(jit->builder, b1); 
-   
-    con_ret = exec_ast(jit, con); /* stmt1 */
-    
-    if (!con_ret->closed)
-       LLVMBuildBr(jit->builder, e);
+    env = LLVMBuildPointerCast(jit->builder, env, LLVMPointerType(type_to_llvm(jit, t), 0), "res");
 
-    LLVMPositionBuilderAtEnd(jit->builder, b2);  
+    if (!is_structured(t))
+       return ret(0, LLVMBuildLoad(jit->builder, env, "res"));
 
-    alt_ret = exec_ast(jit, alt); /* stmt2 */
+    name = serialise("__cs_data");
     
-    if (!alt_ret->closed)
-       LLVMBuildBr(jit->builder, e);
+    /* cleanup up (using destructors) or not */
+    if (cleanup)
+       temp = create_var(jit, sym_lookup(name), name, t);
+    else
+       temp = AddLocal(jit, type_to_llvm(jit, t), name);
 
-    if (con_ret->closed && alt_ret->closed)
-    {
-       LLVMDeleteBasicBlock(e);
-       return ret(1, NULL);
-    } else
-    {
-       LLVMPositionBuilderAtEnd(jit->builder, e); 
-       return ret(0, NULL);
-    }
+    LLVMBuildStore(jit->builder, LLVMBuildLoad(jit->builder, env, "load"), temp);
+
+    return ret(0, temp);
 }
 
 /*
-   Jit an if statement
+   Jit chan[T](n), which creates a channel with room for n values
 */
-ret_t * exec_if_stmt(jit_t * jit, ast_t * ast)
+ret_t * exec_chan_constructor(jit_t * jit, ast_t * ast)
 {
-    ast_t * exp = ast->child;
-    ast_t * con = exp->next;
+    LLVMValueRef args[2];
     
-    ret_t * exp_ret, * con_ret;
+    args[0] = LLVMSizeOf(type_to_llvm(jit, ast->type->params[0]));
+    args[1] = exec_ast(jit, ast->child->next)->val;
 
-    LLVMBasicBlockRef i = LLVMAppendBasicBlock(jit->function, "if");
-    LLVMBasicBlockRef b = LLVMAppendBasicBlock(jit->function, "ifbody");
-    LLVMBasicBlockRef e = LLVMAppendBasicBlock(jit->function, "ifend");
+    return ret(0, LLVMBuildCall(jit->builder, LLVMGetNamedFunction(jit->module, "chan_new"), args, 2, "chan"));
+}
 
-    LLVMBuildBr(jit->builder, i);
-    LLVMPositionBuilderAtEnd(jit->builder, i);  
-    
-    exp_ret = exec_ast(jit, exp); /* expression */
+/*
+   Jit send(c, v). A copy of v is made, as for a call by value, and 
+   moved into the channel. Temporaries are moved in directly.
+*/
+ret_t * exec_send(jit_t * jit, ast_t * ast)
+{
+    ast_t * c = ast->child->next;
+    ast_t * v = c->next;
+    type_t * t = v->type;
+    LLVMValueRef args[2], val, buf;
 
-    LLVMBuildCondBr(jit->builder, exp_ret->val, b, e);
-    LLVMPositionBuilderAtEnd(jit->builder, b); 
-   
-    con_ret = exec_ast(jit, con); /* stmt1 */
-    
-    if (!con_ret->closed)
-       LLVMBuildBr(jit->builder, e);
+    args[0] = exec_ast(jit, c)->val;
+
+    if (v->tag == AST_APPL && is_structured(t))
+       buf = exec_appl(jit, v, 0)->val; /* don't clean up temp */
+    else
+    {
+       val = exec_ast(jit, v)->val;
+       buf = AddLocal(jit, type_to_llvm(jit, t), serialise("__cs_send"));
+       
+       if (is_structured(t))
+          copy_construct(jit, buf, val, t);
+       else
+          LLVMBuildStore(jit->builder, val, buf);
+    }
+
+    args[1] = LLVMBuildPointerCast(jit->builder, buf, LLVMPointerType(LLVMInt8TypeInContext(jit->context), 0), "val");
+    LLVMBuildCall(jit->builder, LLVMGetNamedFunction(jit->module, "chan_send"), args, 2, "");
 
-    LLVMPositionBuilderAtEnd(jit->builder, e); 
-      
     return ret(0, NULL);
 }
 
 /*
-   Jit a while statement
+   Jit recv(c, x). If there is a value, the old value of x is destroyed
+   and the value is moved into x.
 */
-ret_t * exec_while_stmt(jit_t * jit, ast_t * ast)
+ret_t * exec_recv(jit_t * jit, ast_t * ast)
 {
-    ast_t * exp = ast->child;
-    ast_t * con = exp->next;
+    ast_t * c = ast->child->next;
+    ast_t * x = c->next;
+    type_t * t = x->type;
+    bind_t * bind = find_symbol(x->sym);
+    LLVMBasicBlockRef got, end;
+    LLVMValueRef args[2], buf, var, ok;
+
+    args[0] = exec_ast(jit, c)->val;
     
-    ret_t * exp_ret, * con_ret;
+    buf = AddLocal(jit, type_to_llvm(jit, t), serialise("__cs_recv"));
+    args[1] = LLVMBuildPointerCast(jit->builder, buf, LLVMPointerType(LLVMInt8TypeInContext(jit->context), 0), "val");
+    
+    ok = LLVMBuildCall(jit->builder, LLVMGetNamedFunction(jit->module, "chan_recv"), args, 2, "recv");
+    ok = LLVMBuildICmp(jit->builder, LLVMIntNE, ok, LLVMConstInt(LLVMInt32TypeInContext(jit->context), 0, 0), "ok");
 
-    LLVMBasicBlockRef breaksave = jit->breakto;
+    if (scope_is_global(bind))
+       var = global_lookup(jit, bind);
+    else
+       var = loc_lookup(bind->llvm);
 
-    LLVMBasicBlockRef w = LLVMAppendBasicBlock(jit->function, "while");
-    LLVMBasicBlockRef b = LLVMAppendBasicBlock(jit->function, "whilebody");
-    LLVMBasicBlockRef e = LLVMAppendBasicBlock(jit->function, "whileend");
+    if (bind->type->tag == REF) /* if it is a reference type, deref */
+       var = LLVMBuildLoad(jit->builder, var, "deref");
 
-    LLVMBuildBr(jit->builder, w);
-    LLVMPositionBuilderAtEnd(jit->builder, w);  
-    
-    exp_ret = exec_ast(jit, exp); /* expression */
-    
-    LLVMBuildCondBr(jit->builder, exp_ret->val, b, e);
-    LLVMPositionBuilderAtEnd(jit->builder, b); 
-   
-    jit->breakto = e;
+    got = LLVMAppendBasicBlockInContext(jit->context, jit->function, "recv");
+    end = LLVMAppendBasicBlockInContext(jit->context, jit->function, "recvend");
 
-    con_ret = exec_ast(jit, con); /* stmt1 */
+    LLVMBuildCondBr(jit->builder, ok, got, end);
+    LLVMPositionBuilderAtEnd(jit->builder, got);
+
+    if (is_structured(t))
+       call_destructors(jit, var, t, NULL);
+    LLVMBuildStore(jit->builder, LLVMBuildLoad(jit->builder, buf, "load"), var);
     
-    jit->breakto = breaksave;
+    LLVMBuildBr(jit->builder, end);
+    LLVMPositionBuilderAtEnd(jit->builder, end);
 
-    if (!con_ret->closed)
-        LLVMBuildBr(jit->builder, w);
- 
-    LLVMPositionBuilderAtEnd(jit->builder, e); 
-      
-    return ret(0, NULL);
+    return ret(0, ok);
 }
 
 /*
-   Jit a break statement
+   Jit close(c)
 */
-ret_t * exec_break(jit_t * jit, ast_t * ast)
+ret_t * exec_close(jit_t * jit, ast_t * ast)
 {
-    if (jit->breakto == NULL)
-        jit_exception(jit, "Attempt to break outside loop");
+    LLVMValueRef chan = exec_ast(jit, ast->child->next)->val;
+    
+    LLVMBuildCall(jit->builder, LLVMGetNamedFunction(jit->module, "chan_close"), &chan, 1, "");
 
-    LLVMBuildBr(jit->builder, jit->breakto);
-         
-    return ret(1, NULL);
+    return ret(0, NULL);
 }
 
 ret_t * exec_decl(jit_t * jit, ast_t * ast)
@@ -1022,7 +2970,7 @@ ret_t * exec_tuple_assign(jit_t * jit, ast_t * id, ast_t * expr)
           } else
           {
              if (scope_is_global(bind))
-                var = LLVMGetNamedGlobal(jit->module, bind->llvm);
+                var = global_lookup(jit, bind);
              else
                 var = loc_lookup(bind->llvm);
           }
@@ -1059,7 +3007,7 @@ ret_t * exec_tuple_unpack_val(jit_t * jit, ast_t * ast1, LLVMValueRef val, type_
 
     for (i = 0; i < type->arity; i++)
     {
-       LLVMValueRef index[2] = { LLVMConstInt(LLVMInt32Type(), 0, 0), LLVMConstInt(LLVMInt32Type(), i, 0) };
+       LLVMValueRef index[2] = { LLVMConstInt(LLVMInt32TypeInContext(jit->context), 0, 0), LLVMConstInt(LLVMInt32TypeInContext(jit->context), i, 0) };
        LLVMValueRef p = LLVMBuildInBoundsGEP(jit->builder, val, index, 2, "tuple");
        LLVMValueRef val = LLVMBuildLoad(jit->builder, p, "entry");
           
@@ -1080,7 +3028,7 @@ ret_t * exec_tuple_unpack_val(jit_t * jit, ast_t * ast1, LLVMValueRef val, type_
           } else
           {
              if (scope_is_global(bind))
-                var = LLVMGetNamedGlobal(jit->module, bind->llvm);
+                var = global_lookup(jit, bind);
              else
                 var = loc_lookup(bind->llvm);
           }
@@ -1169,7 +3117,7 @@ void call_destructors(jit_t * jit, LLVMValueRef var, type_t * t, LLVMValueRef re
  
                if (requires_destructor(arg))
                {
-                  LLVMValueRef index[2] = { LLVMConstInt(LLVMInt32Type(), 0, 0), LLVMConstInt(LLVMInt32Type(), i, 0) };
+                  LLVMValueRef index[2] = { LLVMConstInt(LLVMInt32TypeInContext(jit->context), 0, 0), LLVMConstInt(LLVMInt32TypeInContext(jit->context), i, 0) };
                   LLVMValueRef slot = LLVMBuildInBoundsGEP(jit->builder, var, index, 2, "datatype");
 
                   call_destructors(jit, slot, arg, NULL);
@@ -1180,11 +3128,11 @@ void call_destructors(jit_t * jit, LLVMValueRef var, type_t * t, LLVMValueRef re
       {
          type_t * type = t->params[0];
          
-         LLVMValueRef indices[2] = { LLVMConstInt(LLVMInt32Type(), 0, 0), LLVMConstInt(LLVMInt32Type(), 0, 0) };
+         LLVMValueRef indices[2] = { LLVMConstInt(LLVMInt32TypeInContext(jit->context), 0, 0), LLVMConstInt(LLVMInt32TypeInContext(jit->context), 0, 0) };
          LLVMValueRef arr = LLVMBuildInBoundsGEP(jit->builder, var, indices, 2, "arr");
          arr = LLVMBuildLoad(jit->builder, arr, "array");
 
-         LLVMValueRef indices2[2] = { LLVMConstInt(LLVMInt32Type(), 0, 0), LLVMConstInt(LLVMInt32Type(), 1, 0) };
+         LLVMValueRef indices2[2] = { LLVMConstInt(LLVMInt32TypeInContext(jit->context), 0, 0), LLVMConstInt(LLVMInt32TypeInContext(jit->context), 1, 0) };
          LLVMValueRef len = LLVMBuildInBoundsGEP(jit->builder, var, indices2, 2, "length");
          len = LLVMBuildLoad(jit->builder, len, "length");
 
@@ -1197,9 +3145,9 @@ void call_destructors(jit_t * jit, LLVMValueRef var, type_t * t, LLVMValueRef re
             LLVMBuildStore(jit->builder, LLVMConstInt(LLVMWordType(), 0, 0), iloc); /* i = 0 */
 
             /* while */
-            LLVMBasicBlockRef w = LLVMAppendBasicBlock(jit->function, "while");
-            LLVMBasicBlockRef b = LLVMAppendBasicBlock(jit->function, "whilebody");
-            LLVMBasicBlockRef e = LLVMAppendBasicBlock(jit->function, "whileend");
+            LLVMBasicBlockRef w = LLVMAppendBasicBlockInContext(jit->context, jit->function, "while");
+            LLVMBasicBlockRef b = LLVMAppendBasicBlockInContext(jit->context, jit->function, "whilebody");
+            LLVMBasicBlockRef e = LLVMAppendBasicBlockInContext(jit->context, jit->function, "whileend");
 
             LLVMBuildBr(jit->builder, w);
             LLVMPositionBuilderAtEnd(jit->builder, w);  
@@ -1236,7 +3184,7 @@ void call_destructors(jit_t * jit, LLVMValueRef var, type_t * t, LLVMValueRef re
  
             if (requires_destructor(arg))
             {
-               LLVMValueRef index[2] = { LLVMConstInt(LLVMInt32Type(), 0, 0), LLVMConstInt(LLVMInt32Type(), i, 0) };
+               LLVMValueRef index[2] = { LLVMConstInt(LLVMInt32TypeInContext(jit->context), 0, 0), LLVMConstInt(LLVMInt32TypeInContext(jit->context), i, 0) };
                LLVMValueRef slot = LLVMBuildInBoundsGEP(jit->builder, var, index, 2, "datatype");
 
                call_destructors(jit, slot, arg, NULL);
@@ -1251,7 +3199,7 @@ void call_destructors(jit_t * jit, LLVMValueRef var, type_t * t, LLVMValueRef re
 */
 ret_t * exec_destructors(jit_t * jit, LLVMValueRef retval)
 {
-    bind_t * bind = current_scope->scope;
+    bind_t * bind = ctx->current_scope->scope;
     LLVMValueRef var;
 
     while (bind != NULL)
@@ -1263,7 +3211,7 @@ ret_t * exec_destructors(jit_t * jit, LLVMValueRef retval)
           if (bind->llvm != NULL) /* make sure it has actually been initialised */
           {
              if (scope_is_global(bind))
-                var = LLVMGetNamedGlobal(jit->module, bind->llvm);
+                var = global_lookup(jit, bind);
              else
                 var = loc_lookup(bind->llvm);
   
@@ -1331,7 +3279,7 @@ void call_assign(jit_t * jit, LLVMValueRef var, LLVMValueRef val, type_t * type)
          {
             type_t * arg = type->args[i];
  
-            LLVMValueRef index[2] = { LLVMConstInt(LLVMInt32Type(), 0, 0), LLVMConstInt(LLVMInt32Type(), i, 0) };
+            LLVMValueRef index[2] = { LLVMConstInt(LLVMInt32TypeInContext(jit->context), 0, 0), LLVMConstInt(LLVMInt32TypeInContext(jit->context), i, 0) };
             LLVMValueRef lslot = LLVMBuildInBoundsGEP(jit->builder, var, index, 2, "datatype");
             LLVMValueRef rslot = LLVMBuildInBoundsGEP(jit->builder, val, index, 2, "datatype");
 
@@ -1343,11 +3291,11 @@ void call_assign(jit_t * jit, LLVMValueRef var, LLVMValueRef val, type_t * type)
 
          type = type->params[0];
    
-         LLVMValueRef indices[2] = { LLVMConstInt(LLVMInt32Type(), 0, 0), LLVMConstInt(LLVMInt32Type(), 1, 0) };
+         LLVMValueRef indices[2] = { LLVMConstInt(LLVMInt32TypeInContext(jit->context), 0, 0), LLVMConstInt(LLVMInt32TypeInContext(jit->context), 1, 0) };
          LLVMValueRef rlen = LLVMBuildInBoundsGEP(jit->builder, val, indices, 2, "length");
          rlen = LLVMBuildLoad(jit->builder, rlen, "rlength");
       
-         LLVMValueRef indices2[2] = { LLVMConstInt(LLVMInt32Type(), 0, 0), LLVMConstInt(LLVMInt32Type(), 0, 0) };
+         LLVMValueRef indices2[2] = { LLVMConstInt(LLVMInt32TypeInContext(jit->context), 0, 0), LLVMConstInt(LLVMInt32TypeInContext(jit->context), 0, 0) };
          LLVMValueRef rarrloc = LLVMBuildInBoundsGEP(jit->builder, val, indices2, 2, "arr");
          LLVMValueRef rarr = LLVMBuildLoad(jit->builder, rarrloc, "rarr");
       
@@ -1359,9 +3307,9 @@ void call_assign(jit_t * jit, LLVMValueRef var, LLVMValueRef val, type_t * type)
       
          /* if rlength > llength realloc larr */
 
-         LLVMBasicBlockRef i1 = LLVMAppendBasicBlock(jit->function, "if");
-         LLVMBasicBlockRef b1 = LLVMAppendBasicBlock(jit->function, "ifbody");
-         LLVMBasicBlockRef e1 = LLVMAppendBasicBlock(jit->function, "ifend");
+         LLVMBasicBlockRef i1 = LLVMAppendBasicBlockInContext(jit->context, jit->function, "if");
+         LLVMBasicBlockRef b1 = LLVMAppendBasicBlockInContext(jit->context, jit->function, "ifbody");
+         LLVMBasicBlockRef e1 = LLVMAppendBasicBlockInContext(jit->context, jit->function, "ifend");
 
          LLVMBuildBr(jit->builder, i1);
          LLVMPositionBuilderAtEnd(jit->builder, i1);  
@@ -1371,7 +3319,7 @@ void call_assign(jit_t * jit, LLVMValueRef var, LLVMValueRef val, type_t * type)
          LLVMBuildCondBr(jit->builder, cmp, b1, e1);
          LLVMPositionBuilderAtEnd(jit->builder, b1); 
    
-         LLVMValueRef larr2 = LLVMBuildGCArrayRealloc(jit, type, larr, rlen, "realloc");
+         LLVMValueRef larr2 = LLVMBuildGCArrayRealloc(jit, type, larr, llen, rlen, "realloc");
          LLVMBuildStore(jit->builder, larr2, larrloc);
 
          LLVMBuildStore(jit->builder, rlen, llenloc);
@@ -1386,9 +3334,9 @@ void call_assign(jit_t * jit, LLVMValueRef var, LLVMValueRef val, type_t * type)
          LLVMBuildStore(jit->builder, LLVMConstInt(LLVMWordType(), 0, 0), iloc); /* i = 0 */
 
          /* while */
-         LLVMBasicBlockRef w = LLVMAppendBasicBlock(jit->function, "while");
-         LLVMBasicBlockRef b = LLVMAppendBasicBlock(jit->function, "whilebody");
-         LLVMBasicBlockRef e = LLVMAppendBasicBlock(jit->function, "whileend");
+         LLVMBasicBlockRef w = LLVMAppendBasicBlockInContext(jit->context, jit->function, "while");
+         LLVMBasicBlockRef b = LLVMAppendBasicBlockInContext(jit->context, jit->function, "whilebody");
+         LLVMBasicBlockRef e = LLVMAppendBasicBlockInContext(jit->context, jit->function, "whileend");
 
          LLVMBuildBr(jit->builder, w);
          LLVMPositionBuilderAtEnd(jit->builder, w);  
@@ -1435,6 +3383,8 @@ ret_t * exec_initialise_assign(jit_t * jit, ast_t * id, ast_t * expr)
       val = exec_appl(jit, expr, 0)->val; /* don't clean up temp */
    else if (expr->tag == AST_BINOP)
       val = exec_binop(jit, expr, 0)->val; /* don't clean up temp */
+   else if (expr->tag == AST_AWAIT)
+      val = exec_await(jit, expr, 0)->val; /* don't clean up temp */
    else
       val = exec_ast(jit, expr)->val;
 
@@ -1459,7 +3409,9 @@ ret_t * exec_initialise_assign(jit_t * jit, ast_t * id, ast_t * expr)
 
    if (expr->type->tag == DATA || expr->type->tag == ARRAY || expr->type->tag == TUPLE)
    {
-      if (expr->tag == AST_ARRAY_CONSTRUCTOR || expr->tag == AST_APPL)
+      if (expr->tag == AST_ARRAY_CONSTRUCTOR || expr->tag == AST_LOCAL_ARRAY_CONSTRUCTOR 
+         || expr->tag == AST_APPL || expr->tag == AST_MAP || expr->tag == AST_FILTER
+         || expr->tag == AST_AWAIT)
       {
          if (TRACE2) printf("assign array constructor or appl\n");
         
@@ -1473,12 +3425,12 @@ ret_t * exec_initialise_assign(jit_t * jit, ast_t * id, ast_t * expr)
             
             type_t * ptype = expr->type->params[0];
             
-            LLVMValueRef indices[2] = { LLVMConstInt(LLVMInt32Type(), 0, 0), LLVMConstInt(LLVMInt32Type(), 1, 0) };
+            LLVMValueRef indices[2] = { LLVMConstInt(LLVMInt32TypeInContext(jit->context), 0, 0), LLVMConstInt(LLVMInt32TypeInContext(jit->context), 1, 0) };
             LLVMValueRef len = LLVMBuildInBoundsGEP(jit->builder, var, indices, 2, "length");
             
             LLVMBuildStore(jit->builder, LLVMConstInt(LLVMWordType(), 0, 0), len);
 
-            LLVMValueRef indices2[2] = { LLVMConstInt(LLVMInt32Type(), 0, 0), LLVMConstInt(LLVMInt32Type(), 0, 0) };
+            LLVMValueRef indices2[2] = { LLVMConstInt(LLVMInt32TypeInContext(jit->context), 0, 0), LLVMConstInt(LLVMInt32TypeInContext(jit->context), 0, 0) };
             LLVMValueRef arr = LLVMBuildInBoundsGEP(jit->builder, var, indices2, 2, "arr");
             
             LLVMBuildStore(jit->builder, LLVMConstNull(type_to_llvm(jit, pointer_type(ptype))), arr);
@@ -1520,7 +3472,7 @@ ret_t * exec_assignment(jit_t * jit, ast_t * id, ast_t * expr)
        else
        {
           if (scope_is_global(bind))
-             var = LLVMGetNamedGlobal(jit->module, bind->llvm);
+             var = global_lookup(jit, bind);
           else
              var = loc_lookup(bind->llvm);
 
@@ -1539,6 +3491,63 @@ ret_t * exec_assignment(jit_t * jit, ast_t * id, ast_t * expr)
     return ret(0, NULL);
 }
 
+/*
+   Jit a const or let binding. This is an ordinary initialisation,
+   the value is picked up by exec_ident once it has been computed.
+*/
+ret_t * exec_const(jit_t * jit, ast_t * ast)
+{
+    return exec_initialise_assign(jit, ast->child, ast->child->next);
+}
+
+/*
+   Return an LLVM constant for the value of a global constant, which
+   must already have been computed, or NULL if it can't be embedded in
+   the code. A small ZZ is given a constant global, which uses must 
+   copy rather than pass on.
+*/
+LLVMValueRef const_value(jit_t * jit, bind_t * bind, LLVMValueRef var)
+{
+    void * ptr;
+    type_t * t = bind->type;
+
+    if (t != ctx->t_int && t != ctx->t_uint && t != ctx->t_double 
+     && t != ctx->t_char && t != ctx->t_bool && t != ctx->t_ZZ)
+       return NULL;
+
+    /* 
+       the statement computing the value may still be waiting to run, 
+       in which case it is loaded instead, as the jit can't be given up
+       in the middle of a compile
+    */
+    if (ctx->pipe != NULL && (eager_inside || !pipe_idle(ctx->pipe)))
+       return NULL;
+
+    ptr = LLVMGetPointerToGlobal(jit->engine, var);
+
+    if (t == ctx->t_int || t == ctx->t_uint)
+       return LLVMConstInt(LLVMWordType(), *(unsigned long *) ptr, t == ctx->t_int);
+    else if (t == ctx->t_double)
+       return LLVMConstReal(LLVMDoubleTypeInContext(jit->context), *(double *) ptr);
+    else if (t == ctx->t_char)
+       return LLVMConstInt(LLVMInt8TypeInContext(jit->context), *(char *) ptr, 0);
+    else if (t == ctx->t_bool)
+       return LLVMConstInt(LLVMInt1TypeInContext(jit->context), *(char *) ptr & 1, 0);
+    else if (t == ctx->t_ZZ && !COEFF_IS_MPZ(*(fmpz *) ptr))
+    {
+       /* a small ZZ is just a word, give it a constant global */
+       LLVMValueRef field[1] = { LLVMConstInt(LLVMWordType(), *(fmpz *) ptr, 1) };
+       LLVMValueRef val = LLVMConstNamedStruct(type_to_llvm(jit, ctx->t_ZZ), field, 1);
+       LLVMValueRef loc = LLVMAddGlobal(jit->module, type_to_llvm(jit, ctx->t_ZZ), "__cs_ZZ");
+       LLVMSetInitializer(loc, val);
+       LLVMSetGlobalConstant(loc, 1);
+       
+       return loc;
+    }
+    
+    return NULL;
+}
+
 /*
    Jit access to an identifier
 */
@@ -1548,7 +3557,7 @@ ret_t * exec_place(jit_t * jit, ast_t * ast)
     LLVMValueRef var;
 
     if (scope_is_global(bind))
-       var = LLVMGetNamedGlobal(jit->module, bind->llvm);
+       var = global_lookup(jit, bind);
     else
        var = loc_lookup(bind->llvm);
     
@@ -1564,8 +3573,27 @@ ret_t * exec_ident(jit_t * jit, ast_t * ast)
     LLVMValueRef var;
 
     if (scope_is_global(bind))
-       var = LLVMGetNamedGlobal(jit->module, bind->llvm);
-    else
+    {
+       var = global_lookup(jit, bind);
+
+       if (bind->immutable) /* a global constant's value is known by now */
+       {
+          if (bind->llvm_val == NULL)
+             bind->llvm_val = const_value(jit, bind, var);
+          if (bind->llvm_val != NULL && bind->type == ctx->t_ZZ) 
+          {
+             /* each use gets its own copy, which may be changed in place */
+             LLVMValueRef args[2];
+
+             args[0] = AddLocal(jit, type_to_llvm(jit, ctx->t_ZZ), serialise("__cs_ZZ"));
+             args[1] = bind->llvm_val;
+             LLVMBuildCall(jit->builder, LLVMGetNamedFunction(jit->module, "__ZZ_init_set"), args, 2, "");
+
+             return ret(0, args[0]);
+          } else if (bind->llvm_val != NULL)
+             return ret(0, bind->llvm_val);
+       }
+    } else
        var = loc_lookup(bind->llvm);
     
     if ((ast->type->tag == DATA || ast->type->tag == TUPLE || ast->type->tag == ARRAY) 
@@ -1599,7 +3627,7 @@ ret_t * exec_tuple(jit_t * jit, ast_t * ast)
            p_ret->val = LLVMBuildLoad(jit->builder, p_ret->val, "load");
         
          /* insert value into tuple */
-        LLVMValueRef indices[2] = { LLVMConstInt(LLVMInt32Type(), 0, 0), LLVMConstInt(LLVMInt32Type(), i, 0) };
+        LLVMValueRef indices[2] = { LLVMConstInt(LLVMInt32TypeInContext(jit->context), 0, 0), LLVMConstInt(LLVMInt32TypeInContext(jit->context), i, 0) };
         LLVMValueRef entry = LLVMBuildInBoundsGEP(jit->builder, val, indices, 2, "tuple");
         LLVMBuildStore(jit->builder, p_ret->val, entry);
         
@@ -1619,7 +3647,7 @@ ret_t * exec_data_stmt(jit_t * jit, ast_t * ast)
    bind_t * bind;
    char * llvm = serialise(sym->name);
    
-   LLVMStructCreateNamed(LLVMGetGlobalContext(), llvm);
+   LLVMStructCreateNamed(jit->context, llvm);
 
    bind = find_symbol(sym);
    bind->type->ret->llvm = llvm;
@@ -1658,7 +3686,9 @@ ret_t * exec_fnparams(jit_t * jit, ast_t * ast)
 }
 
 /*
-   Jit a function definition, given its type.
+   Jit a function definition, given its type. While a background 
+   statement is jit'd, this makes a copy of the function for it, which 
+   uses its copies of the globals, and leaves the type alone.
 */
 ret_t * exec_fndef(jit_t * jit, ast_t * ast, type_t * type)
 {
@@ -1670,6 +3700,7 @@ ret_t * exec_fndef(jit_t * jit, ast_t * ast, type_t * type)
    LLVMTypeRef * args = (LLVMTypeRef *) GC_MALLOC(params*sizeof(LLVMTypeRef));
    LLVMTypeRef llvm_ret, fn_type;
    LLVMValueRef fn_save;
+   fn_list_t * def;
 
    sym_t * sym = ast->child->sym;
    char * llvm;
@@ -1677,6 +3708,7 @@ ret_t * exec_fndef(jit_t * jit, ast_t * ast, type_t * type)
    env_t * scope_save;
    LLVMBuilderRef build_save;
    LLVMBasicBlockRef entry;
+   int snap = jit->snapping;
 
    /* get llvm parameter types */
    for (i = 0; i < params; i++)
@@ -1694,7 +3726,21 @@ ret_t * exec_fndef(jit_t * jit, ast_t * ast, type_t * type)
    /* make llvm function object */
    fn_save = jit->function;
    jit->function = LLVMAddFunction(jit->module, llvm, fn_type);
-   type->llvm = llvm; /* store serialised name in type */
+   
+   def = (fn_list_t *) GC_MALLOC(sizeof(fn_list_t));
+   def->fn = jit->function;
+   def->type = type;
+   
+   if (snap) /* a copy for a background statement, see snap_fndef */
+   {
+      def->next = jit->snap_fns;
+      jit->snap_fns = def;
+   } else /* remember it, in case it has to be abandoned */
+   {
+      type->llvm = llvm; /* store serialised name in type */
+      def->next = jit->defs;
+      jit->defs = def;
+   }
    
    /* set nocapture on all structured params */
    for (i = 0; i < params; i++)
@@ -1709,15 +3755,15 @@ ret_t * exec_fndef(jit_t * jit, ast_t * ast, type_t * type)
       LLVMAddFunctionAttr(jit->function, LLVMNoAliasAttribute);
    
    /* enter function scope */
-   scope_save = current_scope;
-   current_scope = ast->env;
+   scope_save = ctx->current_scope;
+   ctx->current_scope = ast->env;
 
    /* setup jit builder */
    build_save = jit->builder;
-   jit->builder = LLVMCreateBuilder();
+   jit->builder = LLVMCreateBuilderInContext(jit->context);
 
    /* first basic block */
-   entry = LLVMAppendBasicBlock(jit->function, "entry");
+   entry = LLVMAppendBasicBlockInContext(jit->context, jit->function, "entry");
    LLVMPositionBuilderAtEnd(jit->builder, entry);
     
    /* make allocas for the function parameters */
@@ -1728,24 +3774,58 @@ ret_t * exec_fndef(jit_t * jit, ast_t * ast, type_t * type)
    
    if (!r->closed) /* no return */
    {
-      if (type->ret == t_nil)
+      if (type->ret == ctx->t_nil)
          LLVMBuildRetVoid(jit->builder);
       else
          jit_exception(jit, "Function does not return value at end of block");
    }
 
-   /* run the pass manager on the jit'd function */
-   LLVMRunFunctionPassManager(jit->pass, jit->function); 
+   /* run the pass manager on the jit'd function, once it is safe to */
+   jit_optimise(jit, jit->function); 
     
    /* clean up */
    LLVMDisposeBuilder(jit->builder);  
    jit->builder = build_save;
    jit->function = fn_save;    
-   current_scope = scope_save;
+   ctx->current_scope = scope_save;
    
    return ret(0, NULL);
 }
 
+/*
+   Return the copy of a function made for the background statement 
+   being jit'd, making it if necessary. The function itself must have
+   been jit'd already.
+*/
+LLVMValueRef snap_fndef(jit_t * jit, type_t * fn)
+{
+   fn_list_t * f, * last = jit->snap_fns;
+
+   for (f = jit->snap_fns; f != NULL; f = f->next)
+      if (f->type == fn)
+         return f->fn;
+      
+   exec_fndef(jit, fn->ast, fn);
+
+   /* its copy was added first, before those of the functions it calls */
+   for (f = jit->snap_fns; f->next != last; f = f->next) ;
+
+   return f->fn;
+}
+
+/*
+   Return the jit'd function for a user function or constructor. A 
+   background statement calls copies, so that the globals they use are
+   its own copies too.
+*/
+LLVMValueRef fn_function(jit_t * jit, type_t * fn)
+{
+   if (jit->snapping && fn->ast != NULL)
+      return snap_fndef(jit, fn);
+
+   return LLVMGetNamedFunction(jit->module, fn->llvm);
+}
+
 int requires_constructor(type_t * t)
 {
    if (t->tag == DATA)
@@ -1804,7 +3884,7 @@ void call_constructors(jit_t * jit, LLVMValueRef locn, type_t * type)
  
             if (requires_constructor(arg))
             {
-               LLVMValueRef index[2] = { LLVMConstInt(LLVMInt32Type(), 0, 0), LLVMConstInt(LLVMInt32Type(), i, 0) };
+               LLVMValueRef index[2] = { LLVMConstInt(LLVMInt32TypeInContext(jit->context), 0, 0), LLVMConstInt(LLVMInt32TypeInContext(jit->context), i, 0) };
                LLVMValueRef slot = LLVMBuildInBoundsGEP(jit->builder, locn, index, 2, "datatype");
 
                call_constructors(jit, slot, arg);
@@ -1823,7 +3903,7 @@ void call_constructors(jit_t * jit, LLVMValueRef locn, type_t * type)
  
          if (requires_constructor(arg))
          {
-            LLVMValueRef index[2] = { LLVMConstInt(LLVMInt32Type(), 0, 0), LLVMConstInt(LLVMInt32Type(), i, 0) };
+            LLVMValueRef index[2] = { LLVMConstInt(LLVMInt32TypeInContext(jit->context), 0, 0), LLVMConstInt(LLVMInt32TypeInContext(jit->context), i, 0) };
             LLVMValueRef slot = LLVMBuildInBoundsGEP(jit->builder, locn, index, 2, "datatype");
 
             call_constructors(jit, slot, arg);
@@ -1833,11 +3913,11 @@ void call_constructors(jit_t * jit, LLVMValueRef locn, type_t * type)
    {
       type = type->params[0];
    
-      LLVMValueRef indices[2] = { LLVMConstInt(LLVMInt32Type(), 0, 0), LLVMConstInt(LLVMInt32Type(), 1, 0) };
+      LLVMValueRef indices[2] = { LLVMConstInt(LLVMInt32TypeInContext(jit->context), 0, 0), LLVMConstInt(LLVMInt32TypeInContext(jit->context), 1, 0) };
       LLVMValueRef len = LLVMBuildInBoundsGEP(jit->builder, locn, indices, 2, "length");
       len = LLVMBuildLoad(jit->builder, len, "length");
       
-      LLVMValueRef indices2[2] = { LLVMConstInt(LLVMInt32Type(), 0, 0), LLVMConstInt(LLVMInt32Type(), 0, 0) };
+      LLVMValueRef indices2[2] = { LLVMConstInt(LLVMInt32TypeInContext(jit->context), 0, 0), LLVMConstInt(LLVMInt32TypeInContext(jit->context), 0, 0) };
       LLVMValueRef arr = LLVMBuildInBoundsGEP(jit->builder, locn, indices2, 2, "arr");
       arr = LLVMBuildLoad(jit->builder, arr, "arr");
       
@@ -1850,9 +3930,9 @@ void call_constructors(jit_t * jit, LLVMValueRef locn, type_t * type)
          LLVMBuildStore(jit->builder, LLVMConstInt(LLVMWordType(), 0, 0), iloc); /* i = 0 */
 
          /* while */
-         LLVMBasicBlockRef w = LLVMAppendBasicBlock(jit->function, "while");
-         LLVMBasicBlockRef b = LLVMAppendBasicBlock(jit->function, "whilebody");
-         LLVMBasicBlockRef e = LLVMAppendBasicBlock(jit->function, "whileend");
+         LLVMBasicBlockRef w = LLVMAppendBasicBlockInContext(jit->context, jit->function, "while");
+         LLVMBasicBlockRef b = LLVMAppendBasicBlockInContext(jit->context, jit->function, "whilebody");
+         LLVMBasicBlockRef e = LLVMAppendBasicBlockInContext(jit->context, jit->function, "whileend");
 
          LLVMBuildBr(jit->builder, w);
          LLVMPositionBuilderAtEnd(jit->builder, w);  
@@ -1894,15 +3974,30 @@ ret_t * exec_array_constructor(jit_t * jit, ast_t * ast)
    LLVMValueRef val = AddLocal(jit, struct_ty, "array_s");
 
    /* insert length into array struct */
-   LLVMValueRef indices[2] = { LLVMConstInt(LLVMInt32Type(), 0, 0), LLVMConstInt(LLVMInt32Type(), 1, 0) };
+   LLVMValueRef indices[2] = { LLVMConstInt(LLVMInt32TypeInContext(jit->context), 0, 0), LLVMConstInt(LLVMInt32TypeInContext(jit->context), 1, 0) };
    LLVMValueRef entry = LLVMBuildInBoundsGEP(jit->builder, val, indices, 2, "length");
    LLVMBuildStore(jit->builder, r->val, entry);
     
    /* create array */
-   int atomic = is_atomic(ast->type->params[0]);
-   LLVMValueRef arr = LLVMBuildGCArrayMalloc(jit, ast->type->params[0], r->val, "arr", atomic);
+   LLVMValueRef arr;
+   long n = esc_length(expr);
+   
+   if (ast->tag == AST_LOCAL_ARRAY_CONSTRUCTOR && n >= 0) /* array doesn't escape, put it on the stack */
+   {
+      LLVMTypeRef buf_ty = LLVMArrayType(type_to_llvm(jit, ast->type->params[0]), n);
+      LLVMValueRef buf = AddLocal(jit, buf_ty, serialise("__cs_arr"));
+      LLVMValueRef indices3[2] = { LLVMConstInt(LLVMInt32TypeInContext(jit->context), 0, 0), LLVMConstInt(LLVMInt32TypeInContext(jit->context), 0, 0) };
+      
+      /* zero the entries, as GC_malloc would, before any constructors run */
+      LLVMBuildStore(jit->builder, LLVMConstNull(buf_ty), buf);
+      
+      arr = LLVMBuildInBoundsGEP(jit->builder, buf, indices3, 2, "arr");
+   } else
+   {
+      arr = LLVMBuildGCArrayMalloc(jit, ast->type->params[0], r->val, "arr");
+   }
 
-   LLVMValueRef indices2[2] = { LLVMConstInt(LLVMInt32Type(), 0, 0), LLVMConstInt(LLVMInt32Type(), 0, 0) };
+   LLVMValueRef indices2[2] = { LLVMConstInt(LLVMInt32TypeInContext(jit->context), 0, 0), LLVMConstInt(LLVMInt32TypeInContext(jit->context), 0, 0) };
    entry = LLVMBuildInBoundsGEP(jit->builder, val, indices2, 2, "array");
    LLVMBuildStore(jit->builder, arr, entry);
    
@@ -1980,7 +4075,7 @@ LLVMValueRef copy_construct(jit_t * jit, LLVMValueRef var, LLVMValueRef val, typ
          {
             type_t * arg = t->args[i];
  
-            LLVMValueRef index[2] = { LLVMConstInt(LLVMInt32Type(), 0, 0), LLVMConstInt(LLVMInt32Type(), i, 0) };
+            LLVMValueRef index[2] = { LLVMConstInt(LLVMInt32TypeInContext(jit->context), 0, 0), LLVMConstInt(LLVMInt32TypeInContext(jit->context), i, 0) };
             LLVMValueRef lslot = LLVMBuildInBoundsGEP(jit->builder, var, index, 2, "datatype");
             LLVMValueRef rslot = LLVMBuildInBoundsGEP(jit->builder, val, index, 2, "datatype");
 
@@ -1992,11 +4087,11 @@ LLVMValueRef copy_construct(jit_t * jit, LLVMValueRef var, LLVMValueRef val, typ
 
          t = t->params[0];
    
-         LLVMValueRef indices[2] = { LLVMConstInt(LLVMInt32Type(), 0, 0), LLVMConstInt(LLVMInt32Type(), 1, 0) };
+         LLVMValueRef indices[2] = { LLVMConstInt(LLVMInt32TypeInContext(jit->context), 0, 0), LLVMConstInt(LLVMInt32TypeInContext(jit->context), 1, 0) };
          LLVMValueRef rlen = LLVMBuildInBoundsGEP(jit->builder, val, indices, 2, "length");
          rlen = LLVMBuildLoad(jit->builder, rlen, "rlength");
       
-         LLVMValueRef indices2[2] = { LLVMConstInt(LLVMInt32Type(), 0, 0), LLVMConstInt(LLVMInt32Type(), 0, 0) };
+         LLVMValueRef indices2[2] = { LLVMConstInt(LLVMInt32TypeInContext(jit->context), 0, 0), LLVMConstInt(LLVMInt32TypeInContext(jit->context), 0, 0) };
          LLVMValueRef rarrloc = LLVMBuildInBoundsGEP(jit->builder, val, indices2, 2, "arr");
          LLVMValueRef rarr = LLVMBuildLoad(jit->builder, rarrloc, "rarr");
       
@@ -2004,8 +4099,7 @@ LLVMValueRef copy_construct(jit_t * jit, LLVMValueRef var, LLVMValueRef val, typ
             
          LLVMValueRef larrloc = LLVMBuildInBoundsGEP(jit->builder, var, indices2, 2, "arr");
             
-         int atomic = is_atomic(t);
-         LLVMValueRef larr = LLVMBuildGCArrayMalloc(jit, t, rlen, "realloc", atomic);
+         LLVMValueRef larr = LLVMBuildGCArrayMalloc(jit, t, rlen, "realloc");
          LLVMBuildStore(jit->builder, larr, larrloc);
 
          LLVMBuildStore(jit->builder, rlen, llenloc);
@@ -2017,9 +4111,9 @@ LLVMValueRef copy_construct(jit_t * jit, LLVMValueRef var, LLVMValueRef val, typ
          LLVMBuildStore(jit->builder, LLVMConstInt(LLVMWordType(), 0, 0), iloc); /* i = 0 */
 
          /* while */
-         LLVMBasicBlockRef w = LLVMAppendBasicBlock(jit->function, "while");
-         LLVMBasicBlockRef b = LLVMAppendBasicBlock(jit->function, "whilebody");
-         LLVMBasicBlockRef e = LLVMAppendBasicBlock(jit->function, "whileend");
+         LLVMBasicBlockRef w = LLVMAppendBasicBlockInContext(jit->context, jit->function, "while");
+         LLVMBasicBlockRef b = LLVMAppendBasicBlockInContext(jit->context, jit->function, "whilebody");
+         LLVMBasicBlockRef e = LLVMAppendBasicBlockInContext(jit->context, jit->function, "whileend");
 
          LLVMBuildBr(jit->builder, w);
          LLVMPositionBuilderAtEnd(jit->builder, w);  
@@ -2081,6 +4175,66 @@ void call_swap(jit_t * jit, ast_t * id, ast_t * exp)
    }
 }
 
+/*
+   Jit a call to an explicit (foreign) constructor. It is passed the 
+   location of the new value followed by the arguments.
+*/
+ret_t * exec_explicit_constructor(jit_t * jit, ast_t * ast, type_t * proto, int cleanup)
+{
+   ast_t * exp = ast->child->next;
+   type_t * type = proto->ret;
+   char * name = serialise("__cs_data");
+   LLVMValueRef * vals = GC_MALLOC(proto->arity*sizeof(LLVMValueRef));
+   int i;
+
+   /* cleanup up (using destructors) or not */
+   if (cleanup)
+      vals[0] = create_var(jit, sym_lookup(name), name, type);
+   else
+      vals[0] = AddLocal(jit, type_to_llvm(jit, type), name);
+
+   for (i = 1; exp != NULL; i++, exp = exp->next)
+      vals[i] = exec_ast(jit, exp)->val; /* data types are passed by reference */
+
+   LLVMValueRef fn = fn_function(jit, proto);
+   LLVMBuildCall(jit->builder, fn, vals, proto->arity, "");
+
+   return ret(0, vals[0]);
+}
+
+/*
+   Jit a call to a foreign function returning a data type, which by
+   the flint convention is written through an extra first argument
+*/
+ret_t * exec_foreign_call(jit_t * jit, LLVMValueRef f, type_t * type, 
+                          LLVMValueRef * vals, int count, int cleanup)
+{
+   LLVMValueRef * args = GC_MALLOC((count + 1)*sizeof(LLVMValueRef));
+   char * name = serialise("__cs_temp");
+   LLVMValueRef val;
+   int i;
+
+   if (cleanup)
+      val = create_var(jit, sym_lookup(name), name, type);
+   else
+      val = AddLocal(jit, type_to_llvm(jit, type), name);
+
+   if (type == ctx->t_ZZ) /* borrow limbs for the result from the pool */
+   {
+      LLVMValueRef init = LLVMGetNamedFunction(jit->module, "__fmpz_pool_init");
+      LLVMBuildCall(jit->builder, init, &val, 1, "");
+   } else if (requires_constructor(type))
+      call_constructors(jit, val, type);
+
+   args[0] = val;
+   for (i = 0; i < count; i++)
+      args[i + 1] = vals[i];
+
+   LLVMBuildCall(jit->builder, f, args, count + 1, "");
+
+   return ret(0, val);
+}
+
 /* 
    Jit a function application or type constructor application
 */
@@ -2097,15 +4251,21 @@ ret_t * exec_appl(jit_t * jit, ast_t * ast, int cleanup)
    }
 
    bind_t * bind = find_symbol(id->sym);
-   type_t * fn;
+   type_t * fn, * proto = NULL;
    typ_t tag = bind->type->tag;
 
    LLVMValueRef val;
 
    int i, count;
    
-   if (tag == CONSTRUCTOR) fn = bind->type->ret;
-   else fn = find_prototype(bind->type, exp);
+   if (tag == CONSTRUCTOR) 
+   {
+      fn = bind->type->ret;
+      proto = find_prototype(bind->type, exp);
+      if (proto != NULL && proto->llvm != NULL && proto->ret == fn) /* explicit constructor */
+         return exec_explicit_constructor(jit, ast, proto, cleanup);
+   } else 
+      fn = find_prototype(bind->type, exp);
    
    count = fn->arity;
    
@@ -2140,12 +4300,19 @@ ret_t * exec_appl(jit_t * jit, ast_t * ast, int cleanup)
 
       if (fn->llvm == NULL) /* function not yet jit'd */
       {
+         int snap_save = jit->snapping;
+
          inference(fn->ast);
+         jit->snapping = 0; /* the function itself uses the globals */
          r = exec_fndef(jit, fn->ast, fn);
+         jit->snapping = snap_save;
       }
       
-      f = LLVMGetNamedFunction(jit->module, fn->llvm);
+      f = fn_function(jit, fn);
       
+      if (fn->intrinsic && fn->ret->tag == DATA) /* foreign, writes result through first arg */
+         return exec_foreign_call(jit, f, fn->ret, vals, count, cleanup);
+
       /* call function */
       val = LLVMBuildCall(jit->builder, f, vals, count, "");
    } else /* tag == CONSTRUCTOR */
@@ -2172,7 +4339,7 @@ ret_t * exec_appl(jit_t * jit, ast_t * ast, int cleanup)
       for (i = 0; i < count; i++)
       {
          /* insert value into datatype */
-         LLVMValueRef indices[2] = { LLVMConstInt(LLVMInt32Type(), 0, 0), LLVMConstInt(LLVMInt32Type(), i, 0) };
+         LLVMValueRef indices[2] = { LLVMConstInt(LLVMInt32TypeInContext(jit->context), 0, 0), LLVMConstInt(LLVMInt32TypeInContext(jit->context), i, 0) };
          LLVMValueRef entry = LLVMBuildInBoundsGEP(jit->builder, val, indices, 2, fn->sym->name);
          LLVMBuildStore(jit->builder, vals[i], entry);
       } 
@@ -2219,7 +4386,7 @@ ret_t * exec_slot(jit_t * jit, ast_t * ast)
       if (type->slots[i] == slot->sym)
             break;
 
-   LLVMValueRef index[2] = { LLVMConstInt(LLVMInt32Type(), 0, 0), LLVMConstInt(LLVMInt32Type(), i, 0) };
+   LLVMValueRef index[2] = { LLVMConstInt(LLVMInt32TypeInContext(jit->context), 0, 0), LLVMConstInt(LLVMInt32TypeInContext(jit->context), i, 0) };
    LLVMValueRef val = LLVMBuildInBoundsGEP(jit->builder, r->val, index, 2, "datatype");
 
    if (type->args[i]->tag != DATA && type->args[i]->tag != TUPLE && type->args[i]->tag != ARRAY)
@@ -2247,12 +4414,34 @@ ret_t * exec_lslot(jit_t * jit, ast_t * ast)
       if (type->slots[i] == slot->sym)
             break;
 
-   LLVMValueRef index[2] = { LLVMConstInt(LLVMInt32Type(), 0, 0), LLVMConstInt(LLVMInt32Type(), i, 0) };
+   LLVMValueRef index[2] = { LLVMConstInt(LLVMInt32TypeInContext(jit->context), 0, 0), LLVMConstInt(LLVMInt32TypeInContext(jit->context), i, 0) };
    LLVMValueRef val = LLVMBuildInBoundsGEP(jit->builder, r->val, index, 2, "datatype");
    
    return ret(0, val);
 }
 
+/*
+   Jit a pointer to entry (i, j) of an fmpz_mat, via its array of row 
+   pointers
+*/
+LLVMValueRef exec_mat_entry(jit_t * jit, ast_t * id, ast_t * idx)
+{
+    ret_t * r = exec_ast(jit, id);
+    ret_t * i = exec_ast(jit, idx->child);
+    ret_t * j = exec_ast(jit, idx->child->next);
+
+    LLVMTypeRef zz = LLVMPointerType(type_to_llvm(jit, ctx->t_ZZ), 0); /* fmpz * */
+    LLVMValueRef rows = LLVMBuildLoadField(jit, r->val, 3, "rows");
+    rows = LLVMBuildIntToPtr(jit->builder, rows, LLVMPointerType(zz, 0), "rows");
+
+    LLVMValueRef indices[1] = { i->val };
+    LLVMValueRef row = LLVMBuildInBoundsGEP(jit->builder, rows, indices, 1, "row");
+    row = LLVMBuildLoad(jit->builder, row, "row");
+
+    indices[0] = j->val;
+    return LLVMBuildInBoundsGEP(jit->builder, row, indices, 1, "mat_entry");
+}
+
 /*
    Jit an array access
 */
@@ -2265,11 +4454,14 @@ ret_t * exec_locn(jit_t * jit, ast_t * ast)
     if (ast->sym == NULL) /* need some kind of name */
         ast->sym = sym_lookup("__cs_none");
     
+    if (id->type == ctx->t_fmpz_mat) /* entries are ZZ's, used in place */
+       return ret(0, exec_mat_entry(jit, id, expr));
+
     ret_t * r = exec_ast(jit, id);
     ret_t * s = exec_ast(jit, expr);
     
     /* get array from datatype */
-    LLVMValueRef indices[2] = { LLVMConstInt(LLVMInt32Type(), 0, 0), LLVMConstInt(LLVMInt32Type(), 0, 0) };
+    LLVMValueRef indices[2] = { LLVMConstInt(LLVMInt32TypeInContext(jit->context), 0, 0), LLVMConstInt(LLVMInt32TypeInContext(jit->context), 0, 0) };
     LLVMValueRef val = LLVMBuildInBoundsGEP(jit->builder, r->val, indices, 2, "arr");
     val = LLVMBuildLoad(jit->builder, val, "array");
     
@@ -2295,11 +4487,14 @@ ret_t * exec_llocn(jit_t * jit, ast_t * ast)
     if (ast->sym == NULL) /* need some kind of name */
         ast->sym = sym_lookup("__cs_none");
     
+    if (id->type == ctx->t_fmpz_mat)
+       return ret(0, exec_mat_entry(jit, id, expr));
+
     ret_t * r = exec_ast(jit, id);
     ret_t * s = exec_ast(jit, expr);
     
     /* get array from datatype */
-    LLVMValueRef indices[2] = { LLVMConstInt(LLVMInt32Type(), 0, 0), LLVMConstInt(LLVMInt32Type(), 0, 0) };
+    LLVMValueRef indices[2] = { LLVMConstInt(LLVMInt32TypeInContext(jit->context), 0, 0), LLVMConstInt(LLVMInt32TypeInContext(jit->context), 0, 0) };
     LLVMValueRef val = LLVMBuildInBoundsGEP(jit->builder, r->val, indices, 2, "arr");
     val = LLVMBuildLoad(jit->builder, val, "array");
     
@@ -2318,14 +4513,14 @@ ret_t * exec_return(jit_t * jit, ast_t * ast)
     ast_t * p = ast->child;
     ret_t * r;
 
-    if (p != ast_nil)
+    if (p != ctx->ast_nil)
         r = exec_ast(jit, p);
     else
         r = ret(0, NULL);
 
-    env_t * scope_save = current_scope;
+    env_t * scope_save = ctx->current_scope;
     
-    while (current_scope->next->next != NULL) /* while we haven't reached global scope */
+    while (ctx->current_scope->next->next != NULL) /* while we haven't reached global scope */
     {
        exec_destructors(jit, r->val);
        
@@ -2335,12 +4530,12 @@ ret_t * exec_return(jit_t * jit, ast_t * ast)
     if (p->type->tag == DATA || p->type->tag == TUPLE || p->type->tag == ARRAY)
        r->val = LLVMBuildLoad(jit->builder, r->val, "datatype");
 
-    if (p != ast_nil)
+    if (p != ctx->ast_nil)
         LLVMBuildRet(jit->builder, r->val);    
     else
         LLVMBuildRetVoid(jit->builder);
      
-    current_scope = scope_save; /* we might have other statements following the return */
+    ctx->current_scope = scope_save; /* we might have other statements following the return */
 
     return ret(1, NULL);
 }
@@ -2351,6 +4546,17 @@ ret_t * exec_return(jit_t * jit, ast_t * ast)
 ret_t * exec_fn_stmt(jit_t * jit, ast_t * ast)
 {
    ast->tag = AST_FN_BODY; /* needed for type inference of body */
+   
+   if (ctx->eager) /* hand the function to the compile thread */
+   {
+      bind_t * bind = find_symbol(ast->child->sym);
+      int i;
+
+      for (i = 0; i < bind->type->arity; i++)
+         if (bind->type->args[i]->ast == ast)
+            eager_push(ctx->eager, bind->type->args[i]);
+   }
+
    return ret(0, NULL);
 }
 
@@ -2366,6 +4572,8 @@ ret_t * exec_ast(jit_t * jit, ast_t * ast)
         return exec_ZZ(jit, ast);
     case AST_INT:
         return exec_int(jit, ast);
+    case AST_INT_TO_ZZ:
+        return exec_int_to_ZZ(jit, ast);
     case AST_UINT:
         return exec_uint(jit, ast);
     case AST_DOUBLE:
@@ -2386,6 +4594,10 @@ ret_t * exec_ast(jit_t * jit, ast_t * ast)
         return exec_if_stmt(jit, ast);
     case AST_WHILE_STMT:
         return exec_while_stmt(jit, ast);
+    case AST_FOR_STMT:
+        return exec_for_stmt(jit, ast);
+    case AST_PARFOR_STMT:
+        return exec_parfor_stmt(jit, ast);
     case AST_BREAK:
         return exec_break(jit, ast);
     case AST_BLOCK:
@@ -2397,11 +4609,14 @@ ret_t * exec_ast(jit_t * jit, ast_t * ast)
         return exec_data_stmt(jit, ast);
     case AST_ASSIGNMENT:
         return exec_assignment(jit, ast->child, ast->child->next);
+    case AST_CONST:
+        return exec_const(jit, ast);
     case AST_IDENT:
         return exec_ident(jit, ast);
     case AST_APPL:
         return exec_appl(jit, ast, 1); /* by default, cleanup */
     case AST_ARRAY_CONSTRUCTOR:
+    case AST_LOCAL_ARRAY_CONSTRUCTOR:
         return exec_array_constructor(jit, ast);
     case AST_SLOT:
         return exec_slot(jit, ast);
@@ -2411,6 +4626,24 @@ ret_t * exec_ast(jit_t * jit, ast_t * ast)
         return exec_locn(jit, ast);
     case AST_LLOCN:
         return exec_llocn(jit, ast);
+    case AST_MAP:
+        return exec_map(jit, ast);
+    case AST_FILTER:
+        return exec_filter(jit, ast);
+    case AST_ARRAY_REDUCE:
+        return exec_array_reduce(jit, ast);
+    case AST_SPAWN:
+        return exec_spawn(jit, ast);
+    case AST_CHAN_CONSTRUCTOR:
+        return exec_chan_constructor(jit, ast);
+    case AST_SEND:
+        return exec_send(jit, ast);
+    case AST_RECV:
+        return exec_recv(jit, ast);
+    case AST_CLOSE:
+        return exec_close(jit, ast);
+    case AST_AWAIT:
+        return exec_await(jit, ast, 1);
     case AST_FN_STMT:
         return exec_fn_stmt(jit, ast);
     case AST_RETURN:
@@ -2425,7 +4658,7 @@ ret_t * exec_ast(jit_t * jit, ast_t * ast)
 */
 void exec_ret(jit_t * jit, ast_t * ast, LLVMValueRef val)
 {
-   if (ast->type == t_nil)
+   if (ast->type == ctx->t_nil)
       LLVMBuildRetVoid(jit->builder);
    else
       LLVMBuildRet(jit->builder, val);
@@ -2441,24 +4674,25 @@ void print_struct_entry(jit_t * jit, type_t * type, int i, LLVMGenericValueRef v
    LLVMTypeRef ltype = type_to_generic_llvm(jit, type);
    LLVMGenericValueRef gen_val;
    
-   LLVMBuilderRef builder = LLVMCreateBuilder();
+   LLVMBuilderRef builder = LLVMCreateBuilderInContext(jit->context);
    LLVMTypeRef args[1] = { ltype };
    LLVMTypeRef fn_type = LLVMFunctionType(lt, args, 1, 0);
    LLVMValueRef function = LLVMAddFunction(jit->module, "exec2", fn_type);
-   LLVMBasicBlockRef entry = LLVMAppendBasicBlock(function, "entry");
+   LLVMBasicBlockRef entry = LLVMAppendBasicBlockInContext(jit->context, function, "entry");
    LLVMPositionBuilderAtEnd(builder, entry);
    
    LLVMValueRef obj = LLVMGetParam(function, 0);
-   LLVMValueRef index[2] = { LLVMConstInt(LLVMInt32Type(), 0, 0), LLVMConstInt(LLVMInt32Type(), i, 0) };
+   LLVMValueRef index[2] = { LLVMConstInt(LLVMInt32TypeInContext(jit->context), 0, 0), LLVMConstInt(LLVMInt32TypeInContext(jit->context), i, 0) };
    LLVMValueRef res = LLVMBuildInBoundsGEP(builder, obj, index, 2, "tuple");
    if (t->tag != DATA && t->tag != TUPLE)
       res = LLVMBuildLoad(builder, res, "entry");
     
-   if (t == t_nil)
+   if (t == ctx->t_nil)
       LLVMBuildRetVoid(builder);
    else
       LLVMBuildRet(builder, res);
 
+   LLVMRunPassManager(jit->inliner, jit->module); 
    LLVMRunFunctionPassManager(jit->pass, function);
    LLVMGenericValueRef exec_args[1] = { val };
    gen_val = LLVMRunFunction(jit->engine, function, 1, exec_args);
@@ -2509,23 +4743,23 @@ void print_gen(jit_t * jit, type_t * type, LLVMGenericValueRef gen_val)
 {
    int i, res;
    
-   if (type == t_nil)
+   if (type == ctx->t_nil)
       printf("none");
-   else if (type == t_int)
+   else if (type == ctx->t_int)
       printf("%ldi", (long) LLVMGenericValueToInt(gen_val, 1));
-   else if (type == t_uint)
+   else if (type == ctx->t_uint)
       printf("%luu", (unsigned long) LLVMGenericValueToInt(gen_val, 0));
-   else if (type == t_double)
-      printf("%lg", (double) LLVMGenericValueToFloat(LLVMDoubleType(), gen_val));
-   else if (type == t_char)
+   else if (type == ctx->t_double)
+      printf("%lg", (double) LLVMGenericValueToFloat(LLVMDoubleTypeInContext(jit->context), gen_val));
+   else if (type == ctx->t_char)
    {
       char c = (char) LLVMGenericValueToInt(gen_val, 0);
       if (!print_special(c))
          printf("'%c'", c);
    }
-   else if (type == t_string)
+   else if (type == ctx->t_string)
       printf("\"%s\"", (char *) LLVMGenericValueToPointer(gen_val));
-   else if (type == t_bool)
+   else if (type == ctx->t_bool)
    {
       if (LLVMGenericValueToInt(gen_val, 0))
          printf("true");
@@ -2542,9 +4776,24 @@ void print_gen(jit_t * jit, type_t * type, LLVMGenericValueRef gen_val)
       printf(")");
    } else if (type->tag == DATA)
    {
-      if (type == t_ZZ)
+      if (type == ctx->t_ZZ)
          fmpz_print((fmpz *) LLVMGenericValueToPointer(gen_val));
-      else
+      else if (type == ctx->t_nmod) /* residue and modulus */
+      {
+         unsigned long * res = (unsigned long *) LLVMGenericValueToPointer(gen_val);
+         printf("%lu mod %lu", res[0], res[1]);
+      } else if (type == ctx->t_fmpz_mat)
+         fmpz_mat_print_pretty((fmpz_mat_struct *) LLVMGenericValueToPointer(gen_val));
+      else if (type == ctx->t_fmpz_poly)
+         fmpz_poly_print_pretty((fmpz_poly_struct *) LLVMGenericValueToPointer(gen_val), "x");
+      else if (type == ctx->t_nmod_poly) /* coefficients, as for the constructor, and modulus */
+      {
+         nmod_poly_struct * p = (nmod_poly_struct *) LLVMGenericValueToPointer(gen_val);
+         printf("[");
+         for (i = 0; i < p->length; i++)
+            printf(i == 0 ? "%lu" : ", %lu", p->coeffs[i]);
+         printf("] mod %lu", p->mod.n);
+      } else
       {
          printf("%s(", type->sym->name);
          for (i = 0; i < type->arity - 1; i++)
@@ -2555,19 +4804,28 @@ void print_gen(jit_t * jit, type_t * type, LLVMGenericValueRef gen_val)
    } else if (type->tag == ARRAY)
    {
       printf("array");
+   } else if (type->tag == FUTURE)
+   {
+      printf("future");
+   } else if (type->tag == CHAN)
+   {
+      printf("chan");
    } else
       exception("Unknown type in print_gen\n");
 }
 
 /* 
-   We start traversing the ast to do jit'ing 
+   We start traversing the ast to do jit'ing. Returns a function which
+   computes the value of the statement, ready to be run.
 */
-void exec_root(jit_t * jit, ast_t * ast)
+LLVMValueRef exec_compile(jit_t * jit, ast_t * ast)
 {
-    LLVMGenericValueRef gen_val;
+    LLVMValueRef function;
     ret_t * ret;
 
-    /* Traverse the ast jit'ing everything, then run the jit'd code */
+    jit->defs = NULL; /* functions jit'd by earlier statements are done */
+
+    /* Traverse the ast jit'ing everything */
     START_EXEC(type_to_generic_llvm(jit, ast->type));
          
     /* jit the ast */
@@ -2576,19 +4834,107 @@ void exec_root(jit_t * jit, ast_t * ast)
     /* jit the return statement for the exec function */
     if (ast->type->tag == DATA || ast->type->tag == TUPLE) /* data types must be returned as GC'd heap objects */
     {
-       LLVMTypeRef type = type_to_llvm(jit, ast->type);
        LLVMValueRef val = LLVMBuildLoad(jit->builder, ret->val, "val");
-       int atomic = is_atomic(ast->type);
-       ret->val = LLVMBuildGCMalloc(jit, type, "data", atomic);
+       ret->val = LLVMBuildGCMalloc(jit, ast->type, "data");
        LLVMBuildStore(jit->builder, val, ret->val);
     }
 
     exec_ret(jit, ast, ret->val);
     
-    /* get the generic return value from exec */
-    END_EXEC(gen_val);
+    END_EXEC(function);
+
+    return function;
+}
+
+/*
+   Call the machine code for a statement directly, rather than through
+   the execution engine, so that the jit isn't needed while it runs. 
+   Returns the value as a generic value of the given llvm type.
+*/
+LLVMGenericValueRef exec_call(void * code, type_t * type, LLVMTypeRef ret)
+{
+    if (type == ctx->t_nil)
+    {
+       ((void (*)(void)) code)();
+       return NULL;
+    } else if (type == ctx->t_int || type == ctx->t_uint)
+       return LLVMCreateGenericValueOfInt(ret, ((long (*)(void)) code)(), type == ctx->t_int);
+    else if (type == ctx->t_char || type == ctx->t_bool)
+       return LLVMCreateGenericValueOfInt(ret, ((unsigned char (*)(void)) code)(), 0);
+    else if (type == ctx->t_double)
+       return LLVMCreateGenericValueOfFloat(ret, ((double (*)(void)) code)());
+    else /* everything else is returned as a pointer */
+       return LLVMCreateGenericValueOfPointer(((void * (*)(void)) code)());
+}
+
+/*
+   Run the function jit'd for a statement whose value has the given 
+   type, delete it and print the value
+*/
+void exec_run(jit_t * jit, LLVMValueRef function, type_t * type)
+{
+    LLVMGenericValueRef gen_val;
+    LLVMTypeRef ret = type_to_generic_llvm(jit, type);
+    void * code = LLVMGetPointerToGlobal(jit->engine, function);
+    int held;
+
+    /* other threads of the engine may use the jit while the code runs */
+    held = jit_unlock(jit);
+
+    gc_exec_start();
+    gen_val = exec_call(code, type, ret);
+    gc_exec_end();
+    
+    if (held)
+       jit_lock(jit);
+
+    LLVMDeleteFunction(function);
+
+    print_gen(jit, type, gen_val), printf("\n");
+}
+
+/*
+   Jit a statement to be run in the background, returning the function
+   which runs it. Each mutable global the statement uses is replaced by
+   a private copy, so that it doesn't race with statements run in the 
+   meantime. The copies are made by the function returned in snap, 
+   which must be run first. The functions the statement calls are 
+   copied too, and returned in copies, to be deleted with it.
+*/
+LLVMValueRef exec_background(jit_t * jit, ast_t * ast, LLVMValueRef * snap, fn_list_t ** copies)
+{
+    LLVMValueRef function;
+    snap_t * s;
+
+    jit->snapping = 1;
+    jit->snap = NULL;
+    jit->snap_fns = NULL;
+    
+    function = exec_compile(jit, ast);
+    
+    jit->snapping = 0;
+    *copies = jit->snap_fns;
+    jit->snap_fns = NULL;
+
+    START_EXEC(LLVMVoidTypeInContext(jit->context));
+
+    for (s = jit->snap; s != NULL; s = s->next)
+       copy_construct(jit, s->copy, s->var, s->bind->type);
+    
+    LLVMBuildRetVoid(jit->builder);
 
-    /* print the resulting value */
-    print_gen(jit, ast->type, gen_val), printf("\n");
+    END_EXEC(*snap);
+
+    jit->snap = NULL;
+
+    return function;
+}
+
+/*
+   Jit and run a statement at the top level of the REPL
+*/
+void exec_root(jit_t * jit, ast_t * ast)
+{
+    exec_run(jit, exec_compile(jit, ast), ast->type);
 }
 
@@ -30,20 +30,31 @@ ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <math.h>
 
 #include "gc.h"
+#include "gc_typed.h"
 #include "exception.h"
 #include "environment.h"
 #include "inference.h"
+#include "escape.h"
 #include "ast.h"
 #include "serial.h"
+#include "gcstat.h"
+#include "pool.h"
+#include "chan.h"
 
 #include "flint.h"
 #include "fmpz.h"
+#include "fmpz_mat.h"
+#include "fmpz_poly.h"
+#include "nmod_poly.h"
 
 #include <llvm-c/Core.h>  
 #include <llvm-c/Analysis.h>  
 #include <llvm-c/ExecutionEngine.h>  
 #include <llvm-c/Target.h>  
 #include <llvm-c/Transforms/Scalar.h> 
+#include <llvm-c/Transforms/IPO.h> 
+#include <llvm-c/BitReader.h> 
+#include <llvm-c/Linker.h> 
 
 #ifndef BACKEND_H
 #define BACKEND_H
@@ -62,31 +73,107 @@ typedef struct loc_t {
    LLVMValueRef llvm_val;
 } loc_t;
 
-extern loc_t ** loc_tab;
-
 void loc_tab_init(void);
 
 void loc_insert(const char * name, LLVMValueRef llvm_val);
 
 LLVMValueRef loc_lookup(const char * name);
 
+typedef struct descr_t {
+   type_t * type;
+   GC_descr descr;
+   struct descr_t * next;
+} descr_t;
+
 /* Are we on a 32 or 64 bit machine */
 #if ULONG_MAX == 4294967295U
-#define LLVMWordType() LLVMInt32Type()
+#define LLVMWordType() LLVMInt32TypeInContext(jit->context)
+#define LLVM_WORD "i32" /* suffix for overloaded intrinsics */
 #else
-#define LLVMWordType() LLVMInt64Type()
+#define LLVMWordType() LLVMInt64TypeInContext(jit->context)
+#define LLVM_WORD "i64"
+#endif
+
+#define CONST_TAB_SIZE 1024
+
+#ifndef RUNTIME_BC
+#define RUNTIME_BC "runtime.bc" /* runtime helpers compiled to LLVM bitcode */
 #endif
 
+typedef struct const_t {
+   sym_t * sym; /* literal text */
+   type_t * type; /* t_ZZ or t_string */
+   fmpz_t val; /* parsed ZZ literal, large values shared by all uses */
+   LLVMValueRef global;
+   struct const_t * next;
+} const_t;
+
+typedef struct fn_list_t
+{
+   LLVMValueRef fn;
+   type_t * type; /* the type of fn, if it is a function definition */
+   struct fn_list_t * next;
+} fn_list_t;
+
+/*
+   A private copy of a global variable used by a background statement
+*/
+typedef struct snap_t
+{
+   bind_t * bind;
+   LLVMValueRef var; /* the global */
+   LLVMValueRef copy; /* the copy used by the statement */
+   struct snap_t * next;
+} snap_t;
+
+/*
+   An engine, with its own LLVM context and module, holding machine code
+   generated in parallel for functions of the main engine
+*/
+typedef struct unit_t
+{
+   LLVMContextRef context;
+   LLVMExecutionEngineRef engine; /* owns the module */
+   struct unit_t * next;
+} unit_t;
+
 typedef struct jit_t
 {
+    LLVMContextRef context; /* each engine has its own LLVM context */
     LLVMBuilderRef builder;
     LLVMValueRef function;
     LLVMExecutionEngineRef engine;  
     LLVMPassManagerRef pass;
+    LLVMPassManagerRef inliner; /* inlines the runtime helpers */
     LLVMModuleRef module;
     LLVMBasicBlockRef breakto;
+    fn_list_t * pending; /* functions waiting to be optimised */
+    int snapping; /* jit'ing a background statement */
+    snap_t * snap; /* globals it uses */
+    fn_list_t * snap_fns; /* and copies of the functions it calls */
+    fn_list_t * defs; /* functions defined since the last statement */
+    pthread_mutex_t lock; /* held by the thread using the jit */
+    unit_t * units; /* engines holding code compiled by batch_compile */
+    int compiling; /* a statement is being jit'd */
 } jit_t;
 
+typedef struct loop_t
+{
+    LLVMValueRef var; /* loop counter */
+    LLVMBasicBlockRef cond;
+    LLVMBasicBlockRef body;
+    LLVMBasicBlockRef end;
+} loop_t;
+
+typedef struct outline_t
+{
+    LLVMValueRef fn; /* the outlined loop body or task */
+    LLVMValueRef fn_save;
+    LLVMBuilderRef build_save;
+    LLVMBasicBlockRef break_save;
+    env_t * scope_save;
+} outline_t;
+
 typedef struct ret_t
 {
     int closed;
@@ -97,6 +184,12 @@ jit_t * llvm_init(void);
 
 void llvm_reset(jit_t * jit);
 
+void jit_optimise(jit_t * jit, LLVMValueRef fn);
+
+void jit_add_passes(LLVMPassManagerRef pass, LLVMExecutionEngineRef engine);
+
+void jit_run_passes(jit_t * jit);
+
 void llvm_cleanup(jit_t * jit);
 
 LLVMTypeRef type_to_llvm(jit_t * jit, type_t * type);
@@ -111,10 +204,30 @@ int requires_constructor(type_t * t);
 
 void call_constructors(jit_t * jit, LLVMValueRef locn, type_t * type);
 
+void call_destructors(jit_t * jit, LLVMValueRef var, type_t * t, LLVMValueRef retval);
+
+LLVMValueRef copy_construct(jit_t * jit, LLVMValueRef var, LLVMValueRef val, type_t * t);
+
 ret_t * exec_appl(jit_t * jit, ast_t * ast, int cleanup);
 
 ret_t * exec_ast(jit_t * jit, ast_t * ast);
 
+LLVMTypeRef type_to_generic_llvm(jit_t * jit, type_t * type);
+
+void jit_lock(jit_t * jit);
+
+int jit_unlock(jit_t * jit);
+
+void jit_abandon(jit_t * jit);
+
+LLVMValueRef exec_compile(jit_t * jit, ast_t * ast);
+
+LLVMGenericValueRef exec_call(void * code, type_t * type, LLVMTypeRef ret);
+
+LLVMValueRef exec_background(jit_t * jit, ast_t * ast, LLVMValueRef * snap, fn_list_t ** copies);
+
+void exec_run(jit_t * jit, LLVMValueRef function, type_t * type);
+
 void exec_root(jit_t * jit, ast_t * ast);
 
 void print_gen(jit_t * jit, type_t * type, LLVMGenericValueRef gen_val);
@@ -125,28 +238,32 @@ void print_gen(jit_t * jit, type_t * type, LLVMGenericValueRef gen_val);
    LLVMValueRef __function_save; \
    do { \
    __builder_save = jit->builder; \
-   jit->builder = LLVMCreateBuilder(); \
+   jit->builder = LLVMCreateBuilderInContext(jit->context); \
    __function_save = jit->function; \
+   jit->compiling = 1; \
    LLVMTypeRef __args[] = { }; \
    LLVMTypeRef __retval = ret_type; \
    LLVMTypeRef __fn_type = LLVMFunctionType(__retval, __args, 0, 0); \
    jit->function = LLVMAddFunction(jit->module, "exec", __fn_type); \
-   LLVMBasicBlockRef __entry = LLVMAppendBasicBlock(jit->function, "entry"); \
+   LLVMBasicBlockRef __entry = LLVMAppendBasicBlockInContext(jit->context, jit->function, "entry"); \
    LLVMPositionBuilderAtEnd(jit->builder, __entry); \
    } while (0)
    
-/* Run the jit'd code */
-#define END_EXEC(gen_val) \
+/* 
+   Optimise the jit'd code, leaving it ready to be run. The statement
+   itself is optimised by this engine, as its code is needed at once.
+*/
+#define END_EXEC(fn) \
    do { \
+   jit_run_passes(jit); \
    LLVMRunFunctionPassManager(jit->pass, jit->function); \
    if (TRACE) \
       LLVMDumpModule(jit->module); \
-   LLVMGenericValueRef __exec_args[] = {}; \
-   gen_val = LLVMRunFunction(jit->engine, jit->function, 0, __exec_args); \
-   LLVMDeleteFunction(jit->function); \
+   fn = jit->function; \
    LLVMDisposeBuilder(jit->builder); \
    jit->function = __function_save; \
    jit->builder = __builder_save; \
+   jit->compiling = 0; \
    } while (0)
 
 #ifdef __cplusplus
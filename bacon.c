@@ -32,71 +32,143 @@ ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "types.h"
 #include "environment.h"
 #include "inference.h"
+#include "fold.h"
 #include "ffi.h"
 #include "backend.h"
+#include "gcstat.h"
+#include "context.h"
+#include "pipe.h"
+#include "bg.h"
+#include "eager.h"
 
 #include "parser.c"
 
 #define DEBUG1 0 /* print ast */
 #define DEBUG2 0 /* print ast after inference */
 
-extern jmp_buf exc;
+/*
+   Handle a REPL command such as :gc or :jobs
+*/
+void exec_command(ast_t * a)
+{
+   if (!gc_command(a->sym->name) && !bg_command(ctx->jit, a->sym->name))
+      printf("Unknown command :%s\n", a->sym->name);
+}
 
-int main(void)
+int main(int argc, char ** argv)
 {
    ast_t * a;
-   int jval;
-   jit_t * jit;
+   int i, jval, pipeline = 0, eager = 0;
+   context_t * c;
+   pipe_t * p = NULL;
    
    GC_INIT();
+   gc_init();
    GREG g;
+
+   for (i = 1; i < argc; i++)
+   {
+      if (strcmp(argv[i], "--pipeline") == 0)
+         pipeline = 1;
+      else if (strcmp(argv[i], "--eager") == 0)
+         eager = 1;
+      else if (!gc_option(argv[i]))
+      {
+         printf("Usage: bacon [--pipeline] [--eager] [--gc-stats] [--gc-incremental] [--gc-pause=ms] [--gc-divisor=n] [--gc-heap=size]\n");
+         return 1;
+      }
+   }
  
-   ast_init();
-   sym_tab_init();
-   types_init();
-   scope_init();
-   loc_tab_init();
-   intrinsics_init();
-   jit = llvm_init();
-   ZZ_init(jit);
+   c = context_new(stdin);
+   context_enter(c);
    
+   /* 
+      In pipelined mode, e.g. for pasted or piped input, the next 
+      statement is compiled while the last one runs, and there is no
+      prompt
+   */
+   if (pipeline)
+      p = pipe_start(c);
+
+   /* jit functions on another thread as soon as they are defined */
+   if (eager)
+      eager_start(c);
+
    yyinit(&g);
 
    printf("Welcome to Bacon v0.1\n\n");
-   printf("> ");
+   if (!p)
+      printf("> ");
 
    while (1)
    {
       if (!(jval = setjmp(exc)))
       {
+         gc_idle(c->in, g.buf + g.pos, g.limit - g.pos); /* collect while waiting for the user */
+
          if (!yyparse(&g))
          {
             printf("Error parsing\n");
             abort();
-         } else if (root)
+         } else if (ctx->root && ctx->root->tag == AST_COMMAND)
+         {
+            jit_lock(c->jit);
+            if (p) /* commands see the effect of all earlier statements */
+               pipe_sync(p);
+            exec_command(ctx->root);
+            jit_unlock(c->jit);
+            ctx->root = NULL;
+         } else if (ctx->root)
          {
+            jit_lock(c->jit);
 #if DEBUG1
             printf("\n");
-            ast_print(root, 0);
+            ast_print(ctx->root, 0);
 #endif
-            inference(root);
+            inference(ctx->root);
+            constant_folding(ctx->root);
 #if DEBUG2
             printf("\n");
             /*ast2_print(root, 0);*/
 #endif
-            exec_root(jit, root);
-            root = NULL;
+            if (ctx->root->tag == AST_BACKGROUND)
+            {
+               if (p) /* it starts from the globals as they are now */
+                  pipe_sync(p);
+               bg_start(c->jit, ctx->root->child);
+            } else if (p)
+               pipe_push(p, c->jit, ctx->root);
+            else
+            {
+               exec_root(c->jit, ctx->root);
+               if (gc_stats)
+                  gc_stmt_report();
+            }
+            jit_unlock(c->jit);
+            ctx->root = NULL;
          }
       } else if (jval == 1)
-         root = NULL;
-      else /* jval == 2 */
+      {
+         jit_unlock(c->jit);
+         ctx->root = NULL;
+      } else /* jval == 2 */
          break;
       
-      printf("\n> ");
+      if (!p)
+         printf("\n> ");
    }
 
-   llvm_cleanup(jit);
+   if (p)
+      pipe_stop(p);
+
+   if (c->eager)
+      eager_stop(c->eager);
+
+   bg_cleanup(c->jit);
+
    yydeinit(&g);
+   context_enter(NULL);
+   context_free(c);
     
    printf("\n");
 
@@ -0,0 +1,470 @@
+/*
+
+Copyright 2012 William Hart. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are
+permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this list of
+      conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice, this list
+      of conditions and the following disclaimer in the documentation and/or other materials
+      provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY William Hart ``AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL William Hart OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include <llvm-c/BitWriter.h>
+
+#include "batch.h"
+
+/*
+   Note that function i of the batch uses the global value v
+*/
+void batch_ref(batch_t * b, long i, LLVMValueRef v)
+{
+   ref_t * r;
+   long j;
+
+   for (j = 0; j < b->n; j++)
+   {
+      if (b->fns[j] == v)
+      {
+         b->uses[i*b->n + j] = 1;
+         return;
+      }
+   }
+
+   if (LLVMIsAFunction(v) && LLVMGetIntrinsicID(v) != 0)
+      return;
+
+   if (LLVMIsAGlobalAlias(v) || LLVMGetValueName(v)[0] == '\0')
+   {
+      b->fail = 1; /* can't be found in another module */
+      return;
+   }
+
+   for (r = b->refs[i]; r != NULL; r = r->next)
+      if (r->val == v)
+         return;
+
+   r = (ref_t *) GC_MALLOC(sizeof(ref_t));
+   r->val = v;
+   r->next = b->refs[i];
+   b->refs[i] = r;
+}
+
+/*
+   Find the global values used by an operand of function i
+*/
+void batch_scan(batch_t * b, long i, LLVMValueRef v)
+{
+   int k;
+
+   if (LLVMIsAGlobalValue(v))
+      batch_ref(b, i, v);
+   else if (LLVMIsAConstant(v)) /* e.g. a bitcast of a function */
+   {
+      for (k = 0; k < LLVMGetNumOperands(v); k++)
+         batch_scan(b, i, LLVMGetOperand(v, k));
+   }
+}
+
+/*
+   Find the functions of the batch and other globals that function i
+   uses
+*/
+void batch_scan_fn(batch_t * b, long i)
+{
+   LLVMBasicBlockRef bb;
+   LLVMValueRef in;
+   int k;
+
+   for (bb = LLVMGetFirstBasicBlock(b->fns[i]); bb != NULL; bb = LLVMGetNextBasicBlock(bb))
+   {
+      for (in = LLVMGetFirstInstruction(bb); in != NULL; in = LLVMGetNextInstruction(in))
+      {
+         for (k = 0; k < LLVMGetNumOperands(in); k++)
+            batch_scan(b, i, LLVMGetOperand(in, k));
+      }
+   }
+}
+
+/*
+   Write the main module out as bitcode, to be read by each thread into
+   its own context. Returns 0 on failure.
+*/
+int batch_write(batch_t * b)
+{
+   FILE * f = tmpfile();
+   int ok;
+
+   if (f == NULL)
+      return 0;
+
+   if (LLVMWriteBitcodeToFD(b->jit->module, fileno(f), 0, 0) != 0)
+   {
+      fclose(f);
+      return 0;
+   }
+
+   fseek(f, 0, SEEK_END);
+   b->len = ftell(f);
+   rewind(f);
+
+   b->bc = (char *) GC_MALLOC_ATOMIC(b->len);
+   ok = (fread(b->bc, 1, b->len, f) == b->len);
+   
+   fclose(f);
+
+   return ok;
+}
+
+/*
+   Turn a function into a declaration, so that its body is not compiled
+   again. The instructions have to be removed before the blocks, as they 
+   refer to each other.
+*/
+void batch_strip(LLVMValueRef fn)
+{
+   LLVMBasicBlockRef bb;
+   LLVMValueRef in;
+
+   for (bb = LLVMGetFirstBasicBlock(fn); bb != NULL; bb = LLVMGetNextBasicBlock(bb))
+   {
+      for (in = LLVMGetFirstInstruction(bb); in != NULL; in = LLVMGetNextInstruction(in))
+         if (LLVMGetFirstUse(in) != NULL)
+            LLVMReplaceAllUsesWith(in, LLVMGetUndef(LLVMTypeOf(in)));
+   }
+
+   for (bb = LLVMGetFirstBasicBlock(fn); bb != NULL; bb = LLVMGetNextBasicBlock(bb))
+   {
+      while ((in = LLVMGetFirstInstruction(bb)) != NULL)
+         LLVMInstructionEraseFromParent(in);
+   }
+
+   while ((bb = LLVMGetFirstBasicBlock(fn)) != NULL)
+      LLVMDeleteBasicBlock(bb);
+
+   LLVMSetLinkage(fn, LLVMExternalLinkage);
+}
+
+/*
+   Check if the function with the given name is compiled by part p
+*/
+int batch_in_part(batch_t * b, part_t * p, const char * name)
+{
+   long k;
+
+   for (k = 0; k < p->num; k++)
+      if (strcmp(b->names[p->fns[k]], name) == 0)
+         return 1;
+
+   return 0;
+}
+
+/*
+   Optimise and generate machine code for the functions of part p, in 
+   a new context. This runs on a thread of the pool, so it mustn't 
+   touch the main engine.
+*/
+void batch_part(batch_t * b, part_t * p)
+{
+   LLVMContextRef context = LLVMContextCreate();
+   LLVMMemoryBufferRef buf;
+   LLVMModuleRef module;
+   LLVMExecutionEngineRef engine;
+   LLVMPassManagerRef pass;
+   LLVMValueRef fn, v;
+   char * msg = NULL;
+   long k;
+
+   buf = LLVMCreateMemoryBufferWithMemoryRangeCopy(b->bc, b->len, "batch");
+   
+   if (LLVMParseBitcodeInContext(context, buf, &module, &msg) != 0)
+   {
+      LLVMDisposeMessage(msg);
+      LLVMDisposeMemoryBuffer(buf);
+      LLVMContextDispose(context);
+      return;
+   }
+
+   LLVMDisposeMemoryBuffer(buf);
+
+   /* everything else is already compiled, or will be, by the main engine */
+   for (fn = LLVMGetFirstFunction(module); fn != NULL; fn = LLVMGetNextFunction(fn))
+      if (!LLVMIsDeclaration(fn) && !batch_in_part(b, p, LLVMGetValueName(fn)))
+         batch_strip(fn);
+
+   if (LLVMCreateJITCompilerForModule(&engine, module, 2, &msg) != 0)
+   {
+      LLVMDisposeMessage(msg);
+      LLVMDisposeModule(module);
+      LLVMContextDispose(context);
+      return;
+   }
+
+   /* use the code and data of the main engine */
+   for (k = 0; k < p->refs; k++)
+   {
+      v = LLVMGetNamedFunction(module, p->names[k]);
+      if (v == NULL)
+         v = LLVMGetNamedGlobal(module, p->names[k]);
+      if (v != NULL)
+         LLVMAddGlobalMapping(engine, v, p->addrs[k]);
+   }
+
+   pass = LLVMCreateFunctionPassManagerForModule(module);
+   jit_add_passes(pass, engine);
+
+   for (k = 0; k < p->num; k++)
+      LLVMRunFunctionPassManager(pass, LLVMGetNamedFunction(module, b->names[p->fns[k]]));
+
+   LLVMDisposePassManager(pass);
+
+   for (k = 0; k < p->num; k++)
+      b->code[p->fns[k]] = LLVMGetPointerToGlobal(engine, 
+                              LLVMGetNamedFunction(module, b->names[p->fns[k]]));
+
+   p->unit = (unit_t *) GC_MALLOC(sizeof(unit_t));
+   p->unit->context = context;
+   p->unit->engine = engine;
+}
+
+/*
+   Run the parts [lo, hi) of the current wave
+*/
+void batch_run(long lo, long hi, void * env)
+{
+   batch_t * b = (batch_t *) env;
+
+   for ( ; lo < hi; lo++)
+      batch_part(b, b->parts + lo);
+}
+
+/*
+   Add a global used by part p, unless it already has it
+*/
+void batch_add(part_t * p, const char * name, void * addr)
+{
+   long k;
+
+   for (k = 0; k < p->refs; k++)
+      if (p->names[k] == name)
+         return;
+
+   p->names[p->refs] = name;
+   p->addrs[p->refs] = addr;
+   p->refs++;
+}
+
+/*
+   Find the addresses of everything part p uses which it doesn't compile 
+   itself. Globals are allocated, and functions compiled, by the main
+   engine as needed. Functions of the batch were compiled by earlier 
+   parts.
+*/
+void batch_resolve(batch_t * b, part_t * p)
+{
+   jit_t * jit = b->jit;
+   ref_t * r;
+   long k, i, m, num = 0;
+
+   for (k = 0; k < p->num; k++)
+   {
+      i = p->fns[k];
+      for (r = b->refs[i]; r != NULL; r = r->next)
+         num++;
+      num += b->n;
+   }
+
+   p->names = (const char **) GC_MALLOC(num*sizeof(const char *));
+   p->addrs = (void **) GC_MALLOC(num*sizeof(void *));
+   p->refs = 0;
+
+   for (k = 0; k < p->num; k++)
+   {
+      i = p->fns[k];
+      
+      for (r = b->refs[i]; r != NULL; r = r->next)
+         batch_add(p, LLVMGetValueName(r->val), 
+                      LLVMGetPointerToGlobal(jit->engine, r->val));
+
+      for (m = 0; m < b->n; m++)
+         if (b->uses[i*b->n + m] && b->done[m])
+            batch_add(p, b->names[m], b->code[m]);
+   }
+}
+
+/*
+   Check if all the functions that function i depends on, other than
+   those which depend on it in turn, have been compiled
+*/
+int batch_ready(batch_t * b, long i)
+{
+   long j;
+
+   for (j = 0; j < b->n; j++)
+   {
+      if (b->reach[i*b->n + j] && !b->reach[j*b->n + i] && !b->done[j])
+         return 0;
+   }
+
+   return 1;
+}
+
+/*
+   Compile the functions whose dependencies have all been compiled, in
+   parallel. Each group of functions which depend on each other goes
+   to a single part. Returns the number of functions compiled, or -1 if
+   a part failed, in which case the rest are left to the main engine.
+*/
+long batch_wave(batch_t * b)
+{
+   jit_t * jit = b->jit;
+   long i, k, m, groups = 0, parts, count = 0;
+   int failed = 0;
+   char * taken = (char *) GC_MALLOC_ATOMIC(b->n);
+   part_t * p;
+
+   memset(taken, 0, b->n);
+
+   for (i = 0; i < b->n; i++)
+      if (!b->done[i] && batch_ready(b, i))
+         groups++; /* an upper bound */
+
+   if (groups == 0)
+      return 0;
+
+   parts = groups < pool_threads ? groups : pool_threads;
+   b->parts = (part_t *) GC_MALLOC(parts*sizeof(part_t));
+   for (k = 0; k < parts; k++)
+      b->parts[k].fns = (long *) GC_MALLOC_ATOMIC(b->n*sizeof(long));
+
+   /* deal the groups out to the parts */
+   for (i = 0, groups = 0; i < b->n; i++)
+   {
+      if (b->done[i] || taken[i] || !batch_ready(b, i))
+         continue;
+
+      p = b->parts + groups%parts;
+      for (m = i; m < b->n; m++)
+      {
+         if (m == i || (b->reach[i*b->n + m] && b->reach[m*b->n + i]))
+         {
+            p->fns[p->num++] = m;
+            taken[m] = 1;
+         }
+      }
+      
+      groups++;
+   }
+
+   if (groups < parts)
+      parts = groups;
+
+   for (k = 0; k < parts; k++)
+      batch_resolve(b, b->parts + k);
+
+   pool_for(batch_run, b, 0, parts);
+
+   for (k = 0; k < parts; k++)
+   {
+      p = b->parts + k;
+      
+      if (p->unit == NULL)
+      {
+         failed = 1;
+         continue;
+      }
+
+      p->unit->next = jit->units;
+      jit->units = p->unit;
+
+      for (m = 0; m < p->num; m++)
+      {
+         i = p->fns[m];
+         LLVMAddGlobalMapping(jit->engine, b->fns[i], b->code[i]);
+         b->done[i] = 1;
+         count++;
+      }
+   }
+
+   return failed ? -1 : count;
+}
+
+/*
+   Optimise the given functions and generate their machine code, using 
+   every thread of the pool. The main engine maps the functions to the 
+   code, rather than compiling them itself. Small batches, and anything 
+   which can't be compiled in parallel, are just optimised by the main 
+   engine, which compiles them when first needed.
+*/
+void batch_compile(jit_t * jit, fn_list_t * fns)
+{
+   batch_t * b = (batch_t *) GC_MALLOC(sizeof(batch_t));
+   fn_list_t * f;
+   const char * name;
+   long i, j, k, n = 0;
+
+   for (f = fns; f != NULL; f = f->next)
+      n++;
+
+   b->jit = jit;
+   b->n = n;
+   b->fns = (LLVMValueRef *) GC_MALLOC(n*sizeof(LLVMValueRef));
+   b->done = (char *) GC_MALLOC_ATOMIC(n);
+   memset(b->done, 0, n);
+
+   for (f = fns, i = 0; f != NULL; f = f->next, i++)
+      b->fns[i] = f->fn;
+
+   pool_init();
+
+   if (n >= BATCH_MIN && pool_threads > 1 && !pool_inside)
+   {
+      b->names = (const char **) GC_MALLOC(n*sizeof(const char *));
+      b->uses = (char *) GC_MALLOC_ATOMIC(n*n);
+      b->reach = (char *) GC_MALLOC_ATOMIC(n*n);
+      b->refs = (ref_t **) GC_MALLOC(n*sizeof(ref_t *));
+      b->code = (void **) GC_MALLOC(n*sizeof(void *));
+      memset(b->uses, 0, n*n);
+
+      for (i = 0; i < n; i++)
+      {
+         name = LLVMGetValueName(b->fns[i]);
+         b->names[i] = (const char *) GC_MALLOC_ATOMIC(strlen(name) + 1);
+         strcpy((char *) b->names[i], name);
+         
+         batch_scan_fn(b, i);
+      }
+
+      /* functions depend on the functions they use, and what those use */
+      memcpy(b->reach, b->uses, n*n);
+      for (k = 0; k < n; k++)
+         for (i = 0; i < n; i++)
+            if (b->reach[i*n + k])
+               for (j = 0; j < n; j++)
+                  b->reach[i*n + j] |= b->reach[k*n + j];
+
+      if (!b->fail && batch_write(b))
+         while (batch_wave(b) > 0) ;
+   }
+
+   for (i = 0; i < n; i++)
+      if (!b->done[i])
+         LLVMRunFunctionPassManager(jit->pass, b->fns[i]);
+}
@@ -0,0 +1,87 @@
+/*
+
+Copyright 2012 William Hart. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are
+permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this list of
+      conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice, this list
+      of conditions and the following disclaimer in the documentation and/or other materials
+      provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY William Hart ``AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL William Hart OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "thread.h"
+
+#include "backend.h"
+#include "pool.h"
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#define BATCH_MIN 2 /* smallest batch compiled in parallel */
+
+/*
+   Machine code for a batch of functions is generated by the pool, each
+   thread using its own LLVM context, module and engine, as a context
+   can only be used by one thread at a time. Functions which use each
+   other are compiled by the same thread, after the functions they call
+   have been compiled, and the code is handed to the main engine.
+*/
+typedef struct part_t
+{
+   long * fns; /* indices in the batch of the functions it compiles */
+   long num;
+   const char ** names; /* globals they use, defined by the main engine */
+   void ** addrs; /* the addresses of those globals */
+   long refs;
+   unit_t * unit; /* the engine holding the code, or NULL on failure */
+} part_t;
+
+typedef struct ref_t
+{
+   LLVMValueRef val;
+   struct ref_t * next;
+} ref_t;
+
+typedef struct batch_t
+{
+   jit_t * jit;
+   char * bc; /* the main module, as bitcode */
+   long len;
+   LLVMValueRef * fns; /* the functions of the batch */
+   const char ** names; /* and their names */
+   long n;
+   char * uses; /* uses[i*n + j] if function i uses function j */
+   char * reach; /* reach[i*n + j] if function i depends on function j */
+   ref_t ** refs; /* other globals each function uses */
+   void ** code; /* the machine code of each function, once compiled */
+   char * done;
+   part_t * parts; /* the parts of the current wave */
+   int fail; /* the batch can't be compiled in parallel */
+} batch_t;
+
+void batch_compile(jit_t * jit, fn_list_t * fns);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
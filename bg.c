@@ -0,0 +1,236 @@
+/*
+
+Copyright 2012 William Hart. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are
+permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this list of
+      conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice, this list
+      of conditions and the following disclaimer in the documentation and/or other materials
+      provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY William Hart ``AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL William Hart OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "bg.h"
+
+volatile int bg_cancel = 0;
+
+__thread bg_t * bg_self = NULL; /* the job running on this thread */
+
+pthread_mutex_t bg_lock = PTHREAD_MUTEX_INITIALIZER; /* protects job states */
+
+/*
+   Called by jit'd loops when some job has been asked to stop. If it is 
+   the job running on this thread, unwind it. Loop bodies run by the 
+   pool don't stop, but the loop which started them will.
+*/
+void bg_check(void)
+{
+   if (bg_self != NULL && bg_self->cancel && !pool_inside)
+      longjmp(exc, 1);
+}
+
+/*
+   Main function of the thread running a job
+*/
+void * bg_run(void * arg)
+{
+   bg_t * b = (bg_t *) arg;
+   int state;
+
+   context_enter(b->ctx);
+   bg_self = b;
+
+   if (!setjmp(exc))
+   {
+      b->val = exec_call(b->code, b->type, b->ret);
+      state = BG_DONE;
+   } else
+      state = b->cancel ? BG_CANCELLED : BG_FAILED;
+
+   pthread_mutex_lock(&bg_lock);
+   if (b->cancel)
+      bg_cancel--;
+   b->state = state;
+   pthread_mutex_unlock(&bg_lock);
+
+   return NULL;
+}
+
+/*
+   Delete the functions jit'd for a job
+*/
+void bg_delete(bg_t * b)
+{
+   fn_list_t * f;
+
+   LLVMDeleteFunction(b->function);
+
+   for (f = b->copies; f != NULL; f = f->next) /* they may call each other */
+      LLVMReplaceAllUsesWith(f->fn, LLVMGetUndef(LLVMTypeOf(f->fn)));
+
+   for (f = b->copies; f != NULL; f = f->next)
+      LLVMDeleteFunction(f->fn);
+}
+
+/*
+   Jit a statement and start running it on a thread of its own. It 
+   works on copies of the globals it uses, made now, even inside the
+   functions it calls.
+*/
+void bg_start(jit_t * jit, ast_t * ast)
+{
+   bg_t * b = (bg_t *) GC_MALLOC(sizeof(bg_t));
+   bg_t ** p;
+   LLVMValueRef snap;
+   LLVMGenericValueRef args[] = {};
+
+   b->type = ast->type;
+   b->ret = type_to_generic_llvm(jit, ast->type);
+   b->function = exec_background(jit, ast, &snap, &b->copies);
+   b->code = LLVMGetPointerToGlobal(jit->engine, b->function);
+   
+   LLVMRunFunction(jit->engine, snap, 0, args);
+   LLVMDeleteFunction(snap);
+
+   for (p = &ctx->jobs; *p != NULL; p = &(*p)->next)
+      b->id = (*p)->id;
+   b->id++;
+   b->state = BG_RUNNING;
+   b->ctx = ctx;
+   
+   if (pthread_create(&b->thread, NULL, bg_run, b) != 0)
+   {
+      bg_delete(b);
+      exception("Unable to start background job\n");
+   }
+   
+   *p = b;
+
+   printf("[%d]\n", b->id);
+}
+
+/*
+   Ask a job to stop. It does so the next time it goes round a loop.
+*/
+void bg_stop(bg_t * b)
+{
+   pthread_mutex_lock(&bg_lock);
+   if (b->state == BG_RUNNING && !b->cancel)
+   {
+      b->cancel = 1;
+      bg_cancel++;
+   }
+   pthread_mutex_unlock(&bg_lock);
+}
+
+/*
+   Wait for a job to finish and print its value, then forget it
+*/
+void bg_wait(jit_t * jit, bg_t * b)
+{
+   bg_t ** p;
+
+   pthread_join(b->thread, NULL);
+
+   printf("[%d] ", b->id);
+   if (b->state == BG_DONE)
+      print_gen(jit, b->type, b->val);
+   else if (b->state == BG_FAILED)
+      printf("failed");
+   else
+      printf("cancelled");
+   printf("\n");
+
+   for (p = &ctx->jobs; *p != b; p = &(*p)->next) ;
+   *p = b->next;
+
+   bg_delete(b);
+}
+
+/*
+   Find the job with the given number
+*/
+bg_t * bg_find(int id)
+{
+   bg_t * b;
+
+   for (b = ctx->jobs; b != NULL; b = b->next)
+      if (b->id == id)
+         return b;
+
+   printf("No such job [%d]\n", id);
+   
+   return NULL;
+}
+
+/*
+   Stop all jobs, e.g. on exit
+*/
+void bg_cleanup(jit_t * jit)
+{
+   bg_t * b;
+
+   for (b = ctx->jobs; b != NULL; b = b->next)
+      bg_stop(b);
+
+   while (ctx->jobs != NULL)
+      bg_wait(jit, ctx->jobs);
+}
+
+/*
+   Handle a REPL command, e.g. :wait 1. Return 1 if the command was
+   recognised, otherwise 0.
+*/
+int bg_command(jit_t * jit, const char * cmd)
+{
+   char word[32];
+   int id, n;
+   bg_t * b;
+   static const char * states[] = { "running", "done", "failed", "cancelled" };
+
+   if (sscanf(cmd, "%31s", word) != 1)
+      return 0;
+
+   n = sscanf(cmd + strlen(word), "%d", &id);
+
+   if (strcmp(word, "jobs") == 0)
+   {
+      pthread_mutex_lock(&bg_lock);
+      if (ctx->jobs == NULL)
+         printf("No jobs, start one with <expression> &\n");
+      for (b = ctx->jobs; b != NULL; b = b->next)
+         printf("[%d] %s\n", b->id, states[b->state]);
+      pthread_mutex_unlock(&bg_lock);
+   } else if (strcmp(word, "wait") == 0)
+   {
+      if (n != 1) /* wait for all of them */
+      {
+         while (ctx->jobs != NULL)
+            bg_wait(jit, ctx->jobs);
+      } else if ((b = bg_find(id)) != NULL)
+         bg_wait(jit, b);
+   } else if (strcmp(word, "cancel") == 0)
+   {
+      if (n != 1)
+         printf("Usage: :cancel <job>\n");
+      else if ((b = bg_find(id)) != NULL)
+         bg_stop(b);
+   } else
+      return 0;
+
+   return 1;
+}
@@ -0,0 +1,81 @@
+/*
+
+Copyright 2012 William Hart. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are
+permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this list of
+      conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice, this list
+      of conditions and the following disclaimer in the documentation and/or other materials
+      provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY William Hart ``AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL William Hart OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "thread.h"
+
+#include "exception.h"
+#include "backend.h"
+
+#ifndef BG_H
+#define BG_H
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#define BG_RUNNING 0
+#define BG_DONE 1
+#define BG_FAILED 2 /* an exception was raised */
+#define BG_CANCELLED 3
+
+/*
+   An expression run in the background, e.g. f(n) &. Statements such
+   as loops can be run in the background by calling a function.
+*/
+typedef struct bg_t
+{
+   int id; /* job number shown to the user */
+   int state;
+   type_t * type; /* type of the value of the statement */
+   LLVMValueRef function; /* function which runs the statement */
+   fn_list_t * copies; /* copies of the functions it calls */
+   void * code; /* its machine code */
+   LLVMTypeRef ret; /* return type of the function */
+   LLVMGenericValueRef val; /* the value, once the job is done */
+   volatile int cancel; /* the job has been asked to stop */
+   context_t * ctx; /* the engine which started the job */
+   pthread_t thread;
+   struct bg_t * next;
+} bg_t;
+
+extern volatile int bg_cancel; /* number of jobs asked to stop */
+
+void bg_check(void);
+
+void bg_start(jit_t * jit, ast_t * ast);
+
+void bg_cleanup(jit_t * jit);
+
+int bg_command(jit_t * jit, const char * cmd);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
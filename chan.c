@@ -0,0 +1,255 @@
+/*
+
+Copyright 2012 William Hart. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are
+permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this list of
+      conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice, this list
+      of conditions and the following disclaimer in the documentation and/or other materials
+      provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY William Hart ``AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL William Hart OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "chan.h"
+
+/*
+   Create a channel with room for cap values of the given size in bytes
+*/
+chan_t * chan_new(long size, long cap)
+{
+   chan_t * c;
+
+   if (cap <= 0)
+      exception("Channel capacity must be positive\n");
+
+   c = (chan_t *) GC_MALLOC(sizeof(chan_t));
+   c->ring = (char *) GC_MALLOC(size*cap); /* values may hold pointers */
+   c->size = size;
+   c->cap = cap;
+
+   pthread_mutex_init(&c->lock, NULL);
+   pthread_cond_init(&c->cond, NULL);
+   pthread_mutex_init(&c->send.lock, NULL);
+   pthread_cond_init(&c->send.idle, NULL);
+   pthread_mutex_init(&c->recv.lock, NULL);
+   pthread_cond_init(&c->recv.idle, NULL);
+
+   return c;
+}
+
+/*
+   The owner of an end has stopped accessing the ring without the lock.
+   If the end has become shared, a thread may be waiting for that.
+*/
+void chan_idle(chan_end_t * e)
+{
+   __sync_synchronize();
+   e->active = 0;
+   __sync_synchronize();
+   
+   if (e->shared)
+   {
+      pthread_mutex_lock(&e->lock);
+      pthread_cond_broadcast(&e->idle);
+      pthread_mutex_unlock(&e->lock);
+   }
+}
+
+/*
+   Start an operation on one end of a channel. Returns 1 if the owner
+   of the end may go straight to the ring, otherwise 0 with the lock of
+   the end held. The owner marks itself active before checking that
+   the end isn't shared, and a thread sharing the end marks it shared 
+   before sleeping until the owner is inactive, so at most one thread
+   can be using the end at a time.
+*/
+int chan_enter(chan_end_t * e)
+{
+   pthread_t self = pthread_self();
+
+   if (!e->owned) /* the first thread to use the end owns it */
+   {
+      pthread_mutex_lock(&e->lock);
+      if (!e->owned)
+      {
+         e->owner = self;
+         __sync_synchronize();
+         e->owned = 1;
+      }
+      pthread_mutex_unlock(&e->lock);
+   }
+
+   if (!e->shared && pthread_equal(e->owner, self))
+   {
+      e->active = 1;
+      __sync_synchronize();
+      if (!e->shared)
+         return 1;
+      chan_idle(e);
+   }
+
+   pthread_mutex_lock(&e->lock);
+   if (!e->shared)
+   {
+      e->shared = 1;
+      __sync_synchronize();
+   }
+   
+   while (e->active) /* let the owner finish */
+      pthread_cond_wait(&e->idle, &e->lock);
+
+   return 0;
+}
+
+/*
+   Finish an operation on one end of a channel
+*/
+void chan_leave(chan_end_t * e, int fast)
+{
+   if (fast)
+      chan_idle(e);
+   else
+      pthread_mutex_unlock(&e->lock);
+}
+
+/*
+   Sleep until another thread sends, receives or closes, unless *count
+   has already moved on from old. We count ourselves as waiting before
+   checking, and wakers check the count after making their change, so 
+   a wake up can't be missed. The end e, entered as given by *fast, is
+   left while we sleep, so that other threads using it aren't held up,
+   and entered again afterwards. Callers must check again on return.
+*/
+void chan_wait(chan_t * c, chan_end_t * e, int * fast, volatile long * count, long old)
+{
+   if (*fast)
+      chan_idle(e);
+
+   pthread_mutex_lock(&c->lock);
+   
+   c->waiting++;
+   __sync_synchronize();
+   
+   if (*count == old && !c->closed)
+      pthread_cond_wait(&c->cond, &c->lock);
+   
+   c->waiting--;
+   
+   pthread_mutex_unlock(&c->lock);
+
+   if (*fast)
+      *fast = chan_enter(e);
+}
+
+/*
+   Wake any threads sleeping on a channel after a change to it
+*/
+void chan_wake(chan_t * c)
+{
+   __sync_synchronize();
+   
+   if (c->waiting)
+   {
+      pthread_mutex_lock(&c->lock);
+      pthread_cond_broadcast(&c->cond);
+      pthread_mutex_unlock(&c->lock);
+   }
+}
+
+/*
+   Move the value pointed to by val into the channel, waiting for room
+   if the channel is full. It is an error to send on a closed channel.
+*/
+void chan_send(chan_t * c, void * val)
+{
+   int fast = chan_enter(&c->send);
+   long tail;
+
+   while ((tail = c->tail) - c->head == c->cap && !c->closed)
+      chan_wait(c, &c->send, &fast, &c->head, tail - c->cap);
+
+   if (c->closed)
+   {
+      chan_leave(&c->send, fast);
+      exception("Send on closed channel\n");
+   }
+
+   memcpy(c->ring + (tail % c->cap)*c->size, val, c->size);
+   
+   __sync_synchronize(); /* the value is written before it is published */
+   c->tail = tail + 1;
+   
+   chan_wake(c);
+   chan_leave(&c->send, fast);
+}
+
+/*
+   Move the next value in the channel to val, waiting for one if the
+   channel is empty. Returns 0 if the channel is closed and empty.
+*/
+int chan_recv(chan_t * c, void * val)
+{
+   int fast = chan_enter(&c->recv), closed;
+   long head;
+   char * entry;
+
+   while (1)
+   {
+      head = c->head;
+      closed = c->closed;
+      __sync_synchronize(); /* everything sent before the close is visible */
+      
+      if (c->tail != head)
+         break;
+
+      if (closed)
+      {
+         chan_leave(&c->recv, fast);
+         return 0;
+      }
+
+      chan_wait(c, &c->recv, &fast, &c->tail, head);
+   }
+
+   __sync_synchronize();
+   
+   entry = c->ring + (head % c->cap)*c->size;
+   memcpy(val, entry, c->size);
+   memset(entry, 0, c->size); /* don't keep the value alive for the GC */
+   
+   __sync_synchronize(); /* the entry is free before it is handed back */
+   c->head = head + 1;
+   
+   chan_wake(c);
+   chan_leave(&c->recv, fast);
+
+   return 1;
+}
+
+/*
+   Close a channel. Values already sent can still be received.
+*/
+void chan_close(chan_t * c)
+{
+   c->closed = 1;
+   __sync_synchronize();
+
+   pthread_mutex_lock(&c->lock);
+   pthread_cond_broadcast(&c->cond);
+   pthread_mutex_unlock(&c->lock);
+}
+
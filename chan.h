@@ -0,0 +1,89 @@
+/*
+
+Copyright 2012 William Hart. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are
+permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this list of
+      conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice, this list
+      of conditions and the following disclaimer in the documentation and/or other materials
+      provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY William Hart ``AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL William Hart OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "exception.h"
+#include "thread.h"
+
+#ifndef CHAN_H
+#define CHAN_H
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+/*
+   One end of a channel. While only one thread has used the end it 
+   goes straight to the ring. Once a second thread uses it, the end is
+   shared and all operations on it take its lock.
+*/
+typedef struct chan_end_t
+{
+   pthread_mutex_t lock;
+   pthread_cond_t idle; /* signalled when the owner stops being active */
+   volatile pthread_t owner; /* first thread to use this end */
+   volatile int owned; /* owner is set */
+   volatile int shared; /* more than one thread has used this end */
+   volatile int active; /* owner is accessing the ring without the lock */
+} chan_end_t;
+
+/*
+   A bounded channel of cap entries of the given size in bytes. Values
+   are moved into the ring by send and out of it by recv. The counts
+   head and tail only increase, the entry for a count being at index
+   count % cap. The ring is empty when they are equal and full when 
+   they differ by cap.
+*/
+typedef struct chan_t
+{
+   char * ring;
+   long size, cap;
+   volatile long head; /* written only by the receiving end */
+   volatile long tail; /* written only by the sending end */
+   volatile int closed;
+   volatile int waiting; /* threads sleeping on cond */
+   chan_end_t send, recv;
+   pthread_mutex_t lock; /* protects sleeping on cond */
+   pthread_cond_t cond; /* signalled on every send, recv and close */
+} chan_t;
+
+chan_t * chan_new(long size, long cap);
+
+void chan_send(chan_t * c, void * val);
+
+int chan_recv(chan_t * c, void * val);
+
+void chan_close(chan_t * c);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
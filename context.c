@@ -0,0 +1,93 @@
+/*
+
+Copyright 2012 William Hart. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are
+permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this list of
+      conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice, this list
+      of conditions and the following disclaimer in the documentation and/or other materials
+      provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY William Hart ``AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL William Hart OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "ast.h"
+#include "symbol.h"
+#include "types.h"
+#include "environment.h"
+#include "inference.h"
+#include "ffi.h"
+#include "backend.h"
+#include "context.h"
+
+__thread context_t * ctx = NULL;
+
+/*
+   Create a new engine which reads its input from the given file. The
+   context is a root for the collector, which doesn't look in thread 
+   local storage, so it must be freed with context_free.
+*/
+context_t * context_new(FILE * in)
+{
+   context_t * c = (context_t *) GC_MALLOC_UNCOLLECTABLE(sizeof(context_t));
+   context_t * prev = context_enter(c);
+   
+   c->in = in;
+
+   ast_init();
+   sym_tab_init();
+   types_init();
+   scope_init();
+   loc_tab_init();
+   intrinsics_init();
+   c->jit = llvm_init();
+   ZZ_init(c->jit);
+   libc_init(c->jit);
+   nmod_type_init(c->jit);
+   fmpz_mat_type_init(c->jit);
+   poly_type_init(c->jit);
+
+   context_enter(prev);
+
+   return c;
+}
+
+/*
+   Destroy an engine. It must not be the current context of any thread.
+*/
+void context_free(context_t * c)
+{
+   context_t * prev = context_enter(c);
+   
+   llvm_cleanup(c->jit);
+   
+   context_enter(prev);
+   
+   GC_FREE(c);
+}
+
+/*
+   Make the given context current on this thread and return the one 
+   that was current before
+*/
+context_t * context_enter(context_t * c)
+{
+   context_t * prev = ctx;
+
+   ctx = c;
+
+   return prev;
+}
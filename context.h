@@ -0,0 +1,107 @@
+/*
+
+Copyright 2012 William Hart. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are
+permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this list of
+      conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice, this list
+      of conditions and the following disclaimer in the documentation and/or other materials
+      provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY William Hart ``AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL William Hart OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include <stdio.h>
+#include <setjmp.h>
+
+#ifndef CONTEXT_H
+#define CONTEXT_H
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+/*
+   All the state of a single Bacon engine: the symbol table, scopes,
+   types, the jit and so on. Each engine has its own context, so that
+   independent programs can be compiled and run in different threads
+   of the same process. 
+*/
+typedef struct context_t
+{
+   FILE * in; /* source of input for the parser */
+   int eat_eol; /* parser is inside parentheses */
+   
+   struct sym_t ** sym_tab;
+   struct env_t * current_scope;
+   struct ast_t * root; /* last statement parsed */
+   struct ast_t * ast_nil;
+
+   struct type_t * t_nil;
+   struct type_t * t_bool;
+   struct type_t * t_ZZ;
+   struct type_t * t_nmod;
+   struct type_t * t_fmpz_mat;
+   struct type_t * t_fmpz_poly;
+   struct type_t * t_nmod_poly;
+   struct type_t * t_int;
+   struct type_t * t_uint;
+   struct type_t * t_double;
+   struct type_t * t_string;
+   struct type_t * t_char;
+   struct type_t * t_finalizer;
+   struct type_t * t_assignment;
+
+   struct type_node_t * tuple_type_list;
+   struct type_node_t * array_type_list;
+   struct type_node_t * future_type_list;
+   struct type_node_t * chan_type_list;
+   struct type_node_t * ref_type_list;
+
+   struct esc_t * esc_local; /* array constructors which may go on the stack */
+   struct esc_t * esc_escaped; /* bindings seen to escape the current function */
+
+   struct rng_t * rng_list; /* range analysis */
+   struct env_t * rng_fn_scope;
+   int rng_pass;
+   int rng_changed;
+
+   struct loc_t ** loc_tab; /* backend */
+   struct descr_t * descr_list;
+   struct const_t ** const_tab; /* pool of ZZ and string literals */
+   struct jit_t * jit;
+   struct pipe_t * pipe; /* set if statements run on their own thread */
+   struct bg_t * jobs; /* background statements, oldest first */
+   struct eager_t * eager; /* set if functions are jit'd as soon as defined */
+} context_t;
+
+/*
+   The context of the engine running on this thread. Worker threads
+   of the pool take on the context of the thread that gave them work.
+*/
+extern __thread context_t * ctx;
+
+context_t * context_new(FILE * in);
+
+void context_free(context_t * c);
+
+context_t * context_enter(context_t * c);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
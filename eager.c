@@ -0,0 +1,247 @@
+/*
+
+Copyright 2012 William Hart. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are
+permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this list of
+      conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice, this list
+      of conditions and the following disclaimer in the documentation and/or other materials
+      provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY William Hart ``AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL William Hart OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "eager.h"
+
+__thread int eager_inside = 0;
+
+/*
+   Wait for functions to jit and take all of them off the queue, so
+   that a batch of definitions, e.g. pasted in, is jit'd together. 
+   Returns NULL once the compile thread has been stopped.
+*/
+type_node_t * eager_next(eager_t * e)
+{
+   type_node_t * n;
+
+   pthread_mutex_lock(&e->lock);
+   
+   while (e->head == NULL && !e->stop)
+      pthread_cond_wait(&e->cond, &e->lock);
+
+   if (e->stop)
+      n = NULL;
+   else
+   {
+      n = e->head;
+      e->head = e->tail = NULL;
+   }
+
+   pthread_mutex_unlock(&e->lock);
+
+   return n;
+}
+
+/*
+   Remember a function which couldn't be jit'd yet
+*/
+void eager_fail(eager_t * e, type_t * fn)
+{
+   type_node_t * n = (type_node_t *) GC_MALLOC(sizeof(type_node_t));
+
+   n->type = fn;
+
+   pthread_mutex_lock(&e->lock);
+   n->next = e->failed;
+   e->failed = n;
+   pthread_mutex_unlock(&e->lock);
+}
+
+/*
+   Jit a function which has been defined but not yet called, leaving
+   it to be optimised with the rest of the batch. The caller must hold
+   the jit. Returns 0 if an exception was raised, in which case 
+   everything done towards it has been undone. The functions defined
+   by a statement being jit'd by another thread are left alone.
+*/
+int eager_jit(jit_t * jit, type_t * fn)
+{
+   env_t * scope_save = ctx->current_scope;
+   LLVMValueRef fn_save = jit->function;
+   LLVMBuilderRef build_save = jit->builder;
+   LLVMBasicBlockRef break_save = jit->breakto;
+   fn_list_t * pending = jit->pending; /* earlier functions of the batch */
+   fn_list_t * defs = jit->defs;
+   bind_t * locals = fn->ast->env->scope;
+
+   jit->defs = NULL;
+
+   if (!setjmp(exc))
+   {
+      inference(fn->ast);
+      exec_fndef(jit, fn->ast, fn);
+      
+      jit->defs = defs;
+
+      return 1;
+   }
+
+   jit_abandon(jit);
+   
+   jit->defs = defs;
+   
+   if (jit->builder != build_save && jit->builder != NULL)
+      LLVMDisposeBuilder(jit->builder);
+   jit->builder = build_save;
+   jit->function = fn_save;
+   jit->breakto = break_save;
+   jit->pending = pending;
+   ctx->current_scope = scope_save;
+   fn->ast->env->scope = locals; /* it will be inferred afresh */
+
+   return 0;
+}
+
+/*
+   Main loop of the compile thread. The passes are run once for each 
+   batch, rather than once per function, as the inliner has to look at
+   the whole module. Machine code for the batch is generated by the 
+   pool, in parallel, or else by the engine here.
+*/
+void * eager_run(void * arg)
+{
+   eager_t * e = (eager_t *) arg;
+   jit_t * jit;
+   type_node_t * n, * done;
+
+   context_enter(e->ctx);
+   jit = ctx->jit;
+   exc_quiet = 1; /* errors are reported if the function is called */
+   eager_inside = 1;
+
+   while ((n = eager_next(e)) != NULL)
+   {
+      jit_lock(jit);
+      
+      for (done = NULL; n != NULL; n = n->next)
+      {
+         type_node_t * d;
+         
+         if (n->type->llvm != NULL) /* jit'd on first call meanwhile */
+            continue;
+
+         if (!eager_jit(jit, n->type))
+         {
+            eager_fail(e, n->type);
+            continue;
+         }
+
+         d = (type_node_t *) GC_MALLOC(sizeof(type_node_t));
+         d->type = n->type;
+         d->next = done;
+         done = d;
+      }
+
+      /* 
+         if a statement is part way through being jit'd, its functions
+         are unfinished, so the batch is optimised along with it
+      */
+      if (jit->compiling)
+         done = NULL;
+      else if (done != NULL)
+         jit_run_passes(jit);
+
+      for ( ; done != NULL; done = done->next)
+         LLVMGetPointerToGlobal(jit->engine, 
+                  LLVMGetNamedFunction(jit->module, done->type->llvm));
+      
+      jit_unlock(jit);
+   }
+
+   return NULL;
+}
+
+/*
+   Start jit'ing the functions of the engine c as soon as they are 
+   defined
+*/
+eager_t * eager_start(context_t * c)
+{
+   eager_t * e = (eager_t *) GC_MALLOC_UNCOLLECTABLE(sizeof(eager_t));
+
+   pthread_mutex_init(&e->lock, NULL);
+   pthread_cond_init(&e->cond, NULL);
+
+   e->ctx = c;
+
+   if (pthread_create(&e->thread, NULL, eager_run, e) != 0)
+      exception("Unable to start compile thread\n");
+
+   c->eager = e;
+
+   return e;
+}
+
+/*
+   Stop the compile thread. Functions it has not got to yet are jit'd
+   when first called, as usual.
+*/
+void eager_stop(eager_t * e)
+{
+   pthread_mutex_lock(&e->lock);
+   e->stop = 1;
+   pthread_cond_broadcast(&e->cond);
+   pthread_mutex_unlock(&e->lock);
+
+   pthread_join(e->thread, NULL);
+
+   e->ctx->eager = NULL;
+
+   pthread_mutex_destroy(&e->lock);
+   pthread_cond_destroy(&e->cond);
+   
+   GC_FREE(e);
+}
+
+/*
+   Queue a newly defined function to be jit'd. Those which failed 
+   before are queued again after it, as it may be what they were 
+   missing. Called while jit'ing the definition.
+*/
+void eager_push(eager_t * e, type_t * fn)
+{
+   type_node_t * n = (type_node_t *) GC_MALLOC(sizeof(type_node_t));
+
+   n->type = fn;
+   n->next = NULL;
+   
+   pthread_mutex_lock(&e->lock);
+   
+   if (e->tail == NULL)
+      e->head = n;
+   else
+      e->tail->next = n;
+   
+   n->next = e->failed;
+   e->failed = NULL;
+   
+   while (n->next != NULL)
+      n = n->next;
+   e->tail = n;
+   
+   pthread_cond_broadcast(&e->cond);
+   pthread_mutex_unlock(&e->lock);
+}
@@ -0,0 +1,71 @@
+/*
+
+Copyright 2012 William Hart. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are
+permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this list of
+      conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice, this list
+      of conditions and the following disclaimer in the documentation and/or other materials
+      provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY William Hart ``AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL William Hart OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "thread.h"
+
+#include "exception.h"
+#include "types.h"
+#include "backend.h"
+
+#ifndef EAGER_H
+#define EAGER_H
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+/*
+   Functions are normally jit'd when first called. In eager mode they
+   are handed to a compile thread as soon as they are defined, which 
+   jits them while the REPL waits for the next statement. Any it can't
+   jit yet, e.g. because they call a function not yet defined, are 
+   tried again after the next definition, and are otherwise left to be
+   jit'd when first called.
+*/
+typedef struct eager_t
+{
+   pthread_t thread; /* the compile thread */
+   pthread_mutex_t lock; /* protects the queue */
+   pthread_cond_t cond; /* signalled when the queue changes */
+   type_node_t * head, * tail; /* functions waiting to be jit'd */
+   type_node_t * failed; /* functions which could not be jit'd yet */
+   int stop; /* the compile thread should exit */
+   context_t * ctx; /* the engine whose functions are jit'd */
+} eager_t;
+
+extern __thread int eager_inside; /* this is the compile thread */
+
+eager_t * eager_start(context_t * c);
+
+void eager_stop(eager_t * e);
+
+void eager_push(eager_t * e, type_t * fn);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -26,21 +26,20 @@ ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "environment.h"
 
-env_t * current_scope;
-
 void scope_init(void)
 {
-   current_scope = (env_t *) GC_MALLOC(sizeof(env_t));
+   ctx->current_scope = (env_t *) GC_MALLOC(sizeof(env_t));
 }
 
 void intrinsics_init(void)
 {
    int i;
+   bind_t * bind;
 
    type_t ** args = GC_MALLOC(2*sizeof(type_t *));
    type_t ** fns = GC_MALLOC(3*sizeof(type_t *));
    
-   type_t * type_list[3] = { t_int, t_uint, t_double };
+   type_t * type_list[3] = { ctx->t_int, ctx->t_uint, ctx->t_double };
 
    for (i = 0; i < 3; i++)
    {
@@ -58,11 +57,27 @@ void intrinsics_init(void)
    bind_generic(sym_lookup("/"), generic_type(3, fns));
    bind_generic(sym_lookup("%"), generic_type(3, fns));
 
+   for (i = 0; i < 3; i++) /* exponents are uint, except for double */
+   {
+      args[0] = type_list[i];
+      args[1] = (type_list[i] == ctx->t_double ? ctx->t_double : ctx->t_uint);
+      
+      fns[i] = fn_type(type_list[i], 2, args);
+      fns[i]->intrinsic = 1;
+   }
+
+   bind = bind_generic(sym_lookup("^"), generic_type(3, fns));
+
+   args[1] = args[0] = ctx->t_int; /* int exponents may be negative */
+   fns[0] = fn_type(ctx->t_int, 2, args);
+   fns[0]->intrinsic = 1;
+   generic_insert(bind->type, fns[0]);
+
    for (i = 0; i < 3; i++)
    {
       args[1] = args[0] = type_list[i];
       
-      fns[i] = fn_type(t_bool, 2, args);
+      fns[i] = fn_type(ctx->t_bool, 2, args);
       fns[i]->intrinsic = 1;
    }
 
@@ -77,30 +92,30 @@ void intrinsics_init(void)
    {
       args[1] = args[0] = type_list[i];
       
-      fns[i] = fn_type(t_nil, 2, args);
+      fns[i] = fn_type(ctx->t_nil, 2, args);
       fns[i]->intrinsic = 1;
    }
 
-   t_assignment = generic_type(3, fns);
-   bind_generic(sym_lookup("="), t_assignment);
+   ctx->t_assignment = generic_type(3, fns);
+   bind_generic(sym_lookup("="), ctx->t_assignment);
    
-   bind_symbol(sym_lookup("nil"), t_nil, NULL);
-   bind_symbol(sym_lookup("int"), t_int, NULL);
-   bind_symbol(sym_lookup("uint"), t_uint, NULL);
-   bind_symbol(sym_lookup("bool"), t_bool, NULL);
-   bind_symbol(sym_lookup("double"), t_double, NULL);
-   bind_symbol(sym_lookup("string"), t_string, NULL);
-   bind_symbol(sym_lookup("char"), t_char, NULL);
+   bind_symbol(sym_lookup("nil"), ctx->t_nil, NULL);
+   bind_symbol(sym_lookup("int"), ctx->t_int, NULL);
+   bind_symbol(sym_lookup("uint"), ctx->t_uint, NULL);
+   bind_symbol(sym_lookup("bool"), ctx->t_bool, NULL);
+   bind_symbol(sym_lookup("double"), ctx->t_double, NULL);
+   bind_symbol(sym_lookup("string"), ctx->t_string, NULL);
+   bind_symbol(sym_lookup("char"), ctx->t_char, NULL);
 }
 
 bind_t * bind_generic(sym_t * sym, type_t * type)
 {
-   bind_t * scope = current_scope->scope;
+   bind_t * scope = ctx->current_scope->scope;
    bind_t * b = (bind_t *) GC_MALLOC(sizeof(bind_t));
    b->sym = sym;
    b->type = type;
    b->next = scope;
-   current_scope->scope = b;
+   ctx->current_scope->scope = b;
    return b;
 }
 
@@ -112,19 +127,19 @@ void generic_insert(type_t * gen, type_t * fn)
 
 bind_t * bind_symbol(sym_t * sym, type_t * type, char * llvm)
 {
-   bind_t * scope = current_scope->scope;
+   bind_t * scope = ctx->current_scope->scope;
    bind_t * b = (bind_t *) GC_MALLOC(sizeof(bind_t));
    b->sym = sym;
    b->type = type;
    b->llvm = llvm;
    b->next = scope;
-   current_scope->scope = b;
+   ctx->current_scope->scope = b;
    return b;
 }
 
 bind_t * find_symbol(sym_t * sym)
 {
-   env_t * s = current_scope;
+   env_t * s = ctx->current_scope;
    bind_t * b;
 
    while (s != NULL)
@@ -146,7 +161,7 @@ bind_t * find_symbol(sym_t * sym)
 
 bind_t * find_symbol_in_current_scope(sym_t * sym)
 {
-   bind_t * b = current_scope->scope;
+   bind_t * b = ctx->current_scope->scope;
  
    while (b != NULL)
    {
@@ -161,19 +176,19 @@ bind_t * find_symbol_in_current_scope(sym_t * sym)
 env_t * scope_up(void)
 {
    env_t * env = (env_t *) GC_MALLOC(sizeof(env_t));
-   env->next = current_scope;
-   current_scope = env;
-   return current_scope;
+   env->next = ctx->current_scope;
+   ctx->current_scope = env;
+   return ctx->current_scope;
 }
 
 void scope_down(void)
 {
-   current_scope = current_scope->next;
+   ctx->current_scope = ctx->current_scope->next;
 }
 
 int scope_is_global(bind_t * bind)
 {
-   env_t * s = current_scope;
+   env_t * s = ctx->current_scope;
    while (s->next != NULL)
       s = s->next;
 
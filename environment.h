@@ -28,6 +28,7 @@ ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "symbol.h"
 #include "types.h"
+#include "context.h"
 
 #ifndef ENVIRONMENT_H
 #define ENVIRONMENT_H
@@ -43,7 +44,8 @@ typedef struct bind_t
    type_t * type;
    sym_t * sym;
    char * llvm;
-   LLVMValueRef llvm_val;
+   LLVMValueRef llvm_val; /* value of a global constant, once known */
+   int immutable; /* bound with const or let */
    struct bind_t * next;
 } bind_t;
 
@@ -53,14 +55,14 @@ typedef struct env_t
    struct env_t * next;
 } env_t;
 
-extern env_t * current_scope;
-
 void scope_init(void);
 
 void intrinsics_init(void);
 
 bind_t * bind_generic(sym_t * sym, type_t * type);
 
+void generic_insert(type_t * gen, type_t * fn);
+
 bind_t * bind_symbol(sym_t * sym, type_t * type, char * llvm);
 
 bind_t * find_symbol(sym_t * sym);
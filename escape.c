@@ -0,0 +1,236 @@
+/*
+
+Copyright 2012, 2014 William Hart. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are
+permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this list of
+      conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice, this list
+      of conditions and the following disclaimer in the documentation and/or other materials
+      provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY William Hart ``AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL William Hart OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "escape.h"
+
+/*
+   Add an entry for the given binding and array constructor to the 
+   front of a list
+*/
+esc_t * esc_insert(esc_t * list, bind_t * bind, ast_t * ast)
+{
+   esc_t * e = (esc_t *) GC_MALLOC(sizeof(esc_t));
+   e->bind = bind;
+   e->ast = ast;
+   e->next = list;
+   return e;
+}
+
+int esc_find(esc_t * list, bind_t * bind)
+{
+   while (list != NULL)
+   {
+      if (list->bind == bind)
+         return 1;
+      list = list->next;
+   }
+
+   return 0;
+}
+
+/*
+   Record that the value bound to the given identifier may outlive
+   the function, e.g. because it is returned or stored elsewhere.
+*/
+void esc_mark(ast_t * a)
+{
+   bind_t * bind = find_symbol(a->sym);
+
+   if (bind != NULL)
+      ctx->esc_escaped = esc_insert(ctx->esc_escaped, bind, NULL);
+}
+
+/*
+   Return the number of entries given by the literal len if an array
+   of that length may be placed on the stack, otherwise -1
+*/
+long esc_length(ast_t * len)
+{
+   long n;
+   
+   if (len->tag != AST_INT)
+      return -1;
+
+   errno = 0;
+   n = strtol(len->sym->name, NULL, 10);
+   if (errno != 0 || n < 0 || n > LOCAL_ARRAY_MAX)
+      return -1;
+
+   return n;
+}
+
+/*
+   Return 1 if the assignment a initialises a local identifier with a
+   freshly constructed array of small constant length.
+*/
+int esc_candidate(ast_t * a)
+{
+   ast_t * id = a->child;
+   ast_t * expr = id->next;
+   ast_t * len;
+   bind_t * bind;
+
+   if (id->tag != AST_LIDENT || expr->tag != AST_ARRAY_CONSTRUCTOR)
+      return 0;
+
+   len = expr->child->next; /* expression giving number of elements */
+   if (esc_length(len) < 0)
+      return 0;
+
+   bind = find_symbol(id->sym);
+   if (bind == NULL || scope_is_global(bind))
+      return 0;
+
+   if (esc_find(ctx->esc_local, bind)) /* array is constructed more than once */
+      ctx->esc_escaped = esc_insert(ctx->esc_escaped, bind, NULL);
+   else
+      ctx->esc_local = esc_insert(ctx->esc_local, bind, expr);
+
+   return 1;
+}
+
+void esc_list(ast_t * a, int escapes);
+
+/*
+   Walk the AST looking for places where identifiers escape. If the
+   escapes flag is set, the value of the expression a may outlive the
+   function (it is returned, or stored by value in a tuple or data type).
+*/
+void esc_walk(ast_t * a, int escapes)
+{
+   env_t * scope_save;
+   ast_t * a1;
+
+   switch (a->tag)
+   {
+   case AST_IDENT:
+      if (escapes)
+         esc_mark(a);
+      break;
+   case AST_LIDENT: /* reassignment may realloc the array */
+      esc_mark(a);
+      break;
+   case AST_BLOCK:
+      scope_save = ctx->current_scope;
+      ctx->current_scope = a->env; /* load block scope */
+      esc_list(a->child, escapes);
+      ctx->current_scope = scope_save;
+      break;
+   case AST_FOR_STMT:
+   case AST_PARFOR_STMT:
+      a1 = a->child->next; /* start of range */
+      esc_walk(a1, 0);
+      esc_walk(a1->next, 0);
+      scope_save = ctx->current_scope;
+      ctx->current_scope = a->env; /* load loop scope */
+      esc_list(a1->next->next, escapes);
+      ctx->current_scope = scope_save;
+      break;
+   case AST_ASSIGNMENT:
+      a1 = a->child; /* Lvalue */
+      if (esc_candidate(a))
+         esc_walk(a1->next->child->next, 0); /* number of elements */
+      else
+      {
+         esc_walk(a1, 0);
+         if (a1->tag == AST_LTUPLE) /* tuple assignment moves values */
+            esc_walk(a1->next, 1);
+         else /* other assignments copy arrays */
+            esc_walk(a1->next, 0);
+      }
+      break;
+   case AST_RETURN:
+      esc_walk(a->child, 1);
+      break;
+   case AST_TUPLE:
+   case AST_LTUPLE:
+      esc_list(a->child, 1);
+      break;
+   case AST_APPL:
+   case AST_LAPPL:
+      a1 = a->child; /* function or constructor */
+      esc_walk(a1, 0);
+      if (a1->type->tag == GENERIC) /* functions get a copy of value arguments */
+      {
+         type_t * fn = find_prototype(a1->type, a1->next);
+         int i = 0;
+
+         for (a1 = a1->next; a1 != NULL; a1 = a1->next, i++)
+            esc_walk(a1, fn->args[i]->tag == REF);
+      } else /* constructors and swap take values as is */
+         esc_list(a1->next, 1);
+      break;
+   case AST_SLOT:
+   case AST_LSLOT:
+   case AST_LOCN:
+   case AST_LLOCN: /* entries are loaded or copied out */
+      esc_list(a->child, 0);
+      break;
+   case AST_ARRAY_CONSTRUCTOR:
+      esc_walk(a->child->next, 0);
+      break;
+   case AST_FN_STMT:
+   case AST_FN_BODY:
+   case AST_DATA_STMT:
+      break;
+   default:
+      esc_list(a->child, escapes);
+   }
+}
+
+void esc_list(ast_t * a, int escapes)
+{
+   while (a != NULL)
+   {
+      esc_walk(a, escapes);
+      a = a->next;
+   }
+}
+
+/*
+   Given the (already inferred) AST of a function body, find arrays
+   which can't outlive the function call and retag their constructors
+   so the backend allocates them on the stack rather than with the GC.
+   Assumes current_scope is the scope of the function.
+*/
+void escape_analysis(ast_t * a)
+{
+   esc_t * e;
+
+   ctx->esc_local = NULL;
+   ctx->esc_escaped = NULL;
+
+   esc_walk(a, 0);
+
+   for (e = ctx->esc_local; e != NULL; e = e->next)
+   {
+      if (!esc_find(ctx->esc_escaped, e->bind))
+         e->ast->tag = AST_LOCAL_ARRAY_CONSTRUCTOR;
+   }
+
+   ctx->esc_local = NULL;
+   ctx->esc_escaped = NULL;
+}
@@ -26,12 +26,22 @@ ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "exception.h"
 
-jmp_buf exc;
+__thread jmp_buf exc;
+
+__thread int exc_quiet = 0;
+
+__thread const char * exc_msg = NULL;
+
 
 void exception(const char * err)
 {
-   fflush(stdout);
-   fprintf(stderr, "%s\n", err);
+   if (!exc_quiet)
+   {
+      fflush(stdout);
+      fprintf(stderr, "%s\n", err);
+   }
+
+   exc_msg = err;
    
    longjmp(exc, 1);
 }
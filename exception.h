@@ -26,6 +26,7 @@ ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <stdio.h>
 #include <setjmp.h>
+#include "context.h"
 
 #ifndef EXCEPTION_H
 #define EXCEPTION_H
@@ -34,7 +35,11 @@ ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  extern "C" {
 #endif
 
-extern jmp_buf exc;
+extern __thread jmp_buf exc; /* where exceptions on this thread return to */
+
+extern __thread int exc_quiet; /* don't report exceptions on this thread */
+
+extern __thread const char * exc_msg; /* message of the last exception on this thread */
 
 void exception(const char * err);
 
@@ -26,7 +26,8 @@ ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "ffi.h"
 
-type_t * new_foreign_type(sym_t * sym, const char ** fields, type_t ** types, int num_args)
+type_t * new_foreign_type(jit_t * jit, sym_t * sym, 
+                          const char ** fields, type_t ** types, int num_args)
 {
    type_t * t;
    
@@ -38,9 +39,15 @@ type_t * new_foreign_type(sym_t * sym, const char ** fields, type_t ** types, in
 
    t = data_type(num_args, types, sym, slots, 0, NULL); /* the new type being created */ 
    
-   char * llvm = serialise(sym->name);
-   
-   LLVMTypeRef str = LLVMStructCreateNamed(LLVMGetGlobalContext(), llvm);
+   char * llvm = GC_MALLOC(strlen(sym->name) + 8);
+   sprintf(llvm, "struct.%s", sym->name);
+
+   /* the runtime bitcode may already give the layout of the type */
+   if (LLVMGetTypeByName(jit->module, llvm) == NULL)
+   {
+      llvm = serialise(sym->name);
+      LLVMStructCreateNamed(jit->context, llvm);
+   }
                 
    t->llvm = llvm;
    
@@ -54,6 +61,9 @@ void new_foreign_function(jit_t * jit, const char * name, type_t * ret,
    LLVMTypeRef * fn_args = GC_malloc(num*sizeof(LLVMTypeRef));
    LLVMTypeRef fn_ret, fn_type;
 
+   if (LLVMGetNamedFunction(jit->module, name) != NULL) /* e.g. from the runtime bitcode */
+      return;
+
    for (i = 0; i < num; i++)
       fn_args[i] = type_to_llvm(jit, args[i]);
 
@@ -63,47 +73,298 @@ void new_foreign_function(jit_t * jit, const char * name, type_t * ret,
    LLVMAddFunction(jit->module, name, fn_type);
 }
 
+/*
+   Register a foreign function implemented in C under the given
+   name and map it into the jit
+*/
+void map_foreign_function(jit_t * jit, const char * name, void * fn, 
+                          type_t * ret, type_t ** args, int num)
+{
+   LLVMValueRef f;
+
+   new_foreign_function(jit, name, ret, args, num);
+   
+   f = LLVMGetNamedFunction(jit->module, name);
+   if (LLVMIsDeclaration(f)) /* otherwise the jit compiles the bitcode version */
+      LLVMAddGlobalMapping(jit->engine, f, fn);
+}
+
+/*
+   Insert a function with the given prototype into the generic bound
+   to name, creating the generic if needed
+*/
+void insert_foreign_generic(const char * name, const char * llvm, 
+                            type_t * ret, type_t ** args, int num)
+{
+   type_t * f1 = fn_type(ret, num, args);
+   bind_t * bind = find_symbol(sym_lookup(name));
+
+   f1->intrinsic = 1;
+   f1->llvm = (char *) llvm;
+   
+   if (bind != NULL && bind->type->tag == GENERIC)
+      generic_insert(bind->type, f1);
+   else
+      bind_generic(sym_lookup(name), generic_type(1, &f1));
+}
+
+/*
+   Parse a type in a foreign signature, e.g. ref array[ZZ]
+*/
+type_t * parse_foreign_type(const char ** s)
+{
+   char name[64];
+   int len = 0;
+   bind_t * bind;
+   type_t * t;
+
+   while (**s == ' ')
+      (*s)++;
+
+   while ((isalnum(**s) || **s == '_') && len < 63)
+      name[len++] = *(*s)++;
+   name[len] = '\0';
+
+   while (**s == ' ')
+      (*s)++;
+
+   if (strcmp(name, "ref") == 0)
+      return reference_type(parse_foreign_type(s));
+
+   if (strcmp(name, "array") == 0 && **s == '[')
+   {
+      (*s)++;
+      t = array_type(parse_foreign_type(s));
+      if (**s != ']')
+         exception("Malformed array type in foreign binding\n");
+      (*s)++;
+      return t;
+   }
+
+   bind = find_symbol(sym_lookup(name));
+   if (bind == NULL)
+      exception("Unknown type in foreign binding\n");
+   
+   t = bind->type; /* data types are bound to their constructor */
+   return t->tag == CONSTRUCTOR ? t->ret : t;
+}
+
+/*
+   Declare the functions in a binding table, terminated by an entry 
+   with NULL name, and insert them into their generics
+*/
+void foreign_bind(jit_t * jit, const foreign_t * tab)
+{
+   type_t * args[FOREIGN_MAX_ARGS + 1];
+   type_t * ret;
+   const char * s;
+   int num, out;
+
+   for ( ; tab->name != NULL; tab++)
+   {
+      s = tab->sig;
+      ret = parse_foreign_type(&s);
+      if (*s++ != '(')
+         exception("Malformed foreign signature\n");
+
+      out = (ret->tag == DATA); /* result is written through first arg */
+      if (out)
+         args[0] = reference_type(ret);
+
+      num = 0;
+      while (*s == ' ')
+         s++;
+
+      while (*s != ')')
+      {
+         if (num == FOREIGN_MAX_ARGS)
+            exception("Too many arguments in foreign signature\n");
+         
+         args[out + num++] = parse_foreign_type(&s);
+         
+         if (*s == ',')
+            s++;
+         else if (*s != ')')
+            exception("Malformed foreign signature\n");
+      }
+
+      if (tab->fn != NULL)
+         map_foreign_function(jit, tab->llvm, tab->fn, out ? ctx->t_nil : ret, args, out + num);
+      else
+         new_foreign_function(jit, tab->llvm, out ? ctx->t_nil : ret, args, out + num);
+
+      insert_foreign_generic(tab->name, tab->llvm, ret, args + out, num);
+   }
+}
+
 /******************************************************************************
 
    Bignum (ZZ) interface - flint fmpz
 
 ******************************************************************************/
 
+/*
+   Pool of spare mpz's for ZZ temporaries. Flint frees (or shrinks) the 
+   mpz behind an fmpz when it is cleared, so a loop computing with large
+   integers reallocates limbs every iteration. Instead we keep cleared
+   mpz's with their limbs and hand them to new temporaries. We also keep
+   a running average of the number of limbs seen, so that when the pool
+   runs dry we can allocate an mpz which is already big enough.
+*/
+__thread __mpz_struct * fmpz_pool[FMPZ_POOL_SIZE];
+__thread int fmpz_pool_num = 0;
+__thread slong fmpz_pool_limbs = 0;
+
+/*
+   Initialise an fmpz which is about to be used as the output of an
+   operation, with limbs from the pool if recent values were large.
+*/
+void __fmpz_pool_init(fmpz_t f)
+{
+   __mpz_struct * ptr;
+
+   if (fmpz_pool_num != 0)
+      ptr = fmpz_pool[--fmpz_pool_num];
+   else if (fmpz_pool_limbs > 1)
+   {
+      ptr = _fmpz_new_mpz();
+      if (ptr->_mp_alloc < fmpz_pool_limbs)
+         mpz_realloc2(ptr, fmpz_pool_limbs*FLINT_BITS);
+   } else /* values are small, nothing to gain */
+   {
+      *f = 0;
+      return;
+   }
+
+   /* 
+      The value is zero but not in canonical form. This is fine so long
+      as f is written before it is read, which flint always does for 
+      the output of an operation.
+   */
+   ptr->_mp_size = 0;
+   *f = PTR_TO_COEFF(ptr);
+}
+
+/*
+   Clear an fmpz, returning its mpz (if any) to the pool
+*/
+void __fmpz_pool_clear(fmpz_t f)
+{
+   if (COEFF_IS_MPZ(*f))
+   {
+      __mpz_struct * ptr = COEFF_TO_PTR(*f);
+      slong limbs = FLINT_ABS(ptr->_mp_size);
+
+      fmpz_pool_limbs = (3*fmpz_pool_limbs + limbs)/4;
+      
+      if (fmpz_pool_num < FMPZ_POOL_SIZE && ptr->_mp_alloc <= FMPZ_POOL_MAX_LIMBS)
+         fmpz_pool[fmpz_pool_num++] = ptr;
+      else
+         _fmpz_clear_mpz(*f);
+   } else
+      fmpz_pool_limbs = (3*fmpz_pool_limbs)/4;
+
+   *f = 0;
+}
+
+/*
+   Checked versions of flint functions which would otherwise abort
+*/
+void __fmpz_sqrt(fmpz_t r, fmpz_t a)
+{
+   if (fmpz_sgn(a) < 0)
+      exception("Square root of negative integer\n");
+
+   fmpz_sqrt(r, a);
+}
+
+void __fmpz_powm(fmpz_t r, fmpz_t a, fmpz_t e, fmpz_t m)
+{
+   if (fmpz_sgn(m) <= 0)
+      exception("Modulus must be positive in powmod\n");
+
+   if (fmpz_sgn(e) < 0)
+      exception("Negative exponent in powmod\n");
+
+   fmpz_powm(r, a, e, m);
+}
+
+/*
+   Operators and functions on ZZ's, other than constructors and the
+   finaliser, which ZZ_init sets up
+*/
+static const foreign_t ZZ_bindings[] =
+{
+   { "+", "fmpz_add", NULL, "ZZ(ref ZZ, ref ZZ)" },
+   { "-", "fmpz_sub", NULL, "ZZ(ref ZZ, ref ZZ)" },
+   { "*", "fmpz_mul", NULL, "ZZ(ref ZZ, ref ZZ)" },
+   { "/", "fmpz_fdiv_q", NULL, "ZZ(ref ZZ, ref ZZ)" },
+   { "%", "fmpz_mod", NULL, "ZZ(ref ZZ, ref ZZ)" },
+   { "^", "fmpz_pow_ui", NULL, "ZZ(ref ZZ, uint)" },
+   { "=", "fmpz_set", NULL, "nil(ref ZZ, ref ZZ)" },
+   { "<", "__ZZ_lt", __ZZ_lt, "bool(ref ZZ, ref ZZ)" },
+   { ">", "__ZZ_gt", __ZZ_gt, "bool(ref ZZ, ref ZZ)" },
+   { "<=", "__ZZ_lte", __ZZ_lte, "bool(ref ZZ, ref ZZ)" },
+   { ">=", "__ZZ_gte", __ZZ_gte, "bool(ref ZZ, ref ZZ)" },
+   { "==", "__ZZ_eq", __ZZ_eq, "bool(ref ZZ, ref ZZ)" },
+   { "!=", "__ZZ_neq", __ZZ_neq, "bool(ref ZZ, ref ZZ)" },
+   { "gcd", "fmpz_gcd", NULL, "ZZ(ref ZZ, ref ZZ)" },
+   { "lcm", "fmpz_lcm", NULL, "ZZ(ref ZZ, ref ZZ)" },
+   { "sqrt", "__fmpz_sqrt", __fmpz_sqrt, "ZZ(ref ZZ)" },
+   { "abs", "fmpz_abs", NULL, "ZZ(ref ZZ)" },
+   { "neg", "fmpz_neg", NULL, "ZZ(ref ZZ)" },
+   { "powmod", "__fmpz_powm", __fmpz_powm, "ZZ(ref ZZ, ref ZZ, ref ZZ)" },
+   { "is_probab_prime", "fmpz_is_probabprime", NULL, "bool(ref ZZ)" },
+   { "is_square", "fmpz_is_square", NULL, "bool(ref ZZ)" },
+   { "bits", "fmpz_bits", NULL, "uint(ref ZZ)" },
+   { "and", "fmpz_and", NULL, "ZZ(ref ZZ, ref ZZ)" },
+   { "or", "fmpz_or", NULL, "ZZ(ref ZZ, ref ZZ)" },
+   { "xor", "fmpz_xor", NULL, "ZZ(ref ZZ, ref ZZ)" },
+   { "complement", "fmpz_complement", NULL, "ZZ(ref ZZ)" },
+   { "shl", "fmpz_mul_2exp", NULL, "ZZ(ref ZZ, uint)" },
+   { "shr", "fmpz_fdiv_q_2exp", NULL, "ZZ(ref ZZ, uint)" },
+   { "fac", "fmpz_fac_ui", NULL, "ZZ(uint)" },
+   { "binomial", "fmpz_bin_uiui", NULL, "ZZ(uint, uint)" },
+   { "fib", "fmpz_fib_ui", NULL, "ZZ(uint)" },
+   { NULL }
+};
+
 void ZZ_init(jit_t * jit)
 {
    const char * ZZ_fields[1] = { "fmpz" };
-   type_t * ZZ_types[1] = { t_int };
+   type_t * ZZ_types[1] = { ctx->t_int };
    
    sym_t * name = sym_lookup("ZZ");
-   t_ZZ = new_foreign_type(name, ZZ_fields, ZZ_types, 1);
+   ctx->t_ZZ = new_foreign_type(jit, name, ZZ_fields, ZZ_types, 1);
    
-   type_t * constr = constructor_type(name, t_ZZ, 0, NULL); /* generic constructor */
+   type_t * constr = constructor_type(name, ctx->t_ZZ, 0, NULL); /* generic constructor */
 
-   bind_t * bind = bind_symbol(name, constr, NULL); /* bind new type name to generic constructor */
-   type_to_llvm(jit, t_ZZ);
+   bind_symbol(name, constr, NULL); /* bind new type name to generic constructor */
+   type_to_llvm(jit, ctx->t_ZZ);
 
-   type_t * args[3] = { reference_type(t_ZZ), NULL, NULL };
+   type_t * args[3] = { reference_type(ctx->t_ZZ), NULL, NULL };
 
-   type_t * f1 = fn_type(t_nil, 1, args); /* the empty constructor function */
-   new_foreign_function(jit, "__fmpz_init", t_nil, args, 1);
-   f1->llvm = "__fmpz_init";
-   new_foreign_function(jit, "__fmpz_clear", t_nil, args, 1);
+   type_t * f1 = fn_type(ctx->t_nil, 1, args); /* the empty constructor function */
+   map_foreign_function(jit, "__ZZ_init", __ZZ_init, ctx->t_nil, args, 1);
+   f1->llvm = "__ZZ_init";
+   map_foreign_function(jit, "__fmpz_pool_clear", __fmpz_pool_clear, ctx->t_nil, args, 1);
+   map_foreign_function(jit, "__fmpz_pool_init", __fmpz_pool_init, ctx->t_nil, args, 1);
    
-   args[1] = t_uint;
-   type_t * f2 = fn_type(t_nil, 2, args); /* the int constructor function */
-   new_foreign_function(jit, "__fmpz_init_set_ui", t_nil, args, 2);
-   f2->llvm = "__fmpz_init_set_ui";
+   args[1] = ctx->t_uint;
+   type_t * f2 = fn_type(ctx->t_nil, 2, args); /* the int constructor function */
+   map_foreign_function(jit, "__ZZ_init_set_ui", __ZZ_init_set_ui, ctx->t_nil, args, 2);
+   f2->llvm = "__ZZ_init_set_ui";
    
-   args[1] = t_string;
-   args[2] = t_int;
-   type_t * f3 = fn_type(t_nil, 3, args); /* the string constructor function */
-   new_foreign_function(jit, "fmpz_set_str", t_nil, args, 3);
+   args[1] = ctx->t_string;
+   args[2] = ctx->t_int;
+   type_t * f3 = fn_type(ctx->t_nil, 3, args); /* the string constructor function */
+   new_foreign_function(jit, "fmpz_set_str", ctx->t_nil, args, 3);
    f3->llvm = "fmpz_set_str";
    
-   args[1] = reference_type(t_ZZ);
-   type_t * f4 = fn_type(t_nil, 2, args); /* the copy constructor */
-   new_foreign_function(jit, "__fmpz_init_set", t_nil, args, 2);
-   f4->llvm = "__fmpz_init_set";
+   args[1] = reference_type(ctx->t_ZZ);
+   type_t * f4 = fn_type(ctx->t_nil, 2, args); /* the copy constructor */
+   map_foreign_function(jit, "__ZZ_init_set", __ZZ_init_set, ctx->t_nil, args, 2);
+   f4->llvm = "__ZZ_init_set";
    
    generic_insert(constr, f1);
    generic_insert(constr, f2);
@@ -112,101 +373,625 @@ void ZZ_init(jit_t * jit)
    
    type_t * fns[4] = { f1, f2, f3, f4 };
 
-   f1 = fn_type(t_nil, 1, args); /* finaliser */
-   f1->llvm = "__fmpz_clear";
+   f1 = fn_type(ctx->t_nil, 1, args); /* finaliser, returns limbs to the pool */
+   f1->llvm = "__fmpz_pool_clear";
    fns[0] = f1;
-   t_finalizer = generic_type(1, fns); 
-   bind_symbol(sym_lookup("finalizer"), t_finalizer, NULL);
-
-   args[1] = reference_type(t_ZZ);
-   args[2] = reference_type(t_ZZ);
-   new_foreign_function(jit, "fmpz_add", t_nil, args, 3);
-   new_foreign_function(jit, "fmpz_sub", t_nil, args, 3);
-   new_foreign_function(jit, "fmpz_mul", t_nil, args, 3);
-   new_foreign_function(jit, "fmpz_fdiv_q", t_nil, args, 3);
-   new_foreign_function(jit, "fmpz_mod", t_nil, args, 3);
- 
-   args[0] = reference_type(t_ZZ);
-   args[1] = reference_type(t_ZZ);
-   
-   f1 = fn_type(t_ZZ, 2, args);
-   f1->intrinsic = 1;
-   f1->llvm = "fmpz_add";
-   bind = find_symbol(sym_lookup("+"));
-   generic_insert(bind->type, f1);
+   ctx->t_finalizer = generic_type(1, fns); 
+   bind_symbol(sym_lookup("finalizer"), ctx->t_finalizer, NULL);
 
-   f1 = fn_type(t_ZZ, 2, args);
-   f1->intrinsic = 1;
-   f1->llvm = "fmpz_sub";
-   bind = find_symbol(sym_lookup("-"));
-   generic_insert(bind->type, f1);
+   foreign_bind(jit, ZZ_bindings);
+}
 
-   f1 = fn_type(t_ZZ, 2, args);
-   f1->intrinsic = 1;
-   f1->llvm = "fmpz_mul";
-   bind = find_symbol(sym_lookup("*"));
-   generic_insert(bind->type, f1);
+/*
+   Bindings for the C maths library
+*/
+static const foreign_t libc_bindings[] =
+{
+   { "sqrt", "sqrt", NULL, "double(double)" },
+   { "exp", "exp", NULL, "double(double)" },
+   { "log", "log", NULL, "double(double)" },
+   { "sin", "sin", NULL, "double(double)" },
+   { "cos", "cos", NULL, "double(double)" },
+   { "tan", "tan", NULL, "double(double)" },
+   { "atan", "atan", NULL, "double(double)" },
+   { "floor", "floor", NULL, "double(double)" },
+   { "ceil", "ceil", NULL, "double(double)" },
+   { "abs", "fabs", NULL, "double(double)" },
+   { NULL }
+};
+
+void libc_init(jit_t * jit)
+{
+   foreign_bind(jit, libc_bindings);
+}
 
-   f1 = fn_type(t_ZZ, 2, args);
-   f1->intrinsic = 1;
-   f1->llvm = "fmpz_fdiv_q";
-   bind = find_symbol(sym_lookup("/"));
-   generic_insert(bind->type, f1);
+/******************************************************************************
 
-   f1 = fn_type(t_ZZ, 2, args);
-   f1->intrinsic = 1;
-   f1->llvm = "fmpz_mod";
-   bind = find_symbol(sym_lookup("%"));
-   generic_insert(bind->type, f1);
+   Modular integers (nmod) - flint nmod_t
+
+******************************************************************************/
+
+/*
+   An nmod carries its modulus along with the precomputed inverse flint
+   uses for reduction, so that arithmetic never divides. The jit inlines
+   +, - and *, the functions here are used for everything else.
+*/
+
+void __nmod_init_ui(nmod_s * r, ulong x, ulong n)
+{
+   if (n == 0)
+      exception("Zero modulus in nmod\n");
+
+   nmod_init(&r->mod, n);
+   r->x = n_mod2_preinv(x, n, r->mod.ninv);
+}
+
+void __nmod_init_fmpz(nmod_s * r, fmpz * x, ulong n)
+{
+   if (n == 0)
+      exception("Zero modulus in nmod\n");
+
+   nmod_init(&r->mod, n);
+   r->x = fmpz_fdiv_ui(x, n);
+}
+
+/*
+   Residue with the same modulus as a, which saves recomputing the
+   inverse
+*/
+void __nmod_init_mod(nmod_s * r, ulong x, nmod_s * a)
+{
+   r->mod = a->mod;
+   r->x = n_mod2_preinv(x, a->mod.n, a->mod.ninv);
+}
+
+/*
+   Raised by jit'd residue arithmetic when the moduli differ
+*/
+void __nmod_mismatch(void)
+{
+   exception("Moduli don't match in nmod operation\n");
+}
+
+void __nmod_add(nmod_s * r, nmod_s * a, nmod_s * b)
+{
+   if (a->mod.n != b->mod.n)
+      __nmod_mismatch();
+
+   r->mod = a->mod;
+   r->x = nmod_add(a->x, b->x, a->mod);
+}
+
+void __nmod_sub(nmod_s * r, nmod_s * a, nmod_s * b)
+{
+   if (a->mod.n != b->mod.n)
+      __nmod_mismatch();
+
+   r->mod = a->mod;
+   r->x = nmod_sub(a->x, b->x, a->mod);
+}
+
+void __nmod_mul(nmod_s * r, nmod_s * a, nmod_s * b)
+{
+   if (a->mod.n != b->mod.n)
+      __nmod_mismatch();
 
-   new_foreign_function(jit, "fmpz_set", t_nil, args, 2);
+   r->mod = a->mod;
+   r->x = nmod_mul(a->x, b->x, a->mod);
+}
+
+int __nmod_eq(nmod_s * a, nmod_s * b)
+{
+   return a->x == b->x && a->mod.n == b->mod.n;
+}
+
+int __nmod_neq(nmod_s * a, nmod_s * b)
+{
+   return a->x != b->x || a->mod.n != b->mod.n;
+}
+
+/*
+   Bulk operations on arrays of residues. The operands must have the
+   same length and the result array must be at least as long. The 
+   modulus of the first entry of a is loaded once, and every entry is
+   checked against it.
+*/
+#define NMOD_VEC_OP(__name, __op)                                    \
+void __name(nmod_arr_s * r, nmod_arr_s * a, nmod_arr_s * b)          \
+{                                                                    \
+   slong i, len = a->length;                                         \
+   nmod_t mod;                                                       \
+                                                                     \
+   if (b->length != len)                                             \
+      exception("Lengths don't match in nmod vector operation\n");   \
+                                                                     \
+   if (len == 0)                                                     \
+      return;                                                        \
+                                                                     \
+   if (r->length < len)                                              \
+      exception("Result array too short in nmod vector operation\n"); \
+                                                                     \
+   mod = a->arr[0].mod;                                              \
+                                                                     \
+   for (i = 0; i < len; i++)                                         \
+   {                                                                 \
+      if (a->arr[i].mod.n != mod.n || b->arr[i].mod.n != mod.n)      \
+         __nmod_mismatch();                                          \
+                                                                     \
+      r->arr[i].x = __op(a->arr[i].x, b->arr[i].x, mod);             \
+      r->arr[i].mod = mod;                                           \
+   }                                                                 \
+}
+
+NMOD_VEC_OP(__nmod_vec_add, nmod_add)
+
+NMOD_VEC_OP(__nmod_vec_sub, nmod_sub)
+
+NMOD_VEC_OP(__nmod_vec_mul, nmod_mul)
+
+void __nmod_vec_scalar_mul(nmod_arr_s * r, nmod_arr_s * a, nmod_s * c)
+{
+   slong i, len = a->length;
+   nmod_t mod = c->mod;
+
+   if (r->length < len)
+      exception("Result array too short in nmod vector operation\n");
+
+   for (i = 0; i < len; i++)
+   {
+      if (a->arr[i].mod.n != mod.n)
+         __nmod_mismatch();
+
+      r->arr[i].x = nmod_mul(a->arr[i].x, c->x, mod);
+      r->arr[i].mod = mod;
+   }
+}
+
+static const foreign_t nmod_bindings[] =
+{
+   { "+", "__nmod_add", __nmod_add, "nmod(ref nmod, ref nmod)" },
+   { "-", "__nmod_sub", __nmod_sub, "nmod(ref nmod, ref nmod)" },
+   { "*", "__nmod_mul", __nmod_mul, "nmod(ref nmod, ref nmod)" },
+   { "==", "__nmod_eq", __nmod_eq, "bool(ref nmod, ref nmod)" },
+   { "!=", "__nmod_neq", __nmod_neq, "bool(ref nmod, ref nmod)" },
+   { "nmod_vec_add", "__nmod_vec_add", __nmod_vec_add, 
+                     "nil(ref array[nmod], ref array[nmod], ref array[nmod])" },
+   { "nmod_vec_sub", "__nmod_vec_sub", __nmod_vec_sub, 
+                     "nil(ref array[nmod], ref array[nmod], ref array[nmod])" },
+   { "nmod_vec_mul", "__nmod_vec_mul", __nmod_vec_mul, 
+                     "nil(ref array[nmod], ref array[nmod], ref array[nmod])" },
+   { "nmod_vec_scalar_mul", "__nmod_vec_scalar_mul", __nmod_vec_scalar_mul, 
+                     "nil(ref array[nmod], ref array[nmod], ref nmod)" },
+   { NULL }
+};
+
+void nmod_type_init(jit_t * jit)
+{
+   const char * nmod_fields[4] = { "x", "n", "ninv", "norm" };
+   type_t * nmod_types[4] = { ctx->t_uint, ctx->t_uint, ctx->t_uint, ctx->t_uint };
+   type_t * f1;
+   
+   sym_t * name = sym_lookup("nmod");
+   ctx->t_nmod = new_foreign_type(jit, name, nmod_fields, nmod_types, 4);
+   
+   type_t * constr = constructor_type(name, ctx->t_nmod, 0, NULL); /* generic constructor */
+
+   bind_symbol(name, constr, NULL); /* bind new type name to generic constructor */
+   type_to_llvm(jit, ctx->t_nmod);
+
+   type_t * nref = reference_type(ctx->t_nmod);
+   type_t * args[3] = { nref, ctx->t_uint, ctx->t_uint };
    
-   f1 = fn_type(t_nil, 2, args);
+   map_foreign_function(jit, "__nmod_mismatch", __nmod_mismatch, ctx->t_nil, NULL, 0);
+   
+   map_foreign_function(jit, "__nmod_init_ui", __nmod_init_ui, ctx->t_nil, args, 3);
+   f1 = fn_type(ctx->t_nmod, 3, args); /* nmod(x, n) */
    f1->intrinsic = 1;
-   f1->llvm = "fmpz_set";
-   bind = find_symbol(sym_lookup("="));
-   generic_insert(bind->type, f1);
-
-   new_foreign_function(jit, "__fmpz_lt", t_bool, args, 2);
-   new_foreign_function(jit, "__fmpz_gt", t_bool, args, 2);
-   new_foreign_function(jit, "__fmpz_lte", t_bool, args, 2);
-   new_foreign_function(jit, "__fmpz_gte", t_bool, args, 2);
-   new_foreign_function(jit, "__fmpz_eq", t_bool, args, 2);
-   new_foreign_function(jit, "__fmpz_neq", t_bool, args, 2);
-
-   f1 = fn_type(t_bool, 2, args);
+   f1->llvm = "__nmod_init_ui";
+   generic_insert(constr, f1);
+
+   args[1] = reference_type(ctx->t_ZZ);
+   map_foreign_function(jit, "__nmod_init_fmpz", __nmod_init_fmpz, ctx->t_nil, args, 3);
+   f1 = fn_type(ctx->t_nmod, 3, args); /* nmod(ZZ, n) */
    f1->intrinsic = 1;
-   f1->llvm = "__fmpz_lt";
-   bind = find_symbol(sym_lookup("<"));
-   generic_insert(bind->type, f1);
+   f1->llvm = "__nmod_init_fmpz";
+   generic_insert(constr, f1);
 
-   f1 = fn_type(t_bool, 2, args);
+   args[1] = ctx->t_uint;
+   args[2] = nref;
+   map_foreign_function(jit, "__nmod_init_mod", __nmod_init_mod, ctx->t_nil, args, 3);
+   f1 = fn_type(ctx->t_nmod, 3, args); /* nmod(x, a), same modulus as a */
    f1->intrinsic = 1;
-   f1->llvm = "__fmpz_gt";
-   bind = find_symbol(sym_lookup(">"));
-   generic_insert(bind->type, f1);
+   f1->llvm = "__nmod_init_mod";
+   generic_insert(constr, f1);
+
+   foreign_bind(jit, nmod_bindings);
+}
+
+/******************************************************************************
 
-   f1 = fn_type(t_bool, 2, args);
+   Integer matrices - flint fmpz_mat
+
+******************************************************************************/
+
+/*
+   Flint requires the output of an operation to have the right 
+   dimensions, whereas Bacon temporaries start out empty. So the
+   operations resize their output first.
+*/
+
+void __fmpz_mat_fit(fmpz_mat_t r, slong rows, slong cols)
+{
+   if (r->r != rows || r->c != cols)
+   {
+      fmpz_mat_clear(r);
+      fmpz_mat_init(r, rows, cols);
+   }
+}
+
+void __fmpz_mat_init0(fmpz_mat_t r)
+{
+   fmpz_mat_init(r, 0, 0);
+}
+
+void __fmpz_mat_init_dims(fmpz_mat_t r, slong rows, slong cols)
+{
+   if (rows < 0 || cols < 0)
+      exception("Negative dimension in fmpz_mat\n");
+
+   fmpz_mat_init(r, rows, cols);
+}
+
+void __fmpz_mat_set(fmpz_mat_t r, fmpz_mat_t a)
+{
+   if (r != a)
+   {
+      __fmpz_mat_fit(r, a->r, a->c);
+      fmpz_mat_set(r, a);
+   }
+}
+
+void __fmpz_mat_add(fmpz_mat_t r, fmpz_mat_t a, fmpz_mat_t b)
+{
+   if (a->r != b->r || a->c != b->c)
+      exception("Matrix dimensions don't match in addition\n");
+
+   __fmpz_mat_fit(r, a->r, a->c);
+   fmpz_mat_add(r, a, b);
+}
+
+void __fmpz_mat_sub(fmpz_mat_t r, fmpz_mat_t a, fmpz_mat_t b)
+{
+   if (a->r != b->r || a->c != b->c)
+      exception("Matrix dimensions don't match in subtraction\n");
+
+   __fmpz_mat_fit(r, a->r, a->c);
+   fmpz_mat_sub(r, a, b);
+}
+
+void __fmpz_mat_mul(fmpz_mat_t r, fmpz_mat_t a, fmpz_mat_t b)
+{
+   if (a->c != b->r)
+      exception("Matrix dimensions don't match in multiplication\n");
+
+   __fmpz_mat_fit(r, a->r, b->c);
+   fmpz_mat_mul(r, a, b);
+}
+
+void __fmpz_mat_det(fmpz_t d, fmpz_mat_t a)
+{
+   if (a->r != a->c)
+      exception("Determinant of non-square matrix\n");
+
+   fmpz_mat_det(d, a);
+}
+
+/*
+   Solve a*x = b, returning the denominator d such that x/d is the
+   solution, or zero if a is singular
+*/
+void __fmpz_mat_solve(fmpz_t d, fmpz_mat_t x, fmpz_mat_t a, fmpz_mat_t b)
+{
+   if (a->r != a->c || a->r != b->r)
+      exception("Matrix dimensions don't match in solve\n");
+
+   __fmpz_mat_fit(x, b->r, b->c);
+   fmpz_mat_solve(x, d, a, b);
+}
+
+static const foreign_t fmpz_mat_bindings[] =
+{
+   { "=", "__fmpz_mat_set", __fmpz_mat_set, "nil(ref fmpz_mat, ref fmpz_mat)" },
+   { "+", "__fmpz_mat_add", __fmpz_mat_add, "fmpz_mat(ref fmpz_mat, ref fmpz_mat)" },
+   { "-", "__fmpz_mat_sub", __fmpz_mat_sub, "fmpz_mat(ref fmpz_mat, ref fmpz_mat)" },
+   { "*", "__fmpz_mat_mul", __fmpz_mat_mul, "fmpz_mat(ref fmpz_mat, ref fmpz_mat)" },
+   { "det", "__fmpz_mat_det", __fmpz_mat_det, "ZZ(ref fmpz_mat)" },
+   { "solve", "__fmpz_mat_solve", __fmpz_mat_solve, 
+              "ZZ(ref fmpz_mat, ref fmpz_mat, ref fmpz_mat)" },
+   { NULL }
+};
+
+void fmpz_mat_type_init(jit_t * jit)
+{
+   const char * mat_fields[4] = { "entries", "r", "c", "rows" };
+   type_t * mat_types[4] = { ctx->t_uint, ctx->t_int, ctx->t_int, ctx->t_uint };
+   type_t * f1;
+   
+   sym_t * name = sym_lookup("fmpz_mat");
+   ctx->t_fmpz_mat = new_foreign_type(jit, name, mat_fields, mat_types, 4);
+   
+   type_t * constr = constructor_type(name, ctx->t_fmpz_mat, 0, NULL); /* generic constructor */
+
+   bind_symbol(name, constr, NULL); /* bind new type name to generic constructor */
+   type_to_llvm(jit, ctx->t_fmpz_mat);
+
+   type_t * mref = reference_type(ctx->t_fmpz_mat);
+   type_t * args[3] = { mref, ctx->t_int, ctx->t_int };
+   
+   map_foreign_function(jit, "__fmpz_mat_init0", __fmpz_mat_init0, ctx->t_nil, args, 1);
+   f1 = fn_type(ctx->t_nil, 1, args); /* the empty constructor */
+   f1->llvm = "__fmpz_mat_init0";
+   generic_insert(constr, f1);
+
+   map_foreign_function(jit, "__fmpz_mat_init_dims", __fmpz_mat_init_dims, ctx->t_nil, args, 3);
+   f1 = fn_type(ctx->t_fmpz_mat, 3, args); /* fmpz_mat(r, c), zero matrix */
    f1->intrinsic = 1;
-   f1->llvm = "__fmpz_lte";
-   bind = find_symbol(sym_lookup("<="));
-   generic_insert(bind->type, f1);
+   f1->llvm = "__fmpz_mat_init_dims";
+   generic_insert(constr, f1);
+
+   args[1] = mref;
+   new_foreign_function(jit, "fmpz_mat_init_set", ctx->t_nil, args, 2);
+   f1 = fn_type(ctx->t_nil, 2, args); /* the copy constructor */
+   f1->llvm = "fmpz_mat_init_set";
+   generic_insert(constr, f1);
+
+   new_foreign_function(jit, "fmpz_mat_clear", ctx->t_nil, args, 1);
+   f1 = fn_type(ctx->t_nil, 1, args); /* finaliser */
+   f1->llvm = "fmpz_mat_clear";
+   generic_insert(ctx->t_finalizer, f1);
+
+   foreign_bind(jit, fmpz_mat_bindings);
+}
+
+/******************************************************************************
+
+   Polynomials - flint fmpz_poly and nmod_poly
+
+******************************************************************************/
+
+void __fmpz_poly_init_set(fmpz_poly_t r, fmpz_poly_t a)
+{
+   fmpz_poly_init(r);
+   fmpz_poly_set(r, a);
+}
+
+/*
+   fmpz_poly([c0, c1, ...]), coefficients in increasing degree
+*/
+void __fmpz_poly_init_arr(fmpz_poly_t r, fmpz_arr_s * a)
+{
+   slong i;
+
+   fmpz_poly_init2(r, a->length);
+
+   for (i = a->length - 1; i >= 0; i--)
+      fmpz_poly_set_coeff_fmpz(r, i, a->arr + i);
+}
+
+void __fmpz_poly_div(fmpz_poly_t r, fmpz_poly_t a, fmpz_poly_t b)
+{
+   if (fmpz_poly_is_zero(b))
+      exception("Division by zero polynomial\n");
+
+   fmpz_poly_div(r, a, b);
+}
+
+void __fmpz_poly_rem(fmpz_poly_t r, fmpz_poly_t a, fmpz_poly_t b)
+{
+   if (fmpz_poly_is_zero(b))
+      exception("Division by zero polynomial\n");
+
+   fmpz_poly_rem(r, a, b);
+}
+
+int __fmpz_poly_neq(fmpz_poly_t a, fmpz_poly_t b)
+{
+   return !fmpz_poly_equal(a, b);
+}
+
+/*
+   Polynomials created by the empty constructor, e.g. temporaries, 
+   have modulus 1 until they are given the modulus of an operand
+*/
+void __nmod_poly_init0(nmod_poly_t r)
+{
+   nmod_poly_init(r, 1);
+}
+
+void __nmod_poly_init_mod(nmod_poly_t r, ulong n)
+{
+   if (n == 0)
+      exception("Modulus of nmod_poly must be nonzero\n");
+
+   nmod_poly_init(r, n);
+}
+
+/*
+   nmod_poly([c0, c1, ...], n), coefficients in increasing degree
+*/
+void __nmod_poly_init_arr(nmod_poly_t r, uint_arr_s * a, ulong n)
+{
+   slong i;
+
+   if (n == 0)
+      exception("Modulus of nmod_poly must be nonzero\n");
+
+   nmod_poly_init2(r, n, a->length);
+
+   for (i = a->length - 1; i >= 0; i--)
+      nmod_poly_set_coeff_ui(r, i, a->arr[i]);
+}
+
+void __nmod_poly_init_set(nmod_poly_t r, nmod_poly_t a)
+{
+   nmod_poly_init2(r, a->mod.n, a->length);
+   nmod_poly_set(r, a);
+}
+
+void __nmod_poly_set(nmod_poly_t r, nmod_poly_t a)
+{
+   r->mod = a->mod;
+   nmod_poly_set(r, a);
+}
+
+#define NMOD_POLY_OP(__name, __op, __check)                              \
+void __name(nmod_poly_t r, nmod_poly_t a, nmod_poly_t b)                 \
+{                                                                        \
+   if (a->mod.n != b->mod.n)                                             \
+      exception("Moduli don't match in nmod_poly operation\n");          \
+                                                                         \
+   if (__check && nmod_poly_is_zero(b))                                  \
+      exception("Division by zero polynomial\n");                        \
+                                                                         \
+   r->mod = a->mod;                                                      \
+   __op(r, a, b);                                                        \
+}
+
+NMOD_POLY_OP(__nmod_poly_add, nmod_poly_add, 0)
+NMOD_POLY_OP(__nmod_poly_sub, nmod_poly_sub, 0)
+NMOD_POLY_OP(__nmod_poly_mul, nmod_poly_mul, 0)
+NMOD_POLY_OP(__nmod_poly_div, nmod_poly_div, 1)
+NMOD_POLY_OP(__nmod_poly_rem, nmod_poly_rem, 1)
 
-   f1 = fn_type(t_bool, 2, args);
+int __nmod_poly_eq(nmod_poly_t a, nmod_poly_t b)
+{
+   return a->mod.n == b->mod.n && nmod_poly_equal(a, b);
+}
+
+int __nmod_poly_neq(nmod_poly_t a, nmod_poly_t b)
+{
+   return !__nmod_poly_eq(a, b);
+}
+
+ulong __nmod_poly_eval(nmod_poly_t a, ulong x)
+{
+   return nmod_poly_evaluate_nmod(a, n_mod2_preinv(x, a->mod.n, a->mod.ninv));
+}
+
+static const foreign_t fmpz_poly_bindings[] =
+{
+   { "=", "fmpz_poly_set", NULL, "nil(ref fmpz_poly, ref fmpz_poly)" },
+   { "+", "fmpz_poly_add", NULL, "fmpz_poly(ref fmpz_poly, ref fmpz_poly)" },
+   { "-", "fmpz_poly_sub", NULL, "fmpz_poly(ref fmpz_poly, ref fmpz_poly)" },
+   { "*", "fmpz_poly_mul", NULL, "fmpz_poly(ref fmpz_poly, ref fmpz_poly)" },
+   { "/", "__fmpz_poly_div", __fmpz_poly_div, "fmpz_poly(ref fmpz_poly, ref fmpz_poly)" },
+   { "%", "__fmpz_poly_rem", __fmpz_poly_rem, "fmpz_poly(ref fmpz_poly, ref fmpz_poly)" },
+   { "==", "fmpz_poly_equal", NULL, "bool(ref fmpz_poly, ref fmpz_poly)" },
+   { "!=", "__fmpz_poly_neq", __fmpz_poly_neq, "bool(ref fmpz_poly, ref fmpz_poly)" },
+   { "degree", "fmpz_poly_degree", NULL, "int(ref fmpz_poly)" },
+   { "eval", "fmpz_poly_evaluate_fmpz", NULL, "ZZ(ref fmpz_poly, ref ZZ)" },
+   { NULL }
+};
+
+static const foreign_t nmod_poly_bindings[] =
+{
+   { "=", "__nmod_poly_set", __nmod_poly_set, "nil(ref nmod_poly, ref nmod_poly)" },
+   { "+", "__nmod_poly_add", __nmod_poly_add, "nmod_poly(ref nmod_poly, ref nmod_poly)" },
+   { "-", "__nmod_poly_sub", __nmod_poly_sub, "nmod_poly(ref nmod_poly, ref nmod_poly)" },
+   { "*", "__nmod_poly_mul", __nmod_poly_mul, "nmod_poly(ref nmod_poly, ref nmod_poly)" },
+   { "/", "__nmod_poly_div", __nmod_poly_div, "nmod_poly(ref nmod_poly, ref nmod_poly)" },
+   { "%", "__nmod_poly_rem", __nmod_poly_rem, "nmod_poly(ref nmod_poly, ref nmod_poly)" },
+   { "==", "__nmod_poly_eq", __nmod_poly_eq, "bool(ref nmod_poly, ref nmod_poly)" },
+   { "!=", "__nmod_poly_neq", __nmod_poly_neq, "bool(ref nmod_poly, ref nmod_poly)" },
+   { "degree", "nmod_poly_degree", NULL, "int(ref nmod_poly)" },
+   { "eval", "__nmod_poly_eval", __nmod_poly_eval, "uint(ref nmod_poly, uint)" },
+   { NULL }
+};
+
+void poly_type_init(jit_t * jit)
+{
+   const char * zpoly_fields[3] = { "coeffs", "alloc", "length" };
+   type_t * zpoly_types[3] = { ctx->t_uint, ctx->t_int, ctx->t_int };
+   const char * npoly_fields[6] = { "coeffs", "alloc", "length", "n", "ninv", "norm" };
+   type_t * npoly_types[6] = { ctx->t_uint, ctx->t_int, ctx->t_int, ctx->t_uint, ctx->t_uint, ctx->t_uint };
+   type_t * f1;
+   
+   sym_t * name = sym_lookup("fmpz_poly");
+   ctx->t_fmpz_poly = new_foreign_type(jit, name, zpoly_fields, zpoly_types, 3);
+   
+   type_t * constr = constructor_type(name, ctx->t_fmpz_poly, 0, NULL); /* generic constructor */
+
+   bind_symbol(name, constr, NULL); /* bind new type name to generic constructor */
+   type_to_llvm(jit, ctx->t_fmpz_poly);
+
+   type_t * pref = reference_type(ctx->t_fmpz_poly);
+   type_t * args[3] = { pref, reference_type(array_type(ctx->t_ZZ)), NULL };
+   
+   new_foreign_function(jit, "fmpz_poly_init", ctx->t_nil, args, 1);
+   f1 = fn_type(ctx->t_nil, 1, args); /* the empty constructor */
+   f1->llvm = "fmpz_poly_init";
+   generic_insert(constr, f1);
+
+   map_foreign_function(jit, "__fmpz_poly_init_arr", __fmpz_poly_init_arr, ctx->t_nil, args, 2);
+   f1 = fn_type(ctx->t_fmpz_poly, 2, args); /* fmpz_poly(array of coefficients) */
    f1->intrinsic = 1;
-   f1->llvm = "__fmpz_gte";
-   bind = find_symbol(sym_lookup("<="));
-   generic_insert(bind->type, f1);
+   f1->llvm = "__fmpz_poly_init_arr";
+   generic_insert(constr, f1);
+
+   args[1] = pref;
+   map_foreign_function(jit, "__fmpz_poly_init_set", __fmpz_poly_init_set, ctx->t_nil, args, 2);
+   f1 = fn_type(ctx->t_nil, 2, args); /* the copy constructor */
+   f1->llvm = "__fmpz_poly_init_set";
+   generic_insert(constr, f1);
+
+   new_foreign_function(jit, "fmpz_poly_clear", ctx->t_nil, args, 1);
+   f1 = fn_type(ctx->t_nil, 1, args); /* finaliser */
+   f1->llvm = "fmpz_poly_clear";
+   generic_insert(ctx->t_finalizer, f1);
+
+   foreign_bind(jit, fmpz_poly_bindings);
+
+   name = sym_lookup("nmod_poly");
+   ctx->t_nmod_poly = new_foreign_type(jit, name, npoly_fields, npoly_types, 6);
+   
+   constr = constructor_type(name, ctx->t_nmod_poly, 0, NULL); /* generic constructor */
+
+   bind_symbol(name, constr, NULL); /* bind new type name to generic constructor */
+   type_to_llvm(jit, ctx->t_nmod_poly);
 
-   f1 = fn_type(t_bool, 2, args);
+   pref = reference_type(ctx->t_nmod_poly);
+   args[0] = pref;
+   args[1] = ctx->t_uint;
+   
+   map_foreign_function(jit, "__nmod_poly_init0", __nmod_poly_init0, ctx->t_nil, args, 1);
+   f1 = fn_type(ctx->t_nil, 1, args); /* the empty constructor */
+   f1->llvm = "__nmod_poly_init0";
+   generic_insert(constr, f1);
+
+   map_foreign_function(jit, "__nmod_poly_init_mod", __nmod_poly_init_mod, ctx->t_nil, args, 2);
+   f1 = fn_type(ctx->t_nmod_poly, 2, args); /* nmod_poly(n), zero polynomial */
    f1->intrinsic = 1;
-   f1->llvm = "__fmpz_eq";
-   bind = find_symbol(sym_lookup("=="));
-   generic_insert(bind->type, f1);
+   f1->llvm = "__nmod_poly_init_mod";
+   generic_insert(constr, f1);
 
-   f1 = fn_type(t_bool, 2, args);
+   args[1] = reference_type(array_type(ctx->t_uint));
+   args[2] = ctx->t_uint;
+   map_foreign_function(jit, "__nmod_poly_init_arr", __nmod_poly_init_arr, ctx->t_nil, args, 3);
+   f1 = fn_type(ctx->t_nmod_poly, 3, args); /* nmod_poly(array of coefficients, n) */
    f1->intrinsic = 1;
-   f1->llvm = "__fmpz_neq";
-   bind = find_symbol(sym_lookup("!="));
-   generic_insert(bind->type, f1);
+   f1->llvm = "__nmod_poly_init_arr";
+   generic_insert(constr, f1);
+
+   args[1] = pref;
+   map_foreign_function(jit, "__nmod_poly_init_set", __nmod_poly_init_set, ctx->t_nil, args, 2);
+   f1 = fn_type(ctx->t_nil, 2, args); /* the copy constructor */
+   f1->llvm = "__nmod_poly_init_set";
+   generic_insert(constr, f1);
+
+   new_foreign_function(jit, "nmod_poly_clear", ctx->t_nil, args, 1);
+   f1 = fn_type(ctx->t_nil, 1, args); /* finaliser */
+   f1->llvm = "nmod_poly_clear";
+   generic_insert(ctx->t_finalizer, f1);
+
+   foreign_bind(jit, nmod_poly_bindings);
 }
@@ -26,14 +26,21 @@ ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
 
 #include "gc.h"
 #include "types.h"
 #include "environment.h"
 #include "symbol.h"
 #include "backend.h"
+#include "runtime.h"
 #include "flint.h"
 #include "fmpz.h"
+#include "nmod_vec.h"
+#include "fmpz_mat.h"
+#include "fmpz_poly.h"
+#include "nmod_poly.h"
 
 #ifndef FFI_H
 #define FFI_H
@@ -42,8 +49,76 @@ ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  extern "C" {
 #endif
 
+#define FMPZ_POOL_SIZE 64 /* max number of spare mpz's kept by the pool */
+#define FMPZ_POOL_MAX_LIMBS 65536 /* don't keep mpz's larger than this */
+
+#define FOREIGN_MAX_ARGS 8 /* max args of a function in a binding table */
+
+/*
+   Entry in a table of foreign bindings. The C function llvm is inserted 
+   into the generic called name, with Bacon prototype sig, e.g. 
+   "ZZ(ref ZZ, uint)". As per the flint convention, if the return type 
+   is a data type, the C function writes its result through an extra
+   first argument.
+*/
+typedef struct foreign_t
+{
+   const char * name;
+   const char * llvm;
+   void * fn; /* address of a runtime helper to map into the jit, or NULL */
+   const char * sig;
+} foreign_t;
+
+void __fmpz_pool_init(fmpz_t f);
+
+void __fmpz_pool_clear(fmpz_t f);
+
+void map_foreign_function(jit_t * jit, const char * name, void * fn, 
+                          type_t * ret, type_t ** args, int num);
+
+void insert_foreign_generic(const char * name, const char * llvm, 
+                            type_t * ret, type_t ** args, int num);
+
+void foreign_bind(jit_t * jit, const foreign_t * tab);
+
 void ZZ_init(jit_t * jit);
 
+void libc_init(jit_t * jit);
+
+/* layout of a Bacon nmod, a residue and its modulus */
+typedef struct nmod_s
+{
+   mp_limb_t x;
+   nmod_t mod;
+} nmod_s;
+
+/* layout of a Bacon array[nmod] */
+typedef struct nmod_arr_s
+{
+   nmod_s * arr;
+   slong length;
+} nmod_arr_s;
+
+void nmod_type_init(jit_t * jit);
+
+void fmpz_mat_type_init(jit_t * jit);
+
+/* layout of a Bacon array[ZZ] */
+typedef struct fmpz_arr_s
+{
+   fmpz * arr;
+   slong length;
+} fmpz_arr_s;
+
+/* layout of a Bacon array[uint] */
+typedef struct uint_arr_s
+{
+   ulong * arr;
+   slong length;
+} uint_arr_s;
+
+void poly_type_init(jit_t * jit);
+
 #ifdef __cplusplus
  }
 #endif
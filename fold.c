@@ -0,0 +1,411 @@
+/*
+
+Copyright 2012 William Hart. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are
+permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this list of
+      conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice, this list
+      of conditions and the following disclaimer in the documentation and/or other materials
+      provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY William Hart ``AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL William Hart OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "fold.h"
+
+/*
+   Constant folding. After inference we evaluate binary operations 
+   whose arguments are literals at compile time, replacing them by a
+   literal, and replace if statements and expressions whose condition
+   is a comparison of literals by the branch that would be taken.
+
+   ZZ's are folded with flint and ints and uints with wrapping word
+   arithmetic, exactly as the jit'd code would compute them. Anything
+   which would fail at runtime, e.g. division by zero, is left alone.
+*/
+
+/*
+   Return 1 if the given node is a literal we know how to fold
+*/
+int fold_literal(ast_t * a)
+{
+   return a->tag == AST_ZZ || a->tag == AST_INT 
+       || a->tag == AST_UINT || a->tag == AST_DOUBLE;
+}
+
+/*
+   Replace the given node by a literal with the given text
+*/
+void fold_replace(ast_t * a, int tag, const char * str)
+{
+   a->tag = tag;
+   a->sym = sym_lookup(str);
+   a->child = NULL;
+}
+
+/*
+   Compare two literals of the same type, returning -1, 0 or 1
+*/
+int fold_cmp(ast_t * a1, ast_t * a2)
+{
+   fmpz_t f1, f2;
+   int c;
+
+   switch (a1->tag)
+   {
+   case AST_ZZ:
+      fmpz_init(f1);
+      fmpz_init(f2);
+      fmpz_set_str(f1, a1->sym->name, 10);
+      fmpz_set_str(f2, a2->sym->name, 10);
+      c = fmpz_cmp(f1, f2);
+      fmpz_clear(f1);
+      fmpz_clear(f2);
+      return c < 0 ? -1 : c > 0;
+   case AST_INT:
+   {
+      long x = atol(a1->sym->name), y = atol(a2->sym->name);
+      return x < y ? -1 : x > y;
+   }
+   case AST_UINT:
+   {
+      unsigned long x = strtoul(a1->sym->name, NULL, 10);
+      unsigned long y = strtoul(a2->sym->name, NULL, 10);
+      return x < y ? -1 : x > y;
+   }
+   default: /* AST_DOUBLE */
+   {
+      double x = atof(a1->sym->name), y = atof(a2->sym->name);
+      return x < y ? -1 : x > y;
+   }
+   }
+}
+
+/*
+   If a is a comparison of two literals, set val to its value and 
+   return 1, otherwise return 0
+*/
+int fold_cond(ast_t * a, int * val)
+{
+   ast_t * a1, * a2;
+   int c;
+
+   if (a->tag != AST_BINOP)
+      return 0;
+
+   a1 = a->child;
+   a2 = a1->next;
+
+   if (!fold_literal(a1) || a1->tag != a2->tag)
+      return 0;
+
+   if (a1->tag == AST_DOUBLE && (isnan(atof(a1->sym->name)) || isnan(atof(a2->sym->name))))
+      return 0; /* all comparisons but != are false */
+
+   c = fold_cmp(a1, a2);
+
+   if (a->sym == sym_lookup("=="))
+      *val = (c == 0);
+   else if (a->sym == sym_lookup("!="))
+      *val = (c != 0);
+   else if (a->sym == sym_lookup("<"))
+      *val = (c < 0);
+   else if (a->sym == sym_lookup(">"))
+      *val = (c > 0);
+   else if (a->sym == sym_lookup("<="))
+      *val = (c <= 0);
+   else if (a->sym == sym_lookup(">="))
+      *val = (c >= 0);
+   else
+      return 0;
+
+   return 1;
+}
+
+/*
+   Fold a binary operation on two ZZ literals
+*/
+void fold_ZZ(ast_t * a, ast_t * a1, ast_t * a2)
+{
+   fmpz_t f1, f2, r;
+   char * str;
+   int done = 1;
+
+   fmpz_init(f1);
+   fmpz_init(f2);
+   fmpz_init(r);
+   fmpz_set_str(f1, a1->sym->name, 10);
+   fmpz_set_str(f2, a2->sym->name, 10);
+
+   if (a->sym == sym_lookup("+"))
+      fmpz_add(r, f1, f2);
+   else if (a->sym == sym_lookup("-"))
+      fmpz_sub(r, f1, f2);
+   else if (a->sym == sym_lookup("*"))
+      fmpz_mul(r, f1, f2);
+   else if (a->sym == sym_lookup("/") && !fmpz_is_zero(f2))
+      fmpz_fdiv_q(r, f1, f2);
+   else if (a->sym == sym_lookup("%") && !fmpz_is_zero(f2))
+      fmpz_mod(r, f1, f2);
+   else
+      done = 0;
+
+   if (done)
+   {
+      str = fmpz_get_str(NULL, 10, r);
+      fold_replace(a, AST_ZZ, str);
+      flint_free(str);
+   }
+
+   fmpz_clear(f1);
+   fmpz_clear(f2);
+   fmpz_clear(r);
+}
+
+/*
+   Fold a binary operation on two int or uint literals. Arithmetic
+   is done unsigned so that it wraps, like the jit'd code.
+*/
+void fold_word(ast_t * a, ast_t * a1, ast_t * a2)
+{
+   unsigned long x = strtoul(a1->sym->name, NULL, 10);
+   unsigned long y = strtoul(a2->sym->name, NULL, 10);
+   unsigned long r;
+   char str[24];
+   int is_signed = (a1->tag == AST_INT);
+
+   if (is_signed) /* literals are non-negative, but folded ones may not be */
+   {
+      x = (unsigned long) atol(a1->sym->name);
+      y = (unsigned long) atol(a2->sym->name);
+   }
+
+   if (a->sym == sym_lookup("+"))
+      r = x + y;
+   else if (a->sym == sym_lookup("-"))
+      r = x - y;
+   else if (a->sym == sym_lookup("*"))
+      r = x * y;
+   else if (is_signed && (a->sym == sym_lookup("/") || a->sym == sym_lookup("%")))
+   {
+      if (y == 0 || ((long) y == -1L && (long) x == LONG_MIN))
+         return;
+      
+      if (a->sym == sym_lookup("/"))
+         r = (unsigned long) ((long) x / (long) y);
+      else
+         r = (unsigned long) ((long) x % (long) y);
+   } else /* uint division is jit'd as signed, so leave it be */
+      return;
+
+   if (is_signed)
+      sprintf(str, "%ld", (long) r);
+   else
+      sprintf(str, "%lu", r);
+
+   fold_replace(a, a1->tag, str);
+}
+
+/*
+   Fold a binary operation on two double literals
+*/
+void fold_double(ast_t * a, ast_t * a1, ast_t * a2)
+{
+   double x = atof(a1->sym->name), y = atof(a2->sym->name), r;
+   char str[32];
+
+   if (a->sym == sym_lookup("+"))
+      r = x + y;
+   else if (a->sym == sym_lookup("-"))
+      r = x - y;
+   else if (a->sym == sym_lookup("*"))
+      r = x * y;
+   else if (a->sym == sym_lookup("/"))
+      r = x / y;
+   else if (a->sym == sym_lookup("%"))
+      r = fmod(x, y);
+   else
+      return;
+
+   sprintf(str, "%.17g", r); /* enough digits to read back exactly */
+   
+   fold_replace(a, AST_DOUBLE, str);
+}
+
+/*
+   Fold x^e for literals x and e. For ZZ's we only fold if the result
+   isn't too big, otherwise the literal would bloat the module. A 
+   negative int exponent gives the truncated value, as when jit'd.
+*/
+void fold_pow(ast_t * a, ast_t * a1, ast_t * a2)
+{
+   unsigned long e, x, r;
+   long s = 0;
+   fmpz_t f;
+   char * str, buf[32];
+
+   if (a1->tag == AST_DOUBLE)
+   {
+      sprintf(buf, "%.17g", pow(atof(a1->sym->name), atof(a2->sym->name)));
+      fold_replace(a, AST_DOUBLE, buf);
+      return;
+   }
+   
+   if (a2->tag == AST_INT) /* base is an int, exponent may be negative */
+   {
+      s = atol(a2->sym->name);
+      e = s < 0 ? -(unsigned long) s : s;
+   } else
+      e = strtoul(a2->sym->name, NULL, 10);
+   
+   if (a1->tag == AST_ZZ)
+   {
+      fmpz_init(f);
+      fmpz_set_str(f, a1->sym->name, 10);
+      
+      if (fmpz_bits(f) <= 1 || e <= FOLD_POW_BITS/fmpz_bits(f))
+      {
+         fmpz_pow_ui(f, f, e);
+         str = fmpz_get_str(NULL, 10, f);
+         fold_replace(a, AST_ZZ, str);
+         flint_free(str);
+      }
+
+      fmpz_clear(f);
+      return;
+   }
+
+   /* binary powering with wrapping arithmetic, like the jit'd code */
+   x = (a1->tag == AST_INT) ? (unsigned long) atol(a1->sym->name) 
+                            : strtoul(a1->sym->name, NULL, 10);
+   if (s < 0 && x + 1 > 2) /* x^e truncates to 0 unless x is 0, 1 or -1 */
+      r = 0;
+   else
+   {
+      for (r = 1; e != 0; e >>= 1)
+      {
+         if (e & 1)
+            r *= x;
+         x *= x;
+      }
+   }
+
+   if (a1->tag == AST_INT)
+      sprintf(buf, "%ld", (long) r);
+   else
+      sprintf(buf, "%lu", r);
+
+   fold_replace(a, a1->tag, buf);
+}
+
+/*
+   Return 1 if the given branch of an if contains a return or break,
+   in which case we can't replace the if by it, since the code which
+   follows the if would then be unreachable
+*/
+int fold_jumps(ast_t * a)
+{
+   if (a->tag == AST_RETURN || a->tag == AST_BREAK)
+      return 1;
+
+   for (a = a->child; a != NULL; a = a->next)
+      if (fold_jumps(a))
+         return 1;
+
+   return 0;
+}
+
+/*
+   Replace an if statement or expression by the given branch, or by
+   an empty statement if branch is NULL
+*/
+void fold_if(ast_t * a, ast_t * branch)
+{
+   ast_t * next = a->next;
+   type_t * type = a->type;
+
+   if (branch == NULL)
+   {
+      a->tag = AST_THEN;
+      a->child = NULL;
+   } else
+   {
+      *a = *branch;
+      a->next = next;
+      a->type = type;
+   }
+}
+
+void constant_folding_list(ast_t * a)
+{
+   while (a != NULL)
+   {
+      constant_folding(a);
+      a = a->next;
+   }
+}
+
+/*
+   Fold constant subexpressions of an inferred AST in place
+*/
+void constant_folding(ast_t * a)
+{
+   ast_t * a1, * a2, * a3;
+   int val;
+
+   switch (a->tag)
+   {
+   case AST_BINOP:
+      constant_folding_list(a->child);
+      a1 = a->child;
+      a2 = a1->next;
+      if (a->sym == sym_lookup("^"))
+      {
+         if (fold_literal(a1) && (a2->tag == AST_UINT || a2->tag == AST_INT
+          || a2->tag == AST_DOUBLE))
+            fold_pow(a, a1, a2);
+         break;
+      }
+      if (!fold_literal(a1) || a1->tag != a2->tag || a1->type != a->type)
+         break; /* not an arithmetic operation on literals */
+      if (a1->tag == AST_ZZ)
+         fold_ZZ(a, a1, a2);
+      else if (a1->tag == AST_DOUBLE)
+         fold_double(a, a1, a2);
+      else
+         fold_word(a, a1, a2);
+      break;
+   case AST_IF_ELSE_EXPR:
+   case AST_IF_ELSE_STMT:
+   case AST_IF_STMT:
+      constant_folding_list(a->child);
+      a1 = a->child; /* condition */
+      a2 = a1->next; /* then */
+      a3 = a2->next; /* else, if any */
+      if (!fold_cond(a1, &val))
+         break;
+      if (!val && a3 == NULL) /* if statement which is never taken */
+         fold_if(a, NULL);
+      else if (!fold_jumps(val ? a2 : a3))
+         fold_if(a, val ? a2 : a3);
+      break;
+   case AST_FN_STMT: /* function bodies are folded when they are jit'd */
+   case AST_DATA_STMT:
+      break;
+   default:
+      constant_folding_list(a->child);
+   }
+}
@@ -0,0 +1,344 @@
+/*
+
+Copyright 2012 William Hart. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are
+permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this list of
+      conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice, this list
+      of conditions and the following disclaimer in the documentation and/or other materials
+      provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY William Hart ``AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL William Hart OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "gcstat.h"
+
+int gc_stats = 0;
+
+long gc_jit_allocs = 0;
+
+int gc_idle_collect = 0;
+
+unsigned long gc_pause_limit = GC_PAUSE_DEFAULT;
+
+/* totals since startup */
+unsigned long gc_collections = 0;
+double gc_pause_total = 0.0;
+double gc_pause_max = 0.0;
+double gc_pause_start;
+
+/* counters at the start of the current statement */
+size_t gc_stmt_bytes;
+long gc_stmt_allocs;
+unsigned long gc_stmt_collections;
+double gc_stmt_pause;
+
+/* what the last statement did */
+size_t gc_last_bytes = 0;
+long gc_last_allocs = 0;
+unsigned long gc_last_collections = 0;
+double gc_last_pause = 0.0;
+
+/*
+   Count an allocation made by jit'd code. It may be running on any
+   thread, e.g. in a parallel for.
+*/
+void gc_count(void)
+{
+   __sync_fetch_and_add(&gc_jit_allocs, 1);
+}
+
+/*
+   Wall clock time in milliseconds
+*/
+double gc_time(void)
+{
+   struct timeval tv;
+   gettimeofday(&tv, NULL);
+   return tv.tv_sec*1000.0 + tv.tv_usec/1000.0;
+}
+
+/*
+   Called by the collector at the start and end of each collection
+   so that we can time pauses
+*/
+void gc_event(GC_EventType e)
+{
+   if (e == GC_EVENT_START)
+      gc_pause_start = gc_time();
+   else if (e == GC_EVENT_END)
+   {
+      double t = gc_time() - gc_pause_start;
+      
+      gc_collections++;
+      gc_pause_total += t;
+      if (t > gc_pause_max)
+         gc_pause_max = t;
+   }
+}
+
+/*
+   Hook into the collector. Must be called after GC_INIT.
+*/
+void gc_init(void)
+{
+   GC_set_on_collection_event(gc_event);
+}
+
+/*
+   Switch the collector to incremental (and, where the platform
+   provides dirty bits, generational) mode. Each increment of work is 
+   limited to roughly gc_pause_limit ms and the rest is done while we 
+   are idle at the prompt.
+*/
+void gc_incremental(void)
+{
+   GC_set_time_limit(gc_pause_limit);
+   GC_enable_incremental();
+   gc_idle_collect = 1;
+}
+
+/*
+   Return 1 if any of the len characters at buf isn't white space
+*/
+int gc_text_waiting(const char * buf, long len)
+{
+   long i;
+
+   for (i = 0; i < len; i++)
+      if (!isspace(buf[i]))
+         return 1;
+
+   return 0;
+}
+
+/*
+   Return 1 if there is input waiting. It may already have been read
+   by the parser (the len characters at buf), or be waiting on the file
+   descriptor of in. Input sitting in the stdio buffer can't be seen 
+   portably, but then at most one collection is finished before it is 
+   parsed.
+*/
+int gc_input_ready(FILE * in, const char * buf, long len)
+{
+   struct pollfd fds;
+
+   if (gc_text_waiting(buf, len))
+      return 1;
+
+   fds.fd = fileno(in);
+   fds.events = POLLIN;
+
+   return poll(&fds, 1, 0) > 0;
+}
+
+/*
+   Called when the REPL is about to wait for input from in. The parser
+   has already read ahead the len characters at buf. While the user is
+   idle we do collector work in small steps, so that it doesn't have to
+   be done in a pause during the next statement. We stop as soon as
+   input arrives. Piped input is never idle, so we don't start.
+*/
+void gc_idle(FILE * in, const char * buf, long len)
+{
+   if (!gc_idle_collect)
+      return;
+
+   fflush(stdout); /* make sure the prompt is visible */
+
+   if (!isatty(fileno(in)) || gc_input_ready(in, buf, len))
+      return;
+
+   /* start a collection if anything was allocated since the last one */
+   if (GC_is_incremental_mode() && GC_get_bytes_since_gc() != 0)
+      GC_start_incremental_collection();
+
+   while (!gc_input_ready(in, buf, len) && GC_collect_a_little())
+      ;
+}
+
+/*
+   Set the initial heap size in bytes
+*/
+void gc_heap(size_t bytes)
+{
+   size_t heap = GC_get_heap_size();
+
+   if (bytes > heap)
+      GC_expand_hp(bytes - heap);
+}
+
+/*
+   Parse a positive number, returning 0 if str isn't one
+*/
+unsigned long gc_number(const char * str)
+{
+   char * end;
+   unsigned long n;
+
+   if (!isdigit(*str))
+      return 0;
+
+   n = strtoul(str, &end, 10);
+
+   return *end == '\0' ? n : 0;
+}
+
+/*
+   Parse a size such as 64M or 1G into bytes, returning 0 if str isn't
+   one
+*/
+size_t gc_size(const char * str)
+{
+   char * end;
+   size_t n;
+
+   if (!isdigit(*str))
+      return 0;
+
+   n = strtoul(str, &end, 10);
+
+   if (*end == 'k' || *end == 'K') n <<= 10, end++;
+   else if (*end == 'm' || *end == 'M') n <<= 20, end++;
+   else if (*end == 'g' || *end == 'G') n <<= 30, end++;
+
+   return *end == '\0' ? n : 0;
+}
+
+/*
+   Handle a command line option for the collector. Return 1 if the 
+   option was recognised, otherwise 0.
+*/
+int gc_option(const char * opt)
+{
+   unsigned long v;
+
+   if (strcmp(opt, "--gc-stats") == 0)
+      gc_stats = 1;
+   else if (strcmp(opt, "--gc-incremental") == 0)
+      gc_incremental();
+   else if (strncmp(opt, "--gc-pause=", 11) == 0 && (v = gc_number(opt + 11)) != 0)
+   {
+      gc_pause_limit = v;
+      GC_set_time_limit(gc_pause_limit);
+   }
+   else if (strncmp(opt, "--gc-divisor=", 13) == 0 && (v = gc_number(opt + 13)) != 0)
+      GC_set_free_space_divisor(v);
+   else if (strncmp(opt, "--gc-heap=", 10) == 0 && (v = gc_size(opt + 10)) != 0)
+      gc_heap(v);
+   else
+      return 0;
+
+   return 1;
+}
+
+/*
+   Take a snapshot of the collector counters before running jit'd code
+*/
+void gc_exec_start(void)
+{
+   gc_stmt_bytes = GC_get_total_bytes();
+   gc_stmt_allocs = gc_jit_allocs;
+   gc_stmt_collections = gc_collections;
+   gc_stmt_pause = gc_pause_total;
+}
+
+/*
+   Attribute everything since gc_exec_start to the current statement
+*/
+void gc_exec_end(void)
+{
+   gc_last_bytes = GC_get_total_bytes() - gc_stmt_bytes;
+   gc_last_allocs = gc_jit_allocs - gc_stmt_allocs;
+   gc_last_collections = gc_collections - gc_stmt_collections;
+   gc_last_pause = gc_pause_total - gc_stmt_pause;
+}
+
+/*
+   Print what the collector did while running the last statement
+*/
+void gc_stmt_report(void)
+{
+   printf("gc: %lu bytes in %ld allocations, %lu collections (%.2f ms), heap %lu bytes\n",
+          (unsigned long) gc_last_bytes, gc_last_allocs, gc_last_collections, 
+          gc_last_pause, (unsigned long) GC_get_heap_size());
+}
+
+/*
+   Print totals for the session
+*/
+void gc_report(void)
+{
+   printf("heap size:          %lu bytes\n", (unsigned long) GC_get_heap_size());
+   printf("free bytes:         %lu bytes\n", (unsigned long) GC_get_free_bytes());
+   printf("total allocated:    %lu bytes\n", (unsigned long) GC_get_total_bytes());
+   printf("jit'd allocations:  %ld\n", gc_jit_allocs);
+   printf("collections:        %lu\n", gc_collections);
+   printf("total pause:        %.2f ms\n", gc_pause_total);
+   printf("max pause:          %.2f ms\n", gc_pause_max);
+   printf("free space divisor: %lu\n", (unsigned long) GC_get_free_space_divisor());
+   printf("incremental:        %s\n", GC_is_incremental_mode() ? "on" : "off");
+   printf("pause target:       %lu ms\n", gc_pause_limit);
+   printf("idle collection:    %s\n", gc_idle_collect ? "on" : "off");
+   printf("statement stats:    %s\n", gc_stats ? "on" : "off");
+}
+
+/*
+   Handle a REPL command, e.g. :gc collect. Return 1 if the command 
+   was recognised, otherwise 0.
+*/
+int gc_command(const char * cmd)
+{
+   char word[32], arg[32];
+   unsigned long v;
+   int n;
+
+   if (strncmp(cmd, "gc", 2) != 0 || (cmd[2] != '\0' && !isspace(cmd[2])))
+      return 0;
+
+   n = sscanf(cmd + 2, "%31s %31s", word, arg);
+
+   if (n < 1)
+      gc_report();
+   else if (strcmp(word, "stats") == 0 && n == 2 && strcmp(arg, "on") == 0)
+      gc_stats = 1;
+   else if (strcmp(word, "stats") == 0 && n == 2 && strcmp(arg, "off") == 0)
+      gc_stats = 0;
+   else if (strcmp(word, "collect") == 0)
+   {
+      double t = gc_time();
+      GC_gcollect();
+      printf("gc: collected in %.2f ms, heap %lu bytes\n", gc_time() - t, 
+             (unsigned long) GC_get_heap_size());
+   } else if (strcmp(word, "divisor") == 0 && n == 2 && (v = gc_number(arg)) != 0)
+      GC_set_free_space_divisor(v);
+   else if (strcmp(word, "heap") == 0 && n == 2 && (v = gc_size(arg)) != 0)
+      gc_heap(v);
+   else if (strcmp(word, "incremental") == 0)
+      gc_incremental();
+   else if (strcmp(word, "pause") == 0 && n == 2 && (v = gc_number(arg)) != 0)
+   {
+      gc_pause_limit = v;
+      GC_set_time_limit(gc_pause_limit);
+   } else if (strcmp(word, "idle") == 0 && n == 2 && strcmp(arg, "on") == 0)
+      gc_idle_collect = 1;
+   else if (strcmp(word, "idle") == 0 && n == 2 && strcmp(arg, "off") == 0)
+      gc_idle_collect = 0;
+   else
+      printf("Usage: :gc [stats on|off | collect | divisor <n> | heap <size> | incremental | pause <ms> | idle on|off]\n");
+
+   return 1;
+}
@@ -0,0 +1,77 @@
+/*
+
+Copyright 2012 William Hart. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are
+permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this list of
+      conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice, this list
+      of conditions and the following disclaimer in the documentation and/or other materials
+      provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY William Hart ``AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL William Hart OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <sys/time.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include "gc.h"
+
+#ifndef GCSTAT_H
+#define GCSTAT_H
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+extern int gc_stats; /* report GC activity after each statement */
+
+extern long gc_jit_allocs; /* number of allocations made by jit'd code */
+
+extern int gc_idle_collect; /* do collector work while waiting for input */
+
+#define GC_PAUSE_DEFAULT 5 /* target pause in ms for incremental mode */
+
+void gc_count(void);
+
+void gc_init(void);
+
+void gc_incremental(void);
+
+void gc_idle(FILE * in, const char * buf, long len);
+
+int gc_option(const char * opt);
+
+int gc_command(const char * cmd);
+
+void gc_exec_start(void);
+
+void gc_exec_end(void);
+
+void gc_stmt_report(void);
+
+void gc_report(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
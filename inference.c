@@ -25,6 +25,9 @@ ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
 #include "inference.h"
+#include "escape.h"
+#include "range.h"
+#include "fold.h"
 
 /*
    Change AST tag to L-value version of tag
@@ -55,6 +58,8 @@ void assign_inference(ast_t * a, type_t * b)
        bind = find_symbol(a->sym); /* look up identifier */
        if (!bind) /* identifier doesn't exist */
           bind_symbol(a->sym, b, NULL); /* put new identifier in scope */
+       else if (bind->immutable)
+          exception("Attempt to assign to constant\n");
        else if (b != bind->type && reference_type(b) != bind->type) /* identifier type doesn't match expression type */
              exception("Identifier type doesn't match expression type in assignment\n");
        a->type = b; /* infer type of identifier */
@@ -108,6 +113,29 @@ int ast_count(ast_t * a)
    return i;   
 }
 
+/*
+   Infer the type of a bound of a for loop, which must be an int.
+   For convenience, ZZ literals which fit in a word are accepted too.
+*/
+void for_bound(ast_t * a)
+{
+   inference(a);
+   
+   if (a->tag == AST_ZZ)
+   {
+      errno = 0;
+      strtol(a->sym->name, NULL, 10);
+      if (errno == 0)
+      {
+         a->tag = AST_INT;
+         a->type = ctx->t_int;
+      }
+   }
+
+   if (a->type != ctx->t_int)
+      exception("Integer range expected in for statement\n");
+}
+
 /* 
    Do inference for each node of an AST list and return 
    the type of the final node.
@@ -115,7 +143,7 @@ int ast_count(ast_t * a)
 type_t * list_inference(ast_t * a)
 {
    if (a == NULL)
-      return t_nil;
+      return ctx->t_nil;
 
    while (a->next != NULL)
    {
@@ -212,6 +240,34 @@ type_t * match_prototype(type_t * t, ast_t * a, int method)
    return NULL;
 }
 
+/*
+   Check if an argument is a constant, which can't be swapped or passed
+   to a ref parameter
+*/
+int is_constant(ast_t * a)
+{
+   bind_t * bind;
+
+   return a->tag == AST_IDENT && (bind = find_symbol(a->sym)) != NULL 
+       && bind->immutable;
+}
+
+/*
+   Raise an exception if a constant is passed to a ref parameter of the
+   function type t, through which it could be changed. The arguments
+   are matched as for match_prototype.
+*/
+void ref_arg_inference(type_t * t, ast_t * a, int method)
+{
+   int j;
+
+   for (j = 0; a != NULL; a = a->next, j++)
+   {
+      if (t->args[j + method]->tag == REF && is_constant(a))
+         exception("Attempt to assign to constant\n");
+   }
+}
+
 /*
    Given a generic or constructor type t, search through its 
    current list of functions to find one with prototype matching 
@@ -240,6 +296,132 @@ type_t * find_prototype(type_t * t, ast_t * a)
    return NULL; /* didn't find an op with that prototype */
 }
 
+/*
+   Infer map(f, a), filter(f, a) and reduce(f, a, init), where a is an
+   array and f a function. These are builtins rather than functions as
+   they are parametric in the type of the array entries. The node is 
+   retagged and 1 returned, or 0 if a isn't a call to one of them.
+   The arguments must already have been inferred.
+*/
+int array_builtin(ast_t * a)
+{
+   ast_t * id = a->child;
+   ast_t * f = id->next;
+   ast_t * arr, * x, * y;
+   type_t * fn;
+   tag_t tag;
+   int args = 2;
+
+   if (a->tag != AST_APPL || id->tag != AST_IDENT || find_symbol(id->sym) != NULL)
+      return 0; /* user functions of the same name take precedence */
+
+   if (id->sym == sym_lookup("map"))
+      tag = AST_MAP;
+   else if (id->sym == sym_lookup("filter"))
+      tag = AST_FILTER;
+   else if (id->sym == sym_lookup("reduce"))
+   {
+      tag = AST_ARRAY_REDUCE;
+      args = 3;
+   } else
+      return 0;
+
+   if (ast_count(f) != args)
+      exception("Incorrect number of arguments to array builtin\n");
+
+   arr = f->next;
+   if (f->type->tag != GENERIC || arr->type->tag != ARRAY)
+      exception("Function and array expected in array builtin\n");
+
+   /* find the prototype of f taking an entry of the array */
+   x = new_ast();
+   x->type = arr->type->params[0];
+   if (tag == AST_ARRAY_REDUCE) /* and the value so far */
+   {
+      y = new_ast();
+      y->type = arr->next->type;
+      y->next = x;
+      x = y;
+   }
+
+   fn = find_prototype(f->type, x);
+   if (fn == NULL) 
+      exception("Unable to find function prototype matching given argument types\n");
+   
+   if (tag == AST_MAP)
+   {
+      if (fn->ret == ctx->t_nil)
+         exception("Function passed to map must return a value\n");
+      a->type = array_type(fn->ret);
+   } else if (tag == AST_FILTER)
+   {
+      if (fn->ret != ctx->t_bool)
+         exception("Function passed to filter must return a bool\n");
+      a->type = arr->type;
+   } else
+   {
+      if (fn->ret != arr->next->type)
+         exception("Function passed to reduce must return the type of the initial value\n");
+      a->type = fn->ret;
+   }
+
+   a->tag = tag;
+
+   return 1;
+}
+
+/*
+   Infer send(c, v), recv(c, x) and close(c), where c is a channel. As
+   for the array builtins, the node is retagged and 1 returned, or 0 if
+   a isn't a call to one of them. The value received by recv is moved
+   into the variable x, and the result says whether there was one.
+*/
+int chan_builtin(ast_t * a)
+{
+   ast_t * id = a->child;
+   ast_t * c = id->next;
+   bind_t * bind;
+   tag_t tag;
+   int args = 2;
+
+   if (a->tag != AST_APPL || id->tag != AST_IDENT || find_symbol(id->sym) != NULL)
+      return 0; /* user functions of the same name take precedence */
+
+   if (id->sym == sym_lookup("send"))
+      tag = AST_SEND;
+   else if (id->sym == sym_lookup("recv"))
+      tag = AST_RECV;
+   else if (id->sym == sym_lookup("close"))
+   {
+      tag = AST_CLOSE;
+      args = 1;
+   } else
+      return 0;
+
+   if (ast_count(c) != args)
+      exception("Incorrect number of arguments to channel builtin\n");
+
+   if (c->type->tag != CHAN)
+      exception("Channel expected in channel builtin\n");
+
+   if (tag != AST_CLOSE && c->next->type != c->type->params[0])
+      exception("Type does not match channel in channel builtin\n");
+
+   if (tag == AST_RECV)
+   {
+      if (c->next->tag != AST_IDENT)
+         exception("Variable expected in recv\n");
+      bind = find_symbol(c->next->sym);
+      if (bind->immutable)
+         exception("Attempt to assign to constant\n");
+   }
+
+   a->type = (tag == AST_RECV ? ctx->t_bool : ctx->t_nil);
+   a->tag = tag;
+
+   return 1;
+}
+
 /*
    Annotate an AST with known types
 */
@@ -249,32 +431,32 @@ void inference(ast_t * a)
    type_t * t1, * t2, * f1;
    type_t ** args, ** fns;
    sym_t ** slots;
-   ast_t * a1, * a2, * a3, * a4;
+   ast_t * a1, * a2, * a3, * a4, * a5;
    env_t * scope_save;
    int i, j, k;
 
    switch (a->tag)
    {
    case AST_NONE:
-      a->type = t_nil;
+      a->type = ctx->t_nil;
       break;
    case AST_ZZ:
-      a->type = t_ZZ;
+      a->type = ctx->t_ZZ;
       break;
    case AST_INT:
-      a->type = t_int;
+      a->type = ctx->t_int;
       break;
    case AST_UINT:
-      a->type = t_uint;
+      a->type = ctx->t_uint;
       break;
    case AST_DOUBLE:
-      a->type = t_double;
+      a->type = ctx->t_double;
       break;
    case AST_CHAR:
-      a->type = t_char;
+      a->type = ctx->t_char;
       break;
    case AST_STRING:
-      a->type = t_string;
+      a->type = ctx->t_string;
       break;
    case AST_BINOP:
       a1 = a->child; /* list of arguments to operator */
@@ -295,7 +477,7 @@ void inference(ast_t * a)
       a2 = a1->next; /* if block */
       a3 = a2->next; /* else block */
       inference(a1);
-      if (a1->type != t_bool)
+      if (a1->type != ctx->t_bool)
          exception("Boolean expression expected in if..else expression\n");
       inference(a2);
       inference(a3);
@@ -308,20 +490,20 @@ void inference(ast_t * a)
       a2 = a1->next; /* if block/stmt */
       a3 = a2->next; /* else block/stmt */
       inference(a1);
-      if (a1->type != t_bool)
+      if (a1->type != ctx->t_bool)
          exception("Boolean expression expected in if..else statement\n");
       inference(a2);
       inference(a3);
-      a->type = t_nil;
+      a->type = ctx->t_nil;
       break;
    case AST_IF_STMT:
       a1 = a->child; /* condition */
       a2 = a1->next; /* if block/stmt */
       inference(a1);
-      if (a1->type != t_bool)
+      if (a1->type != ctx->t_bool)
          exception("Boolean expression expected in if statement\n");
       inference(a2);
-      a->type = t_nil;
+      a->type = ctx->t_nil;
       break;
    case AST_THEN: /* TODO: are these tags needed any more within if/while? */
    case AST_ELSE:
@@ -335,19 +517,62 @@ void inference(ast_t * a)
       a2 = a1->next; /* expression */
       inference(a2);
       assign_inference(a1, a2->type);
-      a->type = t_nil; /* TODO: should assignment be an expression? */
+      a->type = ctx->t_nil; /* TODO: should assignment be an expression? */
+      break;
+   case AST_CONST:
+      a1 = a->child; /* identifier */
+      a2 = a1->next; /* expression */
+      inference(a2);
+      if (find_symbol_in_current_scope(a1->sym) != NULL)
+         exception("Constant name already bound in this scope\n");
+      bind = bind_symbol(a1->sym, a2->type, NULL);
+      bind->immutable = 1;
+      a1->type = a2->type;
+      a->type = ctx->t_nil;
       break;
    case AST_WHILE_STMT:
       a1 = a->child; /* condition */
       a2 = a1->next; /* while block/stmt */
       inference(a1);
-      if (a1->type != t_bool)
+      if (a1->type != ctx->t_bool)
          exception("Boolean expression expected in while statement\n");
       inference(a2);
-      a->type = t_nil;
+      a->type = ctx->t_nil;
+      break;
+   case AST_FOR_STMT:
+   case AST_PARFOR_STMT:
+      a1 = a->child; /* loop variable */
+      a2 = a1->next; /* start of range */
+      a3 = a2->next; /* end of range (exclusive) */
+      a4 = a3->next; /* loop block/stmt */
+      for_bound(a2);
+      for_bound(a3);
+      for (a5 = a4->next; a5 != NULL; a5 = a5->next) /* reductions */
+         inference(a5);
+      a->env = scope_up(); /* loop variable is local to the loop */
+      bind = bind_symbol(a1->sym, ctx->t_int, NULL);
+      bind->immutable = 1;
+      a1->type = ctx->t_int;
+      if (a->tag == AST_PARFOR_STMT) /* body is run as a separate function */
+         bind_symbol(sym_lookup("return"), NULL, NULL);
+      inference(a4);
+      scope_down();
+      a->type = ctx->t_nil;
+      break;
+   case AST_REDUCE:
+      a1 = a->child; /* reduction variable */
+      bind = find_symbol(a1->sym);
+      if (bind == NULL)
+         exception("Symbol not found in reduction\n");
+      if (bind->immutable)
+         exception("Attempt to assign to constant\n");
+      if (bind->type != ctx->t_int && bind->type != ctx->t_double && bind->type != ctx->t_ZZ)
+         exception("Reduction variable must be int, double or ZZ\n");
+      a1->type = bind->type;
+      a->type = ctx->t_nil;
       break;
    case AST_BREAK:
-      a->type = t_nil;
+      a->type = ctx->t_nil;
       break;
    case AST_DATA_STMT:
       a1 = a->child; /* name of type */
@@ -368,7 +593,7 @@ void inference(ast_t * a)
       assign_args(t1->args, a3); /* infer types of slots in new data type */
       f1->args[0] = pointer_type(t1); /* first arg is for `this' */
       assign_syms(t1->slots, a3); /* fill in slot names in new data type */
-      a->type = t_nil;
+      a->type = ctx->t_nil;
       break;
    case AST_DATA_BODY:
       a1 = a->child; /* list of slot names with types (data slots) */
@@ -432,7 +657,7 @@ void inference(ast_t * a)
          t1 = generic_type(1, fns); /* new generic containing function */
          bind_generic(a1->sym, t1); /* bind function name to generic */
       }   
-      a->type = t_nil;
+      a->type = ctx->t_nil;
       break;
    case AST_PARAM_BODY:
       a1 = a->child; /* list of parameter names with types */
@@ -447,10 +672,13 @@ void inference(ast_t * a)
       break;
    case AST_FN_BODY: /* called on demand when jit'ing function */
       a1 = a->child->next->next->next; /* fn block (body) */ 
-      scope_save = current_scope; /* save current scope */
-      current_scope = a->env; /* load function scope */
+      scope_save = ctx->current_scope; /* save current scope */
+      ctx->current_scope = a->env; /* load function scope */
       inference(a1); 
-      current_scope = scope_save; /* restore scope */
+      constant_folding(a1); /* evaluate literal subexpressions */
+      escape_analysis(a1); /* find arrays which can live on the stack */
+      range_analysis(a1, a->env); /* find ZZ variables which fit in a word */
+      ctx->current_scope = scope_save; /* restore scope */
       break;
    case AST_RETURN:
       a1 = a->child; /* return expression */
@@ -458,16 +686,19 @@ void inference(ast_t * a)
       bind = find_symbol(sym_lookup("return")); /* look return up in fn scope */
       if (bind == NULL) /* TODO: prevent this at the grammar level */
          exception("Return outside of a function");
+      if (bind->type == NULL)
+         exception("Return inside parallel for");
       if (bind->type != a1->type) /* check function return type matches return expression */
          exception("Return type does not match prototype in function definition");
-      a->type = t_nil;
+      a->type = ctx->t_nil;
       break;
    case AST_ARRAY_CONSTRUCTOR:
+   case AST_LOCAL_ARRAY_CONSTRUCTOR:
       a1 = a->child; /* type of array elements */
       a2 = a1->next; /* expression giving number of elements */
       inference(a2);
       inference(a1);
-      if (a2->type != t_int)
+      if (a2->type != ctx->t_int)
          exception("Number of elements in an array must be an int\n");
       t1 = array_type(a1->type); /* type of array is parameterised by type of elements */
       a->type = t1;
@@ -478,6 +709,39 @@ void inference(ast_t * a)
       t1 = array_type(a1->type); /* type of array is parameterised by type of elements */
       a->type = t1;
       break;
+   case AST_CHAN_CONSTRUCTOR:
+      a1 = a->child; /* type of values */
+      a2 = a1->next; /* expression giving capacity */
+      inference(a2);
+      inference(a1);
+      if (a2->type != ctx->t_int)
+         exception("Capacity of a channel must be an int\n");
+      a->type = chan_type(a1->type);
+      break;
+   case AST_CHAN_TYPE:
+      a1 = a->child; /* type of values */
+      inference(a1);
+      a->type = chan_type(a1->type);
+      break;
+   case AST_FUTURE_TYPE:
+      a1 = a->child; /* type of result */
+      inference(a1);
+      a->type = future_type(a1->type);
+      break;
+   case AST_SPAWN:
+      a1 = a->child; /* call to run as a task */
+      inference(a1);
+      if (a1->tag != AST_APPL || a1->child->type->tag != GENERIC)
+         exception("Function call expected in spawn\n");
+      a->type = future_type(a1->type);
+      break;
+   case AST_AWAIT:
+      a1 = a->child; /* future */
+      inference(a1);
+      if (a1->type->tag != FUTURE)
+         exception("Future expected in await\n");
+      a->type = a1->type->params[0];
+      break;
    case AST_IDENT:
       bind = find_symbol(a->sym); /* look up identifier */
       if (!bind)
@@ -516,8 +780,20 @@ void inference(ast_t * a)
    case AST_LLOCN:
       a1 = a->child; /* the root of the locn (array name, appl, slot or another locn) */
       a2 = a1->next; /* expression giving the index in the array */
+      if (a2->tag == AST_TUPLE) /* m[i, j] entry of a matrix */
+      {
+         inference(a1);
+         if (a1->type != ctx->t_fmpz_mat)
+            exception("Attempt to doubly index something which is not a matrix\n");
+         list_inference(a2->child);
+         if (a2->child->type != ctx->t_int || a2->child->next->type != ctx->t_int)
+            exception("Matrix index must be of int type\n");
+         a2->type = ctx->t_nil;
+         a->type = ctx->t_ZZ; /* entries are ZZ's, accessed in place */
+         break;
+      }
       inference(a2);
-      if (a2->type != t_int)
+      if (a2->type != ctx->t_int)
          exception("Array index must be of int type\n");
       inference(a1);
       t1 = a1->type; /* type of root */
@@ -531,6 +807,8 @@ void inference(ast_t * a)
       a1 = a->child; /* the root of the appl (fn name, locn, slot or another appl) */
       a2 = a1->next; /* list of arguments for function application */
       list_inference(a2);
+      if (array_builtin(a) || chan_builtin(a))
+         break;
       /* TODO: remove this hack for swap (which needs to be parametric */
       if (a1->tag == AST_IDENT && a1->sym == sym_lookup("swap"))
       {
@@ -538,10 +816,12 @@ void inference(ast_t * a)
             exception("Incorrect number of arguments to swap\n");
          if (a2->type != a2->next->type)
             exception("Types do not match in swap\n");
+         if (is_constant(a2) || is_constant(a2->next))
+            exception("Attempt to assign to constant\n");
          if (a2->type->tag == ARRAY || a2->type->tag == DATA)
          {
-            a1->type = t_nil;
-            a->type = t_nil;
+            a1->type = ctx->t_nil;
+            a->type = ctx->t_nil;
             break;
          }
       } 
@@ -552,8 +832,24 @@ void inference(ast_t * a)
       t2 = find_prototype(t1, a2); /* find matching prototype in generic or constructor */
       if (t2 == NULL) 
          exception("Unable to find function prototype matching given argument types\n");
+      ref_arg_inference(t2, a2, t1->tag == CONSTRUCTOR);
       a->type = t2->ret; /* type of application is return type of function */
       break;
+   case AST_MAP: /* already inferred, e.g. by a previous pass */
+   case AST_FILTER:
+   case AST_ARRAY_REDUCE:
+   case AST_SEND:
+   case AST_RECV:
+   case AST_CLOSE:
+      break;
+   case AST_BACKGROUND:
+      inference(a->child);
+      a->type = a->child->type;
+      break;
+   case AST_INT_TO_ZZ: /* inserted by range analysis */
+      inference(a->child);
+      a->type = ctx->t_ZZ;
+      break;
    default:
       exception("Unknown AST tag in inference\n");
    }
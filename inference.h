@@ -24,6 +24,9 @@ ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 */
 
+#include <errno.h>
+#include <stdlib.h>
+
 #include "gc.h"
 
 #include "ast.h"
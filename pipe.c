@@ -0,0 +1,232 @@
+/*
+
+Copyright 2012 William Hart. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are
+permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this list of
+      conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice, this list
+      of conditions and the following disclaimer in the documentation and/or other materials
+      provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY William Hart ``AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL William Hart OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "pipe.h"
+
+/*
+   Wait for the next statement to run and take it off the queue. 
+   Returns NULL if the pipeline has been stopped and there are no 
+   statements left.
+*/
+job_t * pipe_next(pipe_t * p)
+{
+   job_t * j;
+
+   pthread_mutex_lock(&p->lock);
+   
+   while (p->head == NULL && !p->stop)
+      pthread_cond_wait(&p->cond, &p->lock);
+
+   if ((j = p->head) != NULL)
+   {
+      p->head = j->next;
+      if (p->head == NULL)
+         p->tail = NULL;
+      p->busy = 1;
+   }
+
+   pthread_mutex_unlock(&p->lock);
+
+   return j;
+}
+
+/*
+   Report that the statement taken by pipe_next has finished
+*/
+void pipe_done(pipe_t * p)
+{
+   pthread_mutex_lock(&p->lock);
+   p->busy = 0;
+   pthread_cond_broadcast(&p->cond);
+   pthread_mutex_unlock(&p->lock);
+}
+
+/*
+   Main loop of the execute thread. Statements are run in the order
+   they were compiled and their values printed.
+*/
+void * pipe_exec(void * arg)
+{
+   pipe_t * p = (pipe_t *) arg;
+   job_t * volatile j;
+   volatile int printing;
+   LLVMGenericValueRef gen_val;
+
+   context_enter(p->ctx);
+
+   while (1)
+   {
+      printing = 0;
+      
+      if (!setjmp(exc))
+      {
+         if ((j = pipe_next(p)) == NULL)
+            break;
+
+         gc_exec_start();
+         gen_val = exec_call(j->code, j->type, j->ret);
+         gc_exec_end();
+
+         jit_lock(ctx->jit);
+         printing = 1;
+         
+         LLVMDeleteFunction(j->function);
+         print_gen(ctx->jit, j->type, gen_val), printf("\n");
+         if (gc_stats)
+            gc_stmt_report();
+         fflush(stdout);
+      } else if (!printing) /* exception raised by the statement */
+      {
+         jit_lock(ctx->jit);
+         LLVMDeleteFunction(j->function);
+      }
+         
+      jit_unlock(ctx->jit);
+      pipe_done(p);
+   }
+
+   return NULL;
+}
+
+/*
+   Start running statements of the engine c on a thread of their own
+*/
+pipe_t * pipe_start(context_t * c)
+{
+   pipe_t * p = (pipe_t *) GC_MALLOC_UNCOLLECTABLE(sizeof(pipe_t));
+
+   pthread_mutex_init(&p->lock, NULL);
+   pthread_cond_init(&p->cond, NULL);
+
+   p->ctx = c;
+
+   if (pthread_create(&p->thread, NULL, pipe_exec, p) != 0)
+      exception("Unable to start execute thread\n");
+
+   c->pipe = p;
+
+   return p;
+}
+
+/*
+   Wait for the queued statements to run, then stop the execute thread
+*/
+void pipe_stop(pipe_t * p)
+{
+   pthread_mutex_lock(&p->lock);
+   p->stop = 1;
+   pthread_cond_broadcast(&p->cond);
+   pthread_mutex_unlock(&p->lock);
+
+   pthread_join(p->thread, NULL);
+
+   ctx->pipe = NULL;
+
+   pthread_mutex_destroy(&p->lock);
+   pthread_cond_destroy(&p->cond);
+   
+   GC_FREE(p);
+}
+
+/*
+   Check if every queued statement has run
+*/
+int pipe_idle(pipe_t * p)
+{
+   int idle;
+
+   pthread_mutex_lock(&p->lock);
+   idle = (p->head == NULL && !p->busy);
+   pthread_mutex_unlock(&p->lock);
+
+   return idle;
+}
+
+/*
+   Check if a statement uses a global constant. Its value can only be
+   embedded in the code once the statement defining it has run.
+*/
+int pipe_uses_const(ast_t * ast)
+{
+   ast_t * c;
+   bind_t * bind;
+
+   if (ast->tag == AST_IDENT && (bind = find_symbol(ast->sym)) != NULL
+    && bind->immutable && scope_is_global(bind))
+      return 1;
+
+   for (c = ast->child; c != NULL; c = c->next)
+      if (pipe_uses_const(c))
+         return 1;
+
+   return 0;
+}
+
+/*
+   Compile a statement whose types have been inferred and queue it to
+   be run. The compile thread must hold the jit.
+*/
+void pipe_push(pipe_t * p, jit_t * jit, ast_t * ast)
+{
+   job_t * j = (job_t *) GC_MALLOC(sizeof(job_t));
+
+   if (pipe_uses_const(ast)) /* wait for the constants to be computed */
+      pipe_sync(p);
+
+   j->type = ast->type;
+   j->ret = type_to_generic_llvm(jit, ast->type);
+   j->function = exec_compile(jit, ast);
+   j->code = LLVMGetPointerToGlobal(jit->engine, j->function);
+   
+   pthread_mutex_lock(&p->lock);
+   
+   if (p->tail == NULL)
+      p->head = j;
+   else
+      p->tail->next = j;
+   p->tail = j;
+   
+   pthread_cond_broadcast(&p->cond);
+   pthread_mutex_unlock(&p->lock);
+}
+
+/*
+   Wait until every queued statement has run, e.g. because the next 
+   statement needs a value computed by an earlier one. The compile 
+   thread must hold the jit, which is given up while waiting, so this
+   is only done between statements.
+*/
+void pipe_sync(pipe_t * p)
+{
+   jit_unlock(p->ctx->jit);
+
+   pthread_mutex_lock(&p->lock);
+   while (p->head != NULL || p->busy)
+      pthread_cond_wait(&p->cond, &p->lock);
+   pthread_mutex_unlock(&p->lock);
+
+   jit_lock(p->ctx->jit);
+}
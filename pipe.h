@@ -0,0 +1,84 @@
+/*
+
+Copyright 2012 William Hart. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are
+permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this list of
+      conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice, this list
+      of conditions and the following disclaimer in the documentation and/or other materials
+      provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY William Hart ``AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL William Hart OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "thread.h"
+
+#include "exception.h"
+#include "backend.h"
+
+#ifndef PIPE_H
+#define PIPE_H
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+/*
+   A statement which has been compiled and is waiting to be run
+*/
+typedef struct job_t
+{
+   LLVMValueRef function; /* the exec function of the statement */
+   void * code; /* machine code for the function */
+   type_t * type; /* type of the value of the statement */
+   LLVMTypeRef ret; /* return type of the function */
+   struct job_t * next;
+} job_t;
+
+/*
+   In pipelined mode the REPL parses and compiles statements on one
+   thread while an execute thread runs them, in order. The compile 
+   thread holds the jit while it works on a statement. The execute
+   thread only needs it to print values and delete functions.
+*/
+typedef struct pipe_t
+{
+   pthread_t thread; /* the execute thread */
+   pthread_mutex_t lock; /* protects the queue */
+   pthread_cond_t cond; /* signalled when the queue changes */
+   job_t * head, * tail; /* statements waiting to run */
+   int busy; /* the execute thread is running a statement */
+   int stop; /* the execute thread should exit once the queue is empty */
+   context_t * ctx; /* the engine whose statements are run */
+} pipe_t;
+
+pipe_t * pipe_start(context_t * c);
+
+void pipe_stop(pipe_t * p);
+
+void pipe_push(pipe_t * p, jit_t * jit, ast_t * ast);
+
+void pipe_sync(pipe_t * p);
+
+int pipe_idle(pipe_t * p);
+
+int pipe_uses_const(ast_t * ast);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
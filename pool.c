@@ -0,0 +1,520 @@
+/*
+
+Copyright 2012 William Hart. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are
+permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this list of
+      conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice, this list
+      of conditions and the following disclaimer in the documentation and/or other materials
+      provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY William Hart ``AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL William Hart OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "pool.h"
+
+int pool_threads = 0; /* number of threads, including the one starting a loop */
+
+worker_t pool_workers[POOL_MAX_THREADS];
+
+pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER; /* protects pool_gen, pool_pending and tasks */
+pthread_mutex_t pool_busy = PTHREAD_MUTEX_INITIALIZER; /* held while a loop is running */
+pthread_mutex_t pool_reduce = PTHREAD_MUTEX_INITIALIZER; /* serialises reductions */
+pthread_cond_t pool_start = PTHREAD_COND_INITIALIZER;
+pthread_cond_t pool_done = PTHREAD_COND_INITIALIZER;
+pthread_cond_t pool_ready = PTHREAD_COND_INITIALIZER; /* a task has finished */
+
+/* the loop currently being run */
+pool_fn_t pool_fn;
+void * pool_env;
+context_t * pool_ctx; /* context of the thread which started the loop */
+long pool_chunk;
+unsigned long pool_gen = 0; /* incremented each time a loop starts */
+int pool_pending = 0; /* worker threads yet to finish the current loop */
+int pool_queued = 0; /* tasks waiting in queues */
+const char * volatile pool_error = NULL; /* first exception raised by the current loop */
+
+__thread int pool_inside = 0; /* set while this thread runs a loop body or task */
+__thread int pool_id = 0; /* index of the worker for this thread */
+
+/*
+   Claim the next chunk of iterations from the front of a thread's
+   own range. Returns 0 if the range is exhausted.
+*/
+int pool_claim(worker_t * w, long * lo, long * hi)
+{
+   int found = 0;
+
+   pthread_mutex_lock(&w->lock);
+   if (w->lo < w->hi && pool_error == NULL) /* after an error, drain */
+   {
+      *lo = w->lo;
+      *hi = w->hi - w->lo > pool_chunk ? w->lo + pool_chunk : w->hi;
+      w->lo = *hi;
+      found = 1;
+   }
+   pthread_mutex_unlock(&w->lock);
+
+   return found;
+}
+
+/*
+   Steal the back half of another thread's remaining iterations and
+   make them our own range. Returns 0 if there was nothing to steal.
+   Our own range is empty while the stolen iterations are in transit,
+   so nobody can steal them back from under us.
+*/
+int pool_steal(int id)
+{
+   int i;
+   long lo, hi;
+   worker_t * w;
+
+   for (i = 1; i < pool_threads && pool_error == NULL; i++)
+   {
+      w = pool_workers + (id + i) % pool_threads;
+      
+      pthread_mutex_lock(&w->lock);
+      lo = w->lo;
+      hi = w->hi;
+      if (lo < hi)
+      {
+         lo += (hi - lo)/2;
+         w->hi = lo;
+      }
+      pthread_mutex_unlock(&w->lock);
+
+      if (lo < hi)
+      {
+         w = pool_workers + id;
+         pthread_mutex_lock(&w->lock);
+         w->lo = lo;
+         w->hi = hi;
+         pthread_mutex_unlock(&w->lock);
+         
+         return 1;
+      }
+   }
+
+   return 0;
+}
+
+/*
+   Record an exception raised by a chunk of the current loop. Only the
+   first is kept. No more chunks are started once one has failed.
+*/
+void pool_fail(const char * err)
+{
+   pthread_mutex_lock(&pool_mutex);
+   if (pool_error == NULL)
+      pool_error = err;
+   pthread_mutex_unlock(&pool_mutex);
+}
+
+/*
+   Run chunks of the current loop until there is no work left
+   anywhere in the pool. Exceptions are caught and recorded, to be
+   raised again by the thread which started the loop.
+*/
+void pool_work(int id)
+{
+   long lo, hi;
+   worker_t * w = pool_workers + id;
+   context_t * prev = context_enter(pool_ctx);
+   int quiet = exc_quiet;
+   jmp_buf save;
+
+   memcpy(save, exc, sizeof(jmp_buf));
+   exc_quiet = 1;
+   pool_inside = 1;
+   
+   if (setjmp(exc))
+      pool_fail(exc_msg);
+
+   do
+   {
+      while (pool_claim(w, &lo, &hi))
+         pool_fn(lo, hi, pool_env);
+   } while (pool_steal(id));
+
+   pool_inside = 0;
+   exc_quiet = quiet;
+   memcpy(exc, save, sizeof(jmp_buf));
+
+   context_enter(prev);
+}
+
+/*
+   Put a task at the front of the queue of the given thread. The caller
+   must hold pool_mutex.
+*/
+void pool_push(int id, task_t * t)
+{
+   worker_t * w = pool_workers + id;
+
+   t->state = TASK_QUEUED;
+   t->owner = id;
+   t->prev = NULL;
+   t->next = w->head;
+   
+   if (w->head != NULL)
+      w->head->prev = t;
+   else
+      w->tail = t;
+   w->head = t;
+
+   pool_queued++;
+}
+
+/*
+   Remove a task from the queue it is on and mark it running. The 
+   caller must hold pool_mutex.
+*/
+void pool_unlink(task_t * t)
+{
+   worker_t * w = pool_workers + t->owner;
+
+   if (t->prev != NULL)
+      t->prev->next = t->next;
+   else
+      w->head = t->next;
+
+   if (t->next != NULL)
+      t->next->prev = t->prev;
+   else
+      w->tail = t->prev;
+
+   t->prev = t->next = NULL;
+   t->state = TASK_RUNNING;
+
+   pool_queued--;
+}
+
+/*
+   Take a task to run, the newest from our own queue if there is one, 
+   otherwise the oldest from the queue of another thread. Returns NULL
+   if nothing is queued. The caller must hold pool_mutex.
+*/
+task_t * pool_take(int id)
+{
+   int i;
+   task_t * t;
+
+   if (pool_queued == 0)
+      return NULL;
+
+   t = pool_workers[id].head;
+   
+   for (i = 1; t == NULL && i < pool_threads; i++)
+      t = pool_workers[(id + i) % pool_threads].tail;
+
+   if (t != NULL)
+      pool_unlink(t);
+
+   return t;
+}
+
+/*
+   Run a task which has been taken from a queue. The caller holds 
+   pool_mutex, which is released while the task runs. Loops inside a 
+   task are run serially, as the workers may be busy with other tasks 
+   which are waiting on this one. An exception raised by the task is
+   kept, to be raised again by await.
+*/
+void pool_run(task_t * t)
+{
+   int inside = pool_inside, quiet = exc_quiet;
+   context_t * prev;
+   jmp_buf save;
+
+   pthread_mutex_unlock(&pool_mutex);
+
+   memcpy(save, exc, sizeof(jmp_buf));
+   prev = context_enter(t->ctx);
+   pool_inside = 1;
+   exc_quiet = 1;
+   
+   if (!setjmp(exc))
+      t->fn(0, 0, t->env);
+   else
+      t->error = exc_msg;
+   
+   exc_quiet = quiet;
+   pool_inside = inside;
+   memcpy(exc, save, sizeof(jmp_buf));
+   context_enter(prev);
+
+   pthread_mutex_lock(&pool_mutex);
+   
+   t->state = TASK_DONE;
+   pthread_cond_broadcast(&pool_ready);
+}
+
+/*
+   Main loop of a worker thread. Workers sleep until a loop starts or
+   a task is queued. They help run the loop then report back, or run
+   the task.
+*/
+void * pool_worker(void * arg)
+{
+   int id = (int) (long) arg;
+   unsigned long gen = 0;
+   task_t * t;
+
+   pool_id = id;
+
+   while (1)
+   {
+      pthread_mutex_lock(&pool_mutex);
+      while (pool_gen == gen && pool_queued == 0)
+         pthread_cond_wait(&pool_start, &pool_mutex);
+      
+      if (pool_gen == gen) /* no new loop, so there is a task */
+      {
+         if ((t = pool_take(id)) != NULL)
+            pool_run(t);
+         pthread_mutex_unlock(&pool_mutex);
+         continue;
+      }
+      
+      gen = pool_gen;
+      pthread_mutex_unlock(&pool_mutex);
+
+      pool_work(id);
+
+      pthread_mutex_lock(&pool_mutex);
+      if (--pool_pending == 0)
+         pthread_cond_signal(&pool_done);
+      pthread_mutex_unlock(&pool_mutex);
+   }
+
+   return NULL;
+}
+
+/*
+   Start the worker threads. The number of threads is taken from 
+   $BACON_THREADS, defaulting to the number of cores. As gc.h is 
+   included with GC_THREADS defined, the workers are registered with 
+   the collector, so jit'd loop bodies and tasks can allocate.
+*/
+void pool_start_threads(void)
+{
+   int i;
+   char * env = getenv("BACON_THREADS");
+
+   pool_threads = env != NULL ? atoi(env) : (int) sysconf(_SC_NPROCESSORS_ONLN);
+   
+   if (pool_threads < 1)
+      pool_threads = 1;
+   if (pool_threads > POOL_MAX_THREADS)
+      pool_threads = POOL_MAX_THREADS;
+
+   for (i = 0; i < pool_threads; i++)
+      pthread_mutex_init(&pool_workers[i].lock, NULL);
+
+   for (i = 1; i < pool_threads; i++)
+   {
+      if (pthread_create(&pool_workers[i].thread, NULL, pool_worker, (void *) (long) i) != 0)
+      {
+         pool_threads = i; /* make do with what we have */
+         break;
+      }
+   }
+}
+
+/*
+   Start the pool if it isn't running yet
+*/
+void pool_init(void)
+{
+   pthread_once(&pool_once, pool_start_threads);
+}
+
+/*
+   Run fn over the iterations [lo, hi), split into chunks across the
+   pool, and return once they have all completed. Loops started from
+   inside a loop body, or while another thread's loop is running, are
+   run serially by the calling thread, as are loops started by worker
+   threads. If a chunk raises an exception, the chunks already running
+   are allowed to finish and it is raised again here.
+*/
+void pool_for(pool_fn_t fn, void * env, long lo, long hi)
+{
+   int i;
+   long n = hi - lo, q, r;
+   worker_t * w;
+   const char * err;
+
+   if (lo >= hi)
+      return;
+
+   pool_init();
+
+   if (pool_inside || pool_id != 0 || pool_threads == 1 || n == 1 
+    || pthread_mutex_trylock(&pool_busy) != 0)
+   {
+      fn(lo, hi, env);
+      return;
+   }
+
+   pool_fn = fn;
+   pool_env = env;
+   pool_ctx = ctx;
+   pool_chunk = n/(pool_threads*POOL_CHUNKS);
+   if (pool_chunk == 0)
+      pool_chunk = 1;
+
+   /* give each thread an equal share of the iterations to start with */
+   q = n/pool_threads;
+   r = n%pool_threads;
+   for (i = 0; i < pool_threads; i++)
+   {
+      w = pool_workers + i;
+      pthread_mutex_lock(&w->lock);
+      w->lo = lo + i*q + (i < r ? i : r);
+      w->hi = w->lo + q + (i < r);
+      pthread_mutex_unlock(&w->lock);
+   }
+
+   /* wake the workers */
+   pthread_mutex_lock(&pool_mutex);
+   pool_pending = pool_threads - 1;
+   pool_gen++;
+   pthread_cond_broadcast(&pool_start);
+   pthread_mutex_unlock(&pool_mutex);
+
+   pool_work(0); /* the calling thread takes part */
+
+   pthread_mutex_lock(&pool_mutex);
+   while (pool_pending != 0)
+      pthread_cond_wait(&pool_done, &pool_mutex);
+   err = pool_error;
+   pool_error = NULL;
+   pthread_mutex_unlock(&pool_mutex);
+
+   pthread_mutex_unlock(&pool_busy);
+
+   if (err != NULL)
+      exception(err);
+}
+
+/*
+   Return the number of blocks to split n items into for a parallel 
+   reduction whose partial results are combined in order. There are
+   enough blocks to balance the load, but no empty ones.
+*/
+long pool_blocks(long n)
+{
+   long b;
+   
+   pool_init();
+
+   b = pool_threads*POOL_CHUNKS;
+
+   return n < b ? n : b;
+}
+
+/*
+   Start a task which runs fn(0, 0, env) and return it as a future. The
+   task is queued on the calling thread, for an idle thread to steal, 
+   unless there are no other threads, in which case it is run now.
+*/
+task_t * pool_spawn(pool_fn_t fn, void * env)
+{
+   task_t * t = (task_t *) GC_MALLOC(sizeof(task_t));
+   
+   t->fn = fn;
+   t->env = env;
+   t->ctx = ctx;
+
+   pool_init();
+
+   pthread_mutex_lock(&pool_mutex);
+
+   if (pool_threads == 1)
+   {
+      t->state = TASK_RUNNING;
+      pool_run(t);
+   } else
+   {
+      pool_push(pool_id, t);
+      pthread_cond_signal(&pool_start);
+   }
+
+   pthread_mutex_unlock(&pool_mutex);
+
+   return t;
+}
+
+/*
+   Wait for a task to finish and return its environment, from which 
+   the caller moves the result. If the task hasn't started, we run it
+   ourselves. If it is running on another thread, we run other queued
+   tasks while we wait, so that threads awaiting futures can't starve
+   the pool. A future can only be awaited once. If the task raised an
+   exception, it is raised again here.
+*/
+void * pool_await(task_t * t)
+{
+   task_t * u;
+
+   pthread_mutex_lock(&pool_mutex);
+
+   if (t->state == TASK_AWAITED)
+   {
+      pthread_mutex_unlock(&pool_mutex);
+      exception("Future has already been awaited\n");
+   }
+
+   while (t->state != TASK_DONE)
+   {
+      if (t->state == TASK_QUEUED)
+      {
+         pool_unlink(t);
+         u = t;
+      } else
+         u = pool_take(pool_id);
+
+      if (u != NULL)
+         pool_run(u);
+      else
+         pthread_cond_wait(&pool_ready, &pool_mutex);
+   }
+
+   t->state = TASK_AWAITED;
+
+   pthread_mutex_unlock(&pool_mutex);
+
+   if (t->error != NULL)
+      exception(t->error);
+
+   return t->env;
+}
+
+/*
+   Reductions combine their per-thread partial results under this lock
+*/
+void pool_lock(void)
+{
+   pthread_mutex_lock(&pool_reduce);
+}
+
+void pool_unlock(void)
+{
+   pthread_mutex_unlock(&pool_reduce);
+}
+
@@ -0,0 +1,110 @@
+/*
+
+Copyright 2012 William Hart. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are
+permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this list of
+      conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice, this list
+      of conditions and the following disclaimer in the documentation and/or other materials
+      provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY William Hart ``AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL William Hart OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "exception.h"
+#include "thread.h"
+
+#ifndef POOL_H
+#define POOL_H
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#define POOL_MAX_THREADS 256 /* upper limit on worker threads */
+
+#define POOL_CHUNKS 8 /* chunks handed out per thread, per loop */
+
+/* 
+   An outlined loop body, which runs the iterations [lo, hi) using
+   the captured variables in env
+*/
+typedef void (*pool_fn_t)(long lo, long hi, void * env);
+
+#define TASK_QUEUED 0 /* waiting in the queue of a thread */
+#define TASK_RUNNING 1
+#define TASK_DONE 2
+#define TASK_AWAITED 3 /* result has been moved out by await */
+
+/*
+   A task started by spawn. It runs fn(0, 0, env), where env holds the
+   result of the task followed by its arguments. The task is the value
+   of the future returned by spawn.
+*/
+typedef struct task_t
+{
+   pool_fn_t fn;
+   void * env;
+   context_t * ctx; /* context of the thread which spawned it */
+   int state;
+   const char * error; /* exception raised by the task, if any */
+   int owner; /* thread whose queue it was put on */
+   struct task_t * prev, * next; /* links in the queue */
+} task_t;
+
+/*
+   Each thread owns a range of iterations. It takes chunks from the
+   front of its own range and steals from the back of other ranges.
+   Likewise it runs the newest of its own tasks and steals the oldest
+   tasks of other threads.
+*/
+typedef struct worker_t
+{
+   pthread_mutex_t lock;
+   long lo, hi; /* iterations not yet claimed */
+   task_t * head, * tail; /* queued tasks, newest first */
+   pthread_t thread;
+} worker_t;
+
+extern int pool_threads;
+
+extern __thread int pool_inside; /* running a loop body or task */
+
+void pool_init(void);
+
+void pool_for(pool_fn_t fn, void * env, long lo, long hi);
+
+long pool_blocks(long n);
+
+task_t * pool_spawn(pool_fn_t fn, void * env);
+
+void * pool_await(task_t * t);
+
+void pool_lock(void);
+
+void pool_unlock(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
@@ -0,0 +1,617 @@
+/*
+
+Copyright 2012 William Hart. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are
+permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this list of
+      conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice, this list
+      of conditions and the following disclaimer in the documentation and/or other materials
+      provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY William Hart ``AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL William Hart OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "range.h"
+
+/*
+   Range analysis for ZZ variables local to a function. We find local
+   ZZ variables whose values provably fit in a small fmpz (a signed word
+   of at most 62 bits) and compile them as ints instead. Where the value
+   is needed as a ZZ we convert back, which is free since a small fmpz
+   is just the word itself.
+
+   Ranges are computed by iterating over all assignments until nothing
+   changes. An assignment v = v + k (or v - k) is only bounded if it is
+   a statement of the body of a loop while (v < e) (or v > e) and is the
+   only assignment to v in that loop.
+*/
+
+typedef enum
+{
+   RNG_COLLECT, /* find candidate variables */
+   RNG_ITERATE, /* refine ranges */
+   RNG_STRICT /* as above, but anything unknown can't be bounded */
+} rng_pass_t;
+
+rng_t * rng_find(bind_t * bind)
+{
+   rng_t * r;
+
+   for (r = ctx->rng_list; r != NULL; r = r->next)
+      if (r->bind == bind)
+         return r;
+
+   return NULL;
+}
+
+/*
+   Return the candidate for an identifier, or NULL if it isn't one
+*/
+rng_t * rng_lookup(ast_t * a)
+{
+   if (a->tag != AST_IDENT && a->tag != AST_LIDENT)
+      return NULL;
+
+   return rng_find(find_symbol(a->sym));
+}
+
+/*
+   Return 1 if the candidate is to be compiled as an int
+*/
+int rng_demoted(ast_t * a)
+{
+   rng_t * r = rng_lookup(a);
+
+   return r != NULL && !r->top && !r->empty;
+}
+
+void rng_top(rng_t * r)
+{
+   if (r != NULL && !r->top)
+   {
+      r->top = 1;
+      ctx->rng_changed = 1;
+   }
+}
+
+/*
+   Add a new candidate for the variable assigned to in a, if it is a
+   local ZZ variable which isn't a parameter
+*/
+void rng_candidate(ast_t * a)
+{
+   bind_t * bind, * b;
+   rng_t * r;
+
+   if (a->tag != AST_LIDENT || a->type != ctx->t_ZZ)
+      return;
+
+   bind = find_symbol(a->sym);
+   if (bind == NULL || scope_is_global(bind) || rng_find(bind) != NULL)
+      return;
+
+   for (b = ctx->rng_fn_scope->scope; b != NULL; b = b->next)
+      if (b == bind)
+         return;
+
+   r = (rng_t *) GC_MALLOC(sizeof(rng_t));
+   r->bind = bind;
+   r->empty = 1;
+   r->next = ctx->rng_list;
+   ctx->rng_list = r;
+}
+
+/*
+   If a is a ZZ (or int) literal which fits in a small fmpz, set val 
+   to its value and return 1, otherwise return 0
+*/
+int rng_literal(ast_t * a, long * val)
+{
+   if ((a->tag != AST_ZZ && a->tag != AST_INT) || strlen(a->sym->name) > RANGE_DIGITS)
+      return 0;
+
+   *val = atol(a->sym->name);
+   return 1;
+}
+
+int rng_fits(long x)
+{
+   return x >= -RANGE_MAX && x <= RANGE_MAX;
+}
+
+/*
+   Set r to x*y and return 1 if it fits, given |x|, |y| <= RANGE_MAX
+*/
+int rng_mul(long x, long y, long * r)
+{
+   if (x != 0 && labs(y) > RANGE_MAX/labs(x))
+      return 0;
+
+   *r = x*y;
+   return 1;
+}
+
+/*
+   Compute a range [lo, hi] for the values of the expression a, from
+   the current estimates for the candidates
+*/
+rng_res_t rng_expr(ast_t * a, long * lo, long * hi)
+{
+   long l1, h1, l2, h2, p[4];
+   rng_res_t r1, r2;
+   rng_t * r;
+   int i;
+
+   switch (a->tag)
+   {
+   case AST_ZZ:
+   case AST_INT:
+      if (!rng_literal(a, lo))
+         return RNG_TOP;
+      *hi = *lo;
+      return RNG_OK;
+   case AST_IDENT:
+      r = rng_lookup(a);
+      if (r == NULL || r->top)
+         return RNG_TOP;
+      if (r->empty)
+         return RNG_NONE;
+      *lo = r->lo;
+      *hi = r->hi;
+      return RNG_OK;
+   case AST_BINOP:
+      if (a->sym != sym_lookup("+") && a->sym != sym_lookup("-") 
+       && a->sym != sym_lookup("*")) /* ZZ division differs from int division */
+         return RNG_TOP;
+      r1 = rng_expr(a->child, &l1, &h1);
+      r2 = rng_expr(a->child->next, &l2, &h2);
+      if (r1 == RNG_TOP || r2 == RNG_TOP)
+         return RNG_TOP;
+      if (r1 == RNG_NONE || r2 == RNG_NONE)
+         return RNG_NONE;
+      if (a->sym == sym_lookup("+"))
+      {
+         *lo = l1 + l2;
+         *hi = h1 + h2;
+      } else if (a->sym == sym_lookup("-"))
+      {
+         *lo = l1 - h2;
+         *hi = h1 - l2;
+      } else /* * */
+      {
+         if (!rng_mul(l1, l2, p) || !rng_mul(l1, h2, p + 1)
+          || !rng_mul(h1, l2, p + 2) || !rng_mul(h1, h2, p + 3))
+            return RNG_TOP;
+         *lo = *hi = p[0];
+         for (i = 1; i < 4; i++)
+         {
+            if (p[i] < *lo) *lo = p[i];
+            if (p[i] > *hi) *hi = p[i];
+         }
+      }
+      return (rng_fits(*lo) && rng_fits(*hi)) ? RNG_OK : RNG_TOP;
+   default:
+      return RNG_TOP;
+   }
+}
+
+/*
+   Merge the range of values from an assignment into a candidate
+*/
+void rng_merge(rng_t * r, rng_res_t res, long lo, long hi)
+{
+   if (r->top)
+      return;
+
+   if (res == RNG_TOP || (res == RNG_NONE && ctx->rng_pass == RNG_STRICT))
+      rng_top(r);
+   else if (res == RNG_OK)
+   {
+      if (r->empty)
+      {
+         r->lo = lo;
+         r->hi = hi;
+         r->empty = 0;
+         ctx->rng_changed = 1;
+      } else if (lo < r->lo || hi > r->hi)
+      {
+         if (lo < r->lo) r->lo = lo;
+         if (hi > r->hi) r->hi = hi;
+         ctx->rng_changed = 1;
+         if (++r->changes > RANGE_WIDEN) /* e.g. unguarded v = v*2 */
+            rng_top(r);
+      }
+   }
+}
+
+/*
+   Count the assignments to the given variable in a
+*/
+int rng_count(ast_t * a, bind_t * bind)
+{
+   env_t * scope_save;
+   int n = 0;
+
+   if (a->tag == AST_LIDENT && find_symbol(a->sym) == bind)
+      return 1;
+
+   if (a->tag == AST_FN_STMT || a->tag == AST_FN_BODY || a->tag == AST_DATA_STMT)
+      return 0;
+
+   scope_save = ctx->current_scope;
+   if (a->tag == AST_BLOCK)
+      ctx->current_scope = a->env;
+
+   for (a = a->child; a != NULL; a = a->next)
+      n += rng_count(a, bind);
+
+   ctx->current_scope = scope_save;
+
+   return n;
+}
+
+/*
+   If a is v + k, k + v or v - k for the candidate r and a positive
+   literal k, return k (negated for v - k), otherwise return 0
+*/
+long rng_step(ast_t * a, rng_t * r)
+{
+   ast_t * a1, * a2;
+   long k;
+
+   if (a->tag != AST_BINOP)
+      return 0;
+
+   a1 = a->child;
+   a2 = a1->next;
+
+   if (a->sym == sym_lookup("+"))
+   {
+      if (rng_lookup(a1) == r && rng_literal(a2, &k))
+         return k;
+      if (rng_lookup(a2) == r && rng_literal(a1, &k))
+         return k;
+   } else if (a->sym == sym_lookup("-"))
+   {
+      if (rng_lookup(a1) == r && rng_literal(a2, &k))
+         return -k;
+   }
+
+   return 0;
+}
+
+/*
+   The assignment v = v + k is a statement of the body of the given 
+   while loop. If the loop condition bounds v from the right side and
+   v is not assigned elsewhere in the loop, compute the range of v after
+   the assignment.
+*/
+rng_res_t rng_guard(ast_t * loop, rng_t * r, long k, long * lo, long * hi)
+{
+   ast_t * cond = loop->child;
+   ast_t * e;
+   sym_t * op;
+   long l, h;
+   rng_res_t res;
+
+   if (cond->tag != AST_BINOP || rng_count(loop, r->bind) != 1)
+      return RNG_TOP;
+
+   op = cond->sym;
+   if (rng_lookup(cond->child) == r)
+      e = cond->child->next;
+   else if (rng_lookup(cond->child->next) == r)
+   {
+      e = cond->child; /* flip e < v to v > e, etc. */
+      if (op == sym_lookup("<")) op = sym_lookup(">");
+      else if (op == sym_lookup(">")) op = sym_lookup("<");
+      else if (op == sym_lookup("<=")) op = sym_lookup(">=");
+      else if (op == sym_lookup(">=")) op = sym_lookup("<=");
+   } else
+      return RNG_TOP;
+
+   if ((res = rng_expr(e, &l, &h)) != RNG_OK)
+      return res;
+
+   if (r->empty)
+      return RNG_NONE;
+
+   if (k > 0 && op == sym_lookup("<")) /* v < e so afterwards v <= e - 1 + k */
+   {
+      *lo = r->lo;
+      *hi = h - 1 + k;
+   } else if (k > 0 && op == sym_lookup("<="))
+   {
+      *lo = r->lo;
+      *hi = h + k;
+   } else if (k < 0 && op == sym_lookup(">"))
+   {
+      *lo = l + 1 + k;
+      *hi = r->hi;
+   } else if (k < 0 && op == sym_lookup(">="))
+   {
+      *lo = l + k;
+      *hi = r->hi;
+   } else
+      return RNG_TOP;
+
+   return (rng_fits(*lo) && rng_fits(*hi)) ? RNG_OK : RNG_TOP;
+}
+
+void rng_walk(ast_t * a, ast_t * loop);
+
+void rng_walk_list(ast_t * a, ast_t * loop)
+{
+   while (a != NULL)
+   {
+      rng_walk(a, loop);
+      a = a->next;
+   }
+}
+
+/*
+   Walk the function body collecting candidates or refining their 
+   ranges, depending on the pass. If a is a statement of the body of a
+   while loop, loop is that loop, otherwise it is NULL.
+*/
+void rng_walk(ast_t * a, ast_t * loop)
+{
+   env_t * scope_save;
+   ast_t * a1, * a2, * body;
+   rng_res_t res;
+   rng_t * r;
+   long lo, hi, k;
+
+   switch (a->tag)
+   {
+   case AST_BLOCK:
+      scope_save = ctx->current_scope;
+      ctx->current_scope = a->env;
+      rng_walk_list(a->child, NULL);
+      ctx->current_scope = scope_save;
+      break;
+   case AST_WHILE_STMT:
+      rng_walk(a->child, NULL); /* condition */
+      body = a->child->next->child; /* block inside the do */
+      scope_save = ctx->current_scope;
+      ctx->current_scope = body->env;
+      rng_walk_list(body->child, a);
+      ctx->current_scope = scope_save;
+      break;
+   case AST_ASSIGNMENT:
+      a1 = a->child; /* Lvalue */
+      a2 = a1->next; /* expression */
+      rng_walk(a2, NULL);
+      if (ctx->rng_pass == RNG_COLLECT)
+      {
+         if (a1->tag == AST_LIDENT)
+            rng_candidate(a1);
+         else
+            rng_walk(a1, NULL);
+      } else if ((r = rng_lookup(a1)) != NULL)
+      {
+         if ((k = rng_step(a2, r)) != 0)
+            res = loop ? rng_guard(loop, r, k, &lo, &hi) : RNG_TOP;
+         else
+            res = rng_expr(a2, &lo, &hi);
+         rng_merge(r, res, lo, hi);
+      } else if (a1->tag != AST_LIDENT)
+         rng_walk(a1, NULL);
+      break;
+   case AST_REDUCE: /* combined with the partial results of each thread */
+      rng_top(rng_lookup(a->child));
+      break;
+   case AST_RECV: /* the variable is assigned the value received */
+      rng_top(rng_lookup(a->child->next->next));
+      break;
+   case AST_LTUPLE: /* tuple assignments and unpacking aren't handled */
+      for (a1 = a->child; a1 != NULL; a1 = a1->next)
+         rng_top(rng_lookup(a1));
+      break;
+   case AST_APPL:
+   case AST_LAPPL:
+      a1 = a->child; /* function or constructor */
+      a2 = a1->next; /* arguments */
+      if (a1->tag == AST_IDENT && a1->sym == sym_lookup("swap"))
+      {
+         for ( ; a2 != NULL; a2 = a2->next)
+            rng_top(rng_lookup(a2));
+         break;
+      }
+      rng_walk(a1, NULL);
+      if (a1->type->tag == GENERIC) /* reference parameters may be assigned to */
+      {
+         type_t * fn = find_prototype(a1->type, a2);
+         int i;
+
+         for (i = 0; a2 != NULL; a2 = a2->next, i++)
+            if (fn->args[i]->tag == REF)
+               rng_top(rng_lookup(a2));
+      }
+      rng_walk_list(a1->next, NULL);
+      break;
+   case AST_FN_STMT:
+   case AST_FN_BODY:
+   case AST_DATA_STMT:
+      break;
+   default:
+      rng_walk_list(a->child, NULL);
+   }
+}
+
+/*
+   Return 1 if the expression can be computed with ints
+*/
+int rng_intable(ast_t * a)
+{
+   long lo, hi;
+
+   switch (a->tag)
+   {
+   case AST_ZZ:
+   case AST_INT:
+      return rng_literal(a, &lo);
+   case AST_IDENT:
+      return rng_demoted(a);
+   case AST_BINOP:
+      return rng_intable(a->child) && rng_intable(a->child->next)
+          && rng_expr(a, &lo, &hi) == RNG_OK;
+   default:
+      return 0;
+   }
+}
+
+/*
+   Retype an expression which is known to be computable with ints
+*/
+void rng_to_int(ast_t * a)
+{
+   if (a->tag == AST_ZZ)
+      a->tag = AST_INT;
+   
+   if (a->tag == AST_BINOP)
+   {
+      rng_to_int(a->child);
+      rng_to_int(a->child->next);
+   }
+   
+   if (a->type == ctx->t_ZZ)
+      a->type = ctx->t_int;
+}
+
+/*
+   Turn an int expression in a ZZ context into a conversion back to ZZ
+*/
+void rng_wrap(ast_t * a)
+{
+   ast_t * b = new_ast();
+   
+   *b = *a;
+   b->next = NULL;
+   b->type = ctx->t_int;
+
+   a->tag = AST_INT_TO_ZZ;
+   a->child = b;
+   a->sym = NULL;
+   a->type = ctx->t_ZZ;
+}
+
+void rng_rewrite(ast_t * a);
+
+void rng_rewrite_list(ast_t * a)
+{
+   while (a != NULL)
+   {
+      rng_rewrite(a);
+      a = a->next;
+   }
+}
+
+/*
+   Rewrite the function body to use ints for demoted variables
+*/
+void rng_rewrite(ast_t * a)
+{
+   env_t * scope_save;
+   ast_t * a1, * a2;
+
+   switch (a->tag)
+   {
+   case AST_BLOCK:
+      scope_save = ctx->current_scope;
+      ctx->current_scope = a->env;
+      rng_rewrite_list(a->child);
+      ctx->current_scope = scope_save;
+      break;
+   case AST_ASSIGNMENT:
+      a1 = a->child; /* Lvalue */
+      a2 = a1->next; /* expression */
+      if (a1->tag == AST_LIDENT && rng_demoted(a1))
+      {
+         a1->type = ctx->t_int;
+         rng_to_int(a2);
+      } else
+      {
+         rng_rewrite(a1);
+         rng_rewrite(a2);
+      }
+      break;
+   case AST_BINOP:
+      a1 = a->child;
+      a2 = a1->next;
+      if (a1->type == ctx->t_ZZ && a->type == ctx->t_bool 
+         && rng_intable(a1) && rng_intable(a2)) /* comparison */
+         rng_to_int(a);
+      else if (a->type == ctx->t_ZZ && rng_intable(a))
+      {
+         rng_to_int(a);
+         rng_wrap(a);
+      } else
+         rng_rewrite_list(a->child);
+      break;
+   case AST_IDENT:
+      if (rng_demoted(a))
+         rng_wrap(a);
+      break;
+   case AST_FN_STMT:
+   case AST_FN_BODY:
+   case AST_DATA_STMT:
+      break;
+   default:
+      rng_rewrite_list(a->child);
+   }
+}
+
+/*
+   Given the (already inferred) AST of a function body, compile local
+   ZZ variables which provably fit in a word as ints. Assumes 
+   current_scope is the scope of the function, which contains its 
+   parameters.
+*/
+void range_analysis(ast_t * a, env_t * fn_scope)
+{
+   rng_t * r;
+   
+   ctx->rng_list = NULL;
+   ctx->rng_fn_scope = fn_scope;
+
+   ctx->rng_pass = RNG_COLLECT;
+   rng_walk(a, NULL);
+
+   if (ctx->rng_list == NULL)
+      return;
+
+   ctx->rng_pass = RNG_ITERATE;
+   do
+   {
+      ctx->rng_changed = 0;
+      rng_walk(a, NULL);
+      
+      if (!ctx->rng_changed && ctx->rng_pass == RNG_ITERATE) /* check nothing is left unknown */
+      {
+         ctx->rng_pass = RNG_STRICT;
+         ctx->rng_changed = 1;
+      }
+   } while (ctx->rng_changed);
+
+   rng_rewrite(a);
+
+   for (r = ctx->rng_list; r != NULL; r = r->next)
+      if (!r->top && !r->empty)
+         r->bind->type = ctx->t_int;
+
+   ctx->rng_list = NULL;
+}
@@ -0,0 +1,78 @@
+/*
+
+Copyright 2012 William Hart. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are
+permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this list of
+      conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice, this list
+      of conditions and the following disclaimer in the documentation and/or other materials
+      provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY William Hart ``AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL William Hart OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "gc.h"
+#include "flint.h"
+#include "fmpz.h"
+
+#include "ast.h"
+#include "types.h"
+#include "environment.h"
+#include "inference.h"
+
+#ifndef RANGE_H
+#define RANGE_H
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#define RANGE_MAX COEFF_MAX /* largest value of a small fmpz */
+#if FLINT_BITS == 64
+#define RANGE_DIGITS 18 /* ZZ literals with this many digits certainly fit */
+#else
+#define RANGE_DIGITS 9
+#endif
+#define RANGE_WIDEN 8 /* give up on a variable whose range keeps growing */
+
+typedef enum
+{
+   RNG_NONE, /* nothing known yet */
+   RNG_OK, /* bounded */
+   RNG_TOP /* can't be bounded */
+} rng_res_t;
+
+typedef struct rng_t
+{
+   bind_t * bind;
+   long lo, hi; /* all values the variable can take lie in [lo, hi] */
+   int empty; /* no values seen yet */
+   int top; /* can't be bounded, or used in a way we can't handle */
+   int changes; /* number of times the range has grown */
+   struct rng_t * next;
+} rng_t;
+
+void range_analysis(ast_t * a, env_t * fn_scope);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
@@ -0,0 +1,84 @@
+/*
+
+Copyright 2014 William Hart. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are
+permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this list of
+      conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice, this list
+      of conditions and the following disclaimer in the documentation and/or other materials
+      provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY William Hart ``AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL William Hart OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/*
+   Runtime helpers called from jit'd code. As well as being compiled into
+   bacon, this file is compiled to LLVM bitcode, which is linked into the
+   jit module at startup so that the helpers can be inlined. They must 
+   not use bacon's globals, nor call any library function which bacon
+   binds itself, as the prototypes would clash in the module.
+*/
+
+#include "runtime.h"
+
+void __ZZ_init(ZZ_s * r)
+{
+   r->f = 0;
+}
+
+void __ZZ_init_set_ui(ZZ_s * r, ulong x)
+{
+   if (x <= COEFF_MAX)
+      r->f = x;
+   else
+   {
+      r->f = 0;
+      fmpz_set_ui(&r->f, x);
+   }
+}
+
+void __ZZ_init_set(ZZ_s * r, ZZ_s * a)
+{
+   if (!COEFF_IS_MPZ(a->f))
+      r->f = a->f;
+   else
+      fmpz_init_set(&r->f, &a->f);
+}
+
+/*
+   Comparisons, with the small values compared inline
+*/
+#define ZZ_CMP(__name, __op)                        \
+bool __name(ZZ_s * a, ZZ_s * b)                     \
+{                                                   \
+   if (!COEFF_IS_MPZ(a->f) && !COEFF_IS_MPZ(b->f))  \
+      return a->f __op b->f;                        \
+                                                    \
+   return fmpz_cmp(&a->f, &b->f) __op 0;            \
+}
+
+ZZ_CMP(__ZZ_lt, <)
+
+ZZ_CMP(__ZZ_gt, >)
+
+ZZ_CMP(__ZZ_lte, <=)
+
+ZZ_CMP(__ZZ_gte, >=)
+
+ZZ_CMP(__ZZ_eq, ==)
+
+ZZ_CMP(__ZZ_neq, !=)
+
@@ -0,0 +1,71 @@
+/*
+
+Copyright 2012 William Hart. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are
+permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this list of
+      conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice, this list
+      of conditions and the following disclaimer in the documentation and/or other materials
+      provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY William Hart ``AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL William Hart OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include <stdbool.h>
+
+#include "flint.h"
+#include "fmpz.h"
+
+#ifndef RUNTIME_H
+#define RUNTIME_H
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+/* 
+   Layout of a Bacon ZZ. The tag gives the bitcode the same struct name
+   that new_foreign_type looks for.
+*/
+typedef struct ZZ
+{
+   fmpz f;
+} ZZ_s;
+
+void __ZZ_init(ZZ_s * r);
+
+void __ZZ_init_set_ui(ZZ_s * r, ulong x);
+
+void __ZZ_init_set(ZZ_s * r, ZZ_s * a);
+
+bool __ZZ_lt(ZZ_s * a, ZZ_s * b);
+
+bool __ZZ_gt(ZZ_s * a, ZZ_s * b);
+
+bool __ZZ_lte(ZZ_s * a, ZZ_s * b);
+
+bool __ZZ_gte(ZZ_s * a, ZZ_s * b);
+
+bool __ZZ_eq(ZZ_s * a, ZZ_s * b);
+
+bool __ZZ_neq(ZZ_s * a, ZZ_s * b);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
@@ -26,11 +26,15 @@ ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "symbol.h"
 
-sym_t ** sym_tab;
+/*
+   The parser may look up symbols while a background compile is 
+   running on another thread
+*/
+static pthread_mutex_t sym_lock = PTHREAD_MUTEX_INITIALIZER;
 
 void sym_tab_init(void)
 {
-    sym_tab = (sym_t **) GC_MALLOC(SYM_TAB_SIZE*sizeof(sym_t *));
+    ctx->sym_tab = (sym_t **) GC_MALLOC(SYM_TAB_SIZE*sizeof(sym_t *));
 }
 
 sym_t * new_symbol(const char * name, int length)
@@ -45,8 +49,8 @@ void print_sym_tab(void)
 {
     int i;
     for (i = 0; i < SYM_TAB_SIZE; i++)
-        if (sym_tab[i])
-            printf("%s\n", sym_tab[i]->name);
+        if (ctx->sym_tab[i])
+            printf("%s\n", ctx->sym_tab[i]->name);
 }
 
 int sym_hash(const char * name, int length)
@@ -64,17 +68,26 @@ sym_t * sym_lookup(const char * name)
    int hash = sym_hash(name, length);
    sym_t * sym;
 
-   while (sym_tab[hash])
+   pthread_mutex_lock(&sym_lock);
+
+   while (ctx->sym_tab[hash])
    {
-       if (strcmp(sym_tab[hash]->name, name) == 0)
-           return sym_tab[hash];
+       if (strcmp(ctx->sym_tab[hash]->name, name) == 0)
+       {
+           sym = ctx->sym_tab[hash];
+           pthread_mutex_unlock(&sym_lock);
+           return sym;
+       }
        hash++;
        if (hash == SYM_TAB_SIZE)
            hash = 0;
    }
 
    sym = new_symbol(name, length);
-   sym_tab[hash] = sym;
+   ctx->sym_tab[hash] = sym;
+   
+   pthread_mutex_unlock(&sym_lock);
+   
    return sym;
 }
 
@@ -27,6 +27,8 @@ ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <string.h>
 #include <stdio.h>
 #include "gc.h"
+#include "thread.h"
+#include "context.h"
 
 #ifndef SYMBOL_H
 #define SYMBOL_H
@@ -41,8 +43,6 @@ typedef struct sym_t {
    char * name;
 } sym_t;
 
-extern sym_t ** sym_tab;
-
 void sym_tab_init(void);
 
 void print_sym_tab(void);
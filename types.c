@@ -26,24 +26,6 @@ ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "types.h"
 
-type_t * t_nil;
-type_t * t_bool;
-type_t * t_ZZ;
-type_t * t_int;
-type_t * t_uint;
-type_t * t_double;
-type_t * t_string;
-type_t * t_char;
-
-type_t * t_finalizer; /* initialised in ffi.c, currently */
-type_t * t_assignment;
-
-type_node_t * tuple_type_list;
-
-type_node_t * array_type_list;
-
-type_node_t * ref_type_list;
-
 type_t * new_type(char * name, typ_t tag)
 {
    type_t * t = (type_t *) GC_MALLOC(sizeof(type_t));
@@ -54,17 +36,19 @@ type_t * new_type(char * name, typ_t tag)
 
 void types_init(void)
 {
-   t_nil = new_type("nil", NIL);
-   t_bool = new_type("bool", NIL);
-   t_int = new_type("int", INT);
-   t_uint = new_type("uint", UINT);
-   t_double = new_type("double", DOUBLE);
-   t_string = new_type("string", STRING);
-   t_char = new_type("char", CHAR);
-
-   tuple_type_list = NULL;
-   array_type_list = NULL;
-   ref_type_list = NULL;
+   ctx->t_nil = new_type("nil", NIL);
+   ctx->t_bool = new_type("bool", NIL);
+   ctx->t_int = new_type("int", INT);
+   ctx->t_uint = new_type("uint", UINT);
+   ctx->t_double = new_type("double", DOUBLE);
+   ctx->t_string = new_type("string", STRING);
+   ctx->t_char = new_type("char", CHAR);
+
+   ctx->tuple_type_list = NULL;
+   ctx->array_type_list = NULL;
+   ctx->future_type_list = NULL;
+   ctx->chan_type_list = NULL;
+   ctx->ref_type_list = NULL;
 }
 
 type_t * fn_type(type_t * ret, int arity, type_t ** args)
@@ -152,9 +136,9 @@ type_t * find_finalizer(type_t * arg)
 {
    int i;
    
-   for (i = 0; i < t_finalizer->arity; i++)
+   for (i = 0; i < ctx->t_finalizer->arity; i++)
    {
-      type_t * fn = t_finalizer->args[i];
+      type_t * fn = ctx->t_finalizer->args[i];
       
       if (fn->args[0] == reference_type(arg))
          return fn;
@@ -172,9 +156,9 @@ type_t * find_assignment(type_t * type)
 {
    int i;
    
-   for (i = 0; i < t_assignment->arity; i++)
+   for (i = 0; i < ctx->t_assignment->arity; i++)
    {
-      type_t * fn = t_assignment->args[i];
+      type_t * fn = ctx->t_assignment->args[i];
       
       if (fn->args[0] == reference_type(type) 
        && fn->args[1] == reference_type(type))
@@ -216,7 +200,7 @@ type_t * tuple_type(int arity, type_t ** args)
    for (i = 0; i < arity; i++)
       t->args[i] = args[i];
 
-   type_node_t * s = tuple_type_list;
+   type_node_t * s = ctx->tuple_type_list;
 
    /* ensure we return a unique tuple type for given arg types */
    while (s != NULL)
@@ -234,8 +218,8 @@ type_t * tuple_type(int arity, type_t ** args)
 
    s = GC_MALLOC(sizeof(type_node_t));
    s->type = t;
-   s->next = tuple_type_list;
-   tuple_type_list = s;
+   s->next = ctx->tuple_type_list;
+   ctx->tuple_type_list = s;
 
    return t;
 }
@@ -272,7 +256,7 @@ type_t * array_type(type_t * el_type)
    t->tag = ARRAY;
    t->params[0] = el_type;
    
-   type_node_t * s = array_type_list;
+   type_node_t * s = ctx->array_type_list;
 
    /* ensure we return a unique array type for given arg types */
    while (s != NULL)
@@ -285,8 +269,62 @@ type_t * array_type(type_t * el_type)
 
    s = GC_MALLOC(sizeof(type_node_t));
    s->type = t;
-   s->next = array_type_list;
-   array_type_list = s;
+   s->next = ctx->array_type_list;
+   ctx->array_type_list = s;
+
+   return t;
+}
+
+type_t * future_type(type_t * res_type)
+{
+   type_t * t = (type_t *) GC_MALLOC(sizeof(type_t));
+   t->num_params = 1;
+   t->params = (type_t **) GC_MALLOC(sizeof(type_t *)*t->num_params); /* one param */
+   t->tag = FUTURE;
+   t->params[0] = res_type;
+   
+   type_node_t * s = ctx->future_type_list;
+
+   /* ensure we return a unique future type for given result type */
+   while (s != NULL)
+   {
+      if (s->type->params[0] == res_type)
+         return s->type;
+      
+      s = s->next;
+   }
+
+   s = GC_MALLOC(sizeof(type_node_t));
+   s->type = t;
+   s->next = ctx->future_type_list;
+   ctx->future_type_list = s;
+
+   return t;
+}
+
+type_t * chan_type(type_t * val_type)
+{
+   type_t * t = (type_t *) GC_MALLOC(sizeof(type_t));
+   t->num_params = 1;
+   t->params = (type_t **) GC_MALLOC(sizeof(type_t *)*t->num_params); /* one param */
+   t->tag = CHAN;
+   t->params[0] = val_type;
+   
+   type_node_t * s = ctx->chan_type_list;
+
+   /* ensure we return a unique channel type for given value type */
+   while (s != NULL)
+   {
+      if (s->type->params[0] == val_type)
+         return s->type;
+      
+      s = s->next;
+   }
+
+   s = GC_MALLOC(sizeof(type_node_t));
+   s->type = t;
+   s->next = ctx->chan_type_list;
+   ctx->chan_type_list = s;
 
    return t;
 }
@@ -311,7 +349,7 @@ type_t * reference_type(type_t * base)
    t->tag = REF;
    t->ret = base;
 
-   type_node_t * s = ref_type_list;
+   type_node_t * s = ctx->ref_type_list;
 
    /* ensure we return a unique ref type for given arg type */
    while (s != NULL)
@@ -324,8 +362,8 @@ type_t * reference_type(type_t * base)
 
    s = GC_MALLOC(sizeof(type_node_t));
    s->type = t;
-   s->next = ref_type_list;
-   ref_type_list = s;
+   s->next = ctx->ref_type_list;
+   ctx->ref_type_list = s;
 
    return t;
 }
@@ -372,6 +410,16 @@ void type_print(type_t * type)
       type_print(type->params[0]);
       printf("]\n");
       break;
+   case FUTURE:
+      printf("future[");
+      type_print(type->params[0]);
+      printf("]");
+      break;
+   case CHAN:
+      printf("chan[");
+      type_print(type->params[0]);
+      printf("]");
+      break;
    case PTR:
       printf("pointer<");
       type_print(type->ret);
@@ -29,6 +29,7 @@ ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "symbol.h"
 #include "exception.h"
+#include "context.h"
 #include "gc.h"
 
 #ifndef TYPES_H
@@ -43,7 +44,7 @@ typedef enum
    NIL, BOOL, INT, UINT, 
    DOUBLE, STRING, CHAR, 
    FN, GENERIC, ARRAY, TUPLE, DATA, 
-   CONSTRUCTOR, PTR, REF
+   CONSTRUCTOR, PTR, REF, FUTURE, CHAN
 } typ_t;
 
 typedef struct type_t
@@ -67,21 +68,6 @@ typedef struct type_node_t
    struct type_node_t * next;
 } type_node_t;
 
-extern type_t * t_nil;
-extern type_t * t_bool;
-extern type_t * t_ZZ;
-extern type_t * t_uint;
-extern type_t * t_int;
-extern type_t * t_double;
-extern type_t * t_string;
-extern type_t * t_char;
-
-extern type_t * t_finalizer;
-extern type_t * t_assignment;
-
-extern type_node_t * tuple_type_list;
-extern type_node_t * array_type_list;
-
 type_t * new_type(char * name, typ_t tag);
 
 void types_init(void);
@@ -107,6 +93,10 @@ type_t * data_type(int arity, type_t ** args, sym_t * sym,
 
 type_t * array_type(type_t * element_type);
 
+type_t * future_type(type_t * result_type);
+
+type_t * chan_type(type_t * value_type);
+
 type_t * pointer_type(type_t * base);
 
 type_t * reference_type(type_t * base);